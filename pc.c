@@ -141,10 +141,44 @@ PID=$$; p=$0; rlwrap="$(command -v rlwrap 2> /dev/null || :)"; cc="$( command -v
 
 /**************************************************************************************************/
 
+/*
+ * Define 'WITH_JIT' to have statements run often translated to machine code.
+ * This is only done on x86-64 (not Windows); elsewhere it's ignored.
+ */
+
+/* #define WITH_JIT */
+
+/**************************************************************************************************/
+
+/*
+ * Define 'WITH_THREADS' (where there are POSIX threads) for the 'parallel'
+ * command, which runs independent statements of a file taken again at once.
+ */
+
+/* #define WITH_THREADS */
+
+/**************************************************************************************************/
+
 /* Hopefully no user servicable parts below! */
 
 /**************************************************************************************************/
 
+#if defined (WITH_JIT) && ( defined (__x86_64__) || defined (__amd64__) ) && !defined (_WIN32)
+# define PC_JIT
+#endif
+
+/* Variables each thread has its own copy of (which, without threads, is the only one) */
+
+#if !defined (WITH_THREADS)
+# define THREAD_LOCAL
+#elif defined (__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+# define THREAD_LOCAL _Thread_local
+#else
+# define THREAD_LOCAL __thread
+#endif
+
+/**************************************************************************************************/
+
 #if !defined (WITHOUT_ROMAN)
 # if !defined (WITH_ROMAN)
 #  define WITH_ROMAN
@@ -258,6 +292,15 @@ PID=$$; p=$0; rlwrap="$(command -v rlwrap 2> /dev/null || :)"; cc="$( command -v
 #include <string.h>   /* strncmp, strlen, strcmp, strdup, strncat ...    */
 #include <sys/stat.h> /* S_ISDIR ...                                     */
 #include <time.h>     /* time ...                                        */
+#if defined (PC_JIT)
+# include <sys/mman.h> /* mmap, mprotect, munmap ...                     */
+# if !defined (MAP_ANONYMOUS)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
+#if defined (WITH_THREADS)
+# include <pthread.h> /* pthread_create, pthread_mutex_lock ...         */
+#endif
 #if !defined (_MSC_VER)
 # include <unistd.h>  /* getpid, getuid, getgid ...                      */
 #else
@@ -393,6 +436,22 @@ PID=$$; p=$0; rlwrap="$(command -v rlwrap 2> /dev/null || :)"; cc="$( command -v
 
 /**************************************************************************************************/
 
+/* Files are taken through mmap() on Unix-like systems (see map_file()) */
+
+#if ( !defined (__unix__) && !defined (__unix) && !defined (_AIX) && \
+      !defined (__APPLE__) && !defined (__HAIKU__) ) || defined (__ELKS__) || \
+    defined (__MINT__) || defined (__DJGPP__) || defined (_CH_)
+# if !defined (NO_MMAP)
+#  define NO_MMAP
+# endif
+#endif
+
+#if !defined (NO_MMAP) && !defined (PC_JIT)
+# include <sys/mman.h> /* mmap, munmap ...                                */
+#endif
+
+/**************************************************************************************************/
+
 #if defined (WITHOUT_LOCALE) || defined (_CH_) || defined (__atarist__) || \
     defined (__ELKS__) || defined (__DJGPP__) || defined (DOSLIKE) || \
     defined (__amiga__) || defined (Retro68) || defined (_MSC_VER)
@@ -464,6 +523,7 @@ PID=$$; p=$0; rlwrap="$(command -v rlwrap 2> /dev/null || :)"; cc="$( command -v
 
 #define AND             '&'
 #define BANG            '!'
+#define COLON           ':'
 #define COMMA           ','
 #define DIVISION        '/'
 #define EQUAL           '='
@@ -478,6 +538,7 @@ PID=$$; p=$0; rlwrap="$(command -v rlwrap 2> /dev/null || :)"; cc="$( command -v
 #define NOTHING         '\0'
 #define OR              '|'
 #define PLUS            '+'
+#define QUESTION        '?'
 #define RBRACE          '}'
 #define RBRACKET        ']'
 #define RPAREN          ')'
@@ -545,6 +606,16 @@ static size_t target_line_len = 80;
 # define INPUT_BUFF INPUT_BUFF_FB
 #endif
 
+/* Output that isn't to a terminal is fully buffered, in pieces this big */
+#if !defined (OUTPUT_BUFF)
+# define OUTPUT_BUFF ( 8 * BUFSIZ )
+#endif
+
+/* A file taken is only kept (see cache_taken()) while its steps take up no more than this */
+#if !defined (TAKE_CACHE_BYTES)
+# define TAKE_CACHE_BYTES ( 4 * 1024 * 1024 )
+#endif
+
 /**************************************************************************************************/
 
 #if defined (USE_LONG_LONG)
@@ -1018,36 +1089,108 @@ end_parsing:
 
 /**************************************************************************************************/
 
-static ULONG do_assignment_operator(char **str, char *var_name);
+typedef enum
+{
+  TOK_END,        /* End of the statement      */
+  TOK_NUMBER,     /* Numeric literal           */
+  TOK_CHAR,       /* Character constant        */
+  TOK_IDENT,      /* Variable or register name */
+  TOK_DOT,        /* '.', the last result      */
+  TOK_LPAREN,
+  TOK_LBRACE,
+  TOK_LBRACKET,
+  TOK_RPAREN,
+  TOK_RBRACE,
+  TOK_RBRACKET,
+  TOK_OR,
+  TOK_AND,
+  TOK_XOR,
+  TOK_PLUS,
+  TOK_MINUS,
+  TOK_TIMES,
+  TOK_DIVISION,
+  TOK_MODULO,
+  TOK_LESS_THAN,
+  TOK_GREATER_THAN,
+  TOK_EQUAL,
+  TOK_BANG,
+  TOK_TWIDDLE,
+  TOK_SEMI_COLON,
+  TOK_QUESTION,
+  TOK_COLON,
+  TOK_OTHER       /* Any other character       */
+} token_kind;
+
+/**************************************************************************************************/
+
+typedef struct token
+{
+  token_kind kind;
+  int        err;   /* errno from a number, or a CHAR_x problem */
+  char      *text;  /* Start of the token in the statement      */
+  size_t     len;
+  ULONG      value; /* Value of a number or character constant  */
+  size_t     close; /* Index of the closer token, for a group   */
+} token;
+
+/**************************************************************************************************/
+
 static ULONG parse_expression(char *str);  /* Top-level interface to parser */
-static ULONG assignment_expr(char **str);  /* Assignments =, +=, *=, etc    */
-static ULONG logical_or_expr(char **str);  /* Logical OR '||'               */
-static ULONG logical_and_expr(char **str); /* Logical AND '&&'              */
-static ULONG or_expr(char **str);          /* OR  '|'                       */
-static ULONG xor_expr(char **str);         /* XOR '^'                       */
-static ULONG and_expr(char **str);         /* AND '&'                       */
-static ULONG equality_expr(char **str);    /* Equality ==, !=               */
-static ULONG relational_expr(char **str);  /* Relational <, >, <=, >=       */
-static ULONG shift_expr(char **str);       /* Shifts <<, >>                 */
-static ULONG add_expression(char **str);   /* Addition/Subtraction +, -     */
-static ULONG term(char **str);             /* Multiplication/Division *,%,/ */
-static ULONG factor(char **str);           /* Negation, Logical NOT ~, !    */
-static ULONG get_value(char **str);
+static void compile_span(token **tok, token *end); /* A statement or group */
+static int get_value(token **tok, int *index);
+
+/**************************************************************************************************/
+
+static uint32_t
+hash32s(const void *buf, size_t len, uint32_t h)
+{
+  const unsigned char *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = h * 31 + p [i];
+
+  h ^= h >> 17;
+  h *= UINT32_C(0xed5ad4bb);
+  h ^= h >> 11;
+  h *= UINT32_C(0xac4c1b51);
+  h ^= h >> 15;
+  h *= UINT32_C(0x31848bab);
+  h ^= h >> 14;
+
+  return h;
+}
 
 /**************************************************************************************************/
 
 /*
- * Variables are kept in a simple singly-linked list. Not high performance,
- * but it's also an extremely small implementation.  New variables get added
- * to the head of the list.  Variables can be unset/removed by assigning no
- * value (e.g. 'var=').
+ * Variables are kept in an open-addressing hash table (linear probing) of
+ * pointers to individually allocated entries.  The table itself is grown as
+ * needed, but entries never move, so a 'variable *' stays valid until that
+ * variable is unset/removed by assigning no value (e.g. 'var=').
  */
 
+typedef enum
+{
+  REG_GT,   /* GT time register (listed first) */
+  REG_GC,   /* unsigned char                   */
+  REG_GS,   /* unsigned short                  */
+  REG_GI,   /* unsigned int                    */
+  REG_GL,   /* unsigned long                   */
+  REG_GLL,  /* unsigned long long              */
+  REG_COUNT,
+  REG_NONE = -1
+} register_id;
+
+/**************************************************************************************************/
+
 typedef struct variable
 {
   char *name;
+  size_t len;
+  uint32_t hash;
   ULONG value;
-  struct variable *next;
+  register_id reg;
 } variable;
 
 /**************************************************************************************************/
@@ -1065,33 +1208,375 @@ static arithmetic_mode_t arithmetic_mode = MODE_AUTO;
 
 /**************************************************************************************************/
 
-static variable dummy =
+/*
+ * Statements are compiled into a program of instructions for a small stack
+ * machine (see run_program()).  Anything the parser reports is compiled in
+ * as well, so messages come out in the same order each time it is run.
+ */
+
+typedef enum
 {
-  NULL, 0L, NULL
-};
+  OP_END,          /* Stop; the result is on top of the stack       */
+  OP_PUSH,         /* Push arg                                      */
+  OP_CONST,        /* Push arg, a numeric literal (errno = 0)       */
+  OP_LAST,         /* Push last_result                              */
+  OP_SET_LAST,     /* Set last_result to the top of the stack       */
+  OP_SHOW_GT,      /* Push and print the GT register                */
+  OP_LOAD,         /* Push a variable                               */
+  OP_LOAD_INC,     /* Push a variable after incrementing it (x++)   */
+  OP_LOAD_DEC,     /* Push a variable after decrementing it (x--)   */
+  OP_PRE_INC,      /* Replace the top with a variable, ++x          */
+  OP_PRE_DEC,      /* Replace the top with a variable, --x          */
+  OP_ASSIGN,       /* Store the top of the stack in a variable      */
+  OP_ASSIGN_OP,    /* Compound assignment, aux is the operator      */
+  OP_REMOVE,       /* Unset a variable at the end of an unset chain */
+  OP_UNSET,        /* Unset a variable ('x ='), pushing 0           */
+  OP_DIAG,         /* Print message arg                             */
+  OP_WARN_CONVERT, /* Set errno to aux, warn about literal arg      */
+  OP_WARN_CHAR,    /* Warn about an overlong character constant     */
+  OP_NEG,
+  OP_NOT,
+  OP_COMPL,
+  OP_LOGOR,
+  OP_LOGAND,
+  OP_OR,
+  OP_XOR,
+  OP_AND,
+  OP_EQ,
+  OP_NE,
+  OP_LT,           /* Signed comparisons (auto and signed modes)    */
+  OP_LE,
+  OP_GT,
+  OP_GE,
+  OP_ULT,          /* Unsigned comparisons                          */
+  OP_ULE,
+  OP_UGT,
+  OP_UGE,
+  OP_SHL,
+  OP_SHR,
+  OP_ADD,          /* Arithmetic with overflow checks, or unsigned  */
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_SADD,         /* Signed mode arithmetic                        */
+  OP_SSUB,
+  OP_SMUL,
+  OP_SDIV,
+  OP_SMOD,
+  OP_STORE_LAST,   /* Set last_result to arg                        */
+  OP_MUL_POW2,     /* Multiply the top by 2 ** arg (as OP_MUL)      */
+  OP_DIV_POW2,     /* Unsigned divide the top by 2 ** arg           */
+  OP_MOD_POW2,     /* Unsigned remainder: the top & arg             */
+  OP_JUMP,         /* Continue at instruction arg                   */
+  OP_JUMP_FALSE,   /* Pop, and jump to arg if it was zero           */
+  OP_POP,          /* Discard the top of the stack                  */
+  OP_PRINT,        /* Pop and print the top of the stack            */
+  OP_COMMAND,      /* Run the command named by message arg          */
+  OP_ARG,          /* Push argument arg of the function called      */
+  OP_CALL          /* Call function arg with aux arguments on top   */
+} opcode;
+
+/**************************************************************************************************/
+
+typedef struct instruction
+{
+  opcode op;
+  int    aux;
+  ULONG  arg;  /* Constant, or index of a variable or message */
+} instruction;
+
+/**************************************************************************************************/
+
+/*
+ * Variables are referred to by name, caching the lookup until variables
+ * are next added or removed (when var_generation changes).
+ */
+
+typedef struct var_ref
+{
+  const char   *name;
+  size_t        len;
+  variable     *var;
+  unsigned long gen;
+} var_ref;
+
+/**************************************************************************************************/
+
+typedef struct message
+{
+  const char *format; /* Takes a '%.*s' of text, or nothing */
+  const char *text;
+  int         len;
+} message;
+
+/**************************************************************************************************/
+
+typedef struct program
+{
+  char             *source;     /* Own copy of the statement text  */
+  arithmetic_mode_t mode;       /* Mode it was compiled for        */
+  int             (*hook)       /* Lookup hook it was compiled for */
+    (const char *name, size_t len, ULONG *val);
+  instruction      *code;
+  size_t            code_len;
+  size_t            code_size;
+  var_ref          *refs;
+  size_t            refs_len;
+  size_t            refs_size;
+  message          *msgs;
+  size_t            msgs_len;
+  size_t            msgs_size;
+  size_t            depth;      /* Stack depth while compiling     */
+  size_t            max_depth;
+  size_t            barrier;    /* Jump target; don't fold before  */
+  int               unset_mode; /* Statement was an unset ('x =')  */
+  uint32_t          hash;       /* Of source and mode, for caching */
+  struct program   *chain;      /* Next in the same cache bucket   */
+  struct program   *newer;      /* Cache entries in order of use   */
+  struct program   *older;
+#if defined (PC_JIT)
+  void             *jit;        /* Machine code, once translated   */
+  size_t            jit_size;
+  int               jit_tried;
+  unsigned          runs;
+#endif
+} program;
+
+/**************************************************************************************************/
+
+/* How far compiling a control statement got (see compile_block()) */
+
+typedef enum
+{
+  BLOCK_DONE,  /* Complete                                     */
+  BLOCK_MORE,  /* Needs more lines                             */
+  BLOCK_HELD,  /* Complete, unless the next line is an 'else' */
+  BLOCK_ERROR  /* Can't be compiled (and has been reported)   */
+} block_status;
+
+/**************************************************************************************************/
+
+/* The lines of a control statement, gathered from input until it's complete */
+
+typedef struct block_reader
+{
+  char    *text;
+  size_t   len;
+  size_t   size;
+  program *held; /* Compiled, if BLOCK_HELD */
+} block_reader;
+
+/**************************************************************************************************/
+
+/*
+ * User functions, from 'def name(a, b) = expression'.  The body is compiled
+ * for each mode it gets called in, with the arguments in slots of their own,
+ * and the results of a 'pure' function are remembered in a small memo.
+ */
+
+#define FUNCTION_MAX_ARGS 8
+#define MEMO_SIZE         64  /* Power of two */
+#define MAX_CALL_DEPTH    256
+
+typedef struct memo
+{
+  int               used;
+  arithmetic_mode_t mode;
+  ULONG             args [FUNCTION_MAX_ARGS];
+  ULONG             result;
+} memo;
+
+typedef struct function
+{
+  char       *text;                         /* Own copy of the definition */
+  const char *name;
+  size_t      len;
+  const char *arg_name [FUNCTION_MAX_ARGS];
+  size_t      arg_len [FUNCTION_MAX_ARGS];
+  int         nargs;
+  const char *body;
+  int         pure;
+  memo       *memo;                         /* MEMO_SIZE entries, if pure */
+  program    *prog [MODE_UNSIGNED + 1];     /* Body, by mode, as needed   */
+} function;
+
+static function *functions      = NULL;
+static size_t    function_count = 0;
+static size_t    functions_size = 0;
+
+/**************************************************************************************************/
+
+/*
+ * Reactive mode: an assignment 'x = expression' is kept as a rule, in its
+ * place among the others, and whenever a statement changes a variable the
+ * rules that read that value (and the rules that read theirs, and so on)
+ * are run again.  Since a script may assign a variable more than once,
+ * each rule reads the value the last rule before it wrote.
+ */
+
+typedef struct watch /* A variable some rule reads or writes */
+{
+  char          *name;
+  size_t         len;
+  uint32_t       hash;
+  struct watch  *chain;        /* Next in the same bucket   */
+  struct rule  **readers;      /* In order of seq           */
+  size_t         readers_len;
+  size_t         readers_size;
+  struct rule  **writers;      /* In order of seq           */
+  size_t         writers_len;
+  size_t         writers_size;
+  unsigned long  mark;         /* Last update to change it  */
+} watch;
+
+typedef struct dependency
+{
+  watch *var;
+  ULONG  value;   /* Written, the last time the rule ran */
+  int    present; /* Or the rule unset it                */
+} dependency;
+
+typedef struct rule
+{
+  char             *text;       /* Own copy of the statement      */
+  arithmetic_mode_t mode;
+  program          *prog;       /* Compiled when needed           */
+  unsigned long     seq;        /* Place in the order of rules    */
+  size_t            index;      /* In rules []                    */
+  watch            *target;
+  dependency       *reads;
+  size_t            reads_len;
+  dependency       *writes;
+  size_t            writes_len;
+  unsigned long     mark;       /* Last update that reached it    */
+} rule;
+
+/**************************************************************************************************/
+
+/*
+ * What happened when a file was taken: the lines echoed, and statements
+ * and control statements run, in order.  An unchanged file is taken again
+ * by going through these, with statements compiled the first time.
+ */
+
+typedef enum
+{
+  STEP_ECHO,       /* A line of the file, printed as it's read */
+  STEP_STATEMENT,  /* Given to process_statement()             */
+  STEP_EXPRESSION, /* One that was an expression               */
+  STEP_BLOCK       /* A control statement                      */
+} step_kind;
+
+typedef struct step
+{
+  step_kind     kind;
+  char         *text;
+  program      *prog; /* Expression or block, once compiled  */
+  unsigned long gen;  /* Of compile_generation, then          */
+  unsigned long wave; /* Of plan_waves(), or 0 to wait for all */
+} step;
+
+typedef struct taken_file
+{
+  char              *path;
+  dev_t              dev;
+  ino_t              ino;
+  time_t             mtime;
+  off_t              size;
+  step              *steps;
+  size_t             steps_len;
+  size_t             steps_size;
+  size_t             bytes;  /* Roughly, held by the steps */
+  size_t             limit;  /* Of bytes, if not 0         */
+  int                broken; /* Not to be cached           */
+  int                users;  /* Being taken                */
+  int                cached;
+  struct taken_file *next;   /* In the cache, newest first */
+} taken_file;
+
+/**************************************************************************************************/
+
+/* Whether assignments are kept as rules (see react_to_statement()) */
+
+static int reactive = 0;
+
+#if defined (WITH_THREADS)
+
+/* Whether a file taken again runs independent statements at once (see replay_parallel()) */
+
+static int parallel = 0;
+#endif
+
+/* Whether results, lines read and command messages go unprinted (see run_results()) */
+
+static int quiet = 0;
+
+/**************************************************************************************************/
+
+/* Statement cache statistics, readable as the builtins 'cache_hits' and 'cache_misses' */
+
+static unsigned long cache_hits   = 0;
+static unsigned long cache_misses = 0;
+
+/**************************************************************************************************/
+
+#define VAR_TABLE_MIN 64
+
+static variable    **var_table      = NULL;
+static size_t        var_table_size = 0; /* Always zero or a power of two */
+static size_t        var_count      = 0;
+static unsigned long var_generation = 0; /* Bumped as variables come and go */
 
 /**************************************************************************************************/
 
-static variable *vars = &dummy;
+/*
+ * Registers live in their own fixed array, outside the hash table, and are
+ * indexed by register_id.  Each has a precomputed mask for its width.
+ */
+
+static variable registers [REG_COUNT] =
+{
+  { (char *)"GT",  2, 0, 0, REG_GT  },
+  { (char *)"GC",  2, 0, 0, REG_GC  },
+  { (char *)"GS",  2, 0, 0, REG_GS  },
+  { (char *)"GI",  2, 0, 0, REG_GI  },
+  { (char *)"GL",  2, 0, 0, REG_GL  },
+  { (char *)"GLL", 3, 0, 0, REG_GLL }
+};
+
+static const ULONG register_mask [REG_COUNT] =
+{
+  ~(ULONG)0,        /* GT  */
+  (ULONG)UCHAR_MAX, /* GC  */
+  (ULONG)USHRT_MAX, /* GS  */
+  (ULONG)UINT_MAX,  /* GI  */
+  (ULONG)ULONG_MAX, /* GL  */
+  ~(ULONG)0         /* GLL */
+};
+
+/**************************************************************************************************/
 
 /*
  * This is a hook for external read-only variables. If it is set and we don't
  * find a variable name in our name space, we call it to look for the variable.
+ * Names are passed as a pointer and length (they needn't be NUL-terminated).
  * If it finds the name, it fills in val and returns 1.
  * If it returns 0, it didn't find the variable.
  */
 
 static int (*external_var_lookup)
-  (const char *name, ULONG *val) = (int (*)(const char *, ULONG *))NULL;
+  (const char *name, size_t len, ULONG *val) =
+    (int (*)(const char *, size_t, ULONG *))NULL;
 
 /**************************************************************************************************/
 
 /*
  * This very ugly function declaration is for the function set_var_lookup_hook
  * which accepts one argument, "func", which is a pointer to a function that
- * returns int (and accepts a char * and ULONG *).  set_var_lookup_hook
- * returns a pointer to a function that returns int and accepts char *
- * and ULONG *.
+ * returns int (and accepts a char *, size_t, and ULONG *).  set_var_lookup_hook
+ * returns a pointer to a function that returns int and accepts char *,
+ * size_t, and ULONG *.
  *
  * It's very ugly looking but fairly basic in what it does.  You pass in a
  * function to set as the variable name lookup up hook and it passes back to
@@ -1103,11 +1588,13 @@ static int(
   *set_var_lookup_hook(
     int ( *func ) (
       const char *name,
+      size_t len,
       ULONG *val))) (
   const char *name,
+  size_t len,
   ULONG *val)
 {
-  int (*old_func) (const char *name, ULONG *val) = external_var_lookup;
+  int (*old_func) (const char *name, size_t len, ULONG *val) = external_var_lookup;
 
   external_var_lookup = func;
 
@@ -1121,10 +1608,18 @@ static int(
  * can refer to it as '.' (just like bc).
  */
 
-static ULONG last_result = 0;
+static THREAD_LOCAL ULONG last_result = 0;
 static int unset_mode    = 0;
 static int unset_silent  = 0;
 
+/* Whether the statement being compiled is an assignment (or unset) */
+
+static int statement_assigns = 0;
+
+/* While a conditional is compiled again, with its messages moved in front */
+
+static int hide_diags = 0;
+
 /**************************************************************************************************/
 
 #if defined (WITH_BASE36) || defined (WITH_TERNARY)
@@ -1271,6 +1766,11 @@ print_result(ULONG value)
 #endif
   char *fields [8];
   int field_index = 0;
+  char out [4 + 8 * ( sizeof ( dec_str ) + 6 ) + 1]; /* The fields (none longer than dec_str), wrapped */
+  size_t out_len = 4;
+
+  if (quiet)
+    return;
 
 #if defined (_MSC_VER)
 # pragma warning( disable : 4127 )
@@ -1471,7 +1971,7 @@ print_result(ULONG value)
   fields [field_index++] = bin_str;
   fields [field_index] = NULL;
 
-  (void)fprintf(stdout, "    ");
+  (void)memcpy(out, "    ", 4);
 
   for (i = 0; fields [i] != NULL; i++)
     {
@@ -1479,22 +1979,24 @@ print_result(ULONG value)
 
       if (line_len > 4 && line_len + field_len > target_line_len)
         {
-          (void)fprintf(stdout, "\n     ");
+          (void)memcpy(out + out_len, "\n     ", 6);
+          out_len += 6;
           line_len = 5;
         }
 
-      (void)fprintf(stdout, "%s", fields [i]);
-
+      (void)memcpy(out + out_len, fields [i], field_len);
+      out_len  += field_len;
       line_len += field_len;
 
       if (fields [(long)i+1] != NULL)
         {
-          (void)fprintf(stdout, " ");
+          out [out_len++] = ' ';
           line_len++;
         }
     }
 
-  (void)fprintf(stdout, "\n");
+  out [out_len++] = '\n';
+  (void)fwrite(out, 1, out_len, stdout); /* In one piece */
 }
 
 /**************************************************************************************************/
@@ -1600,495 +2102,851 @@ tos_time_now(void)
 
 /**************************************************************************************************/
 
-static int
-builtin_vars(const char *name, ULONG *val)
-{
-  static int isbe;
-  static int endianed = 0;
+/*
+ * Builtin (read-only) variables.  The one table below drives both lookup and
+ * the listing shown by 'help'; builtin_value() supplies the value for an id.
+ */
 
-  if (endianed == 0)
-    {
-      int tmp = 1;
-      isbe = (*((char *)&tmp) ? 0 : 1);
-      endianed = 1;
-    }
+typedef enum
+{
+  BV_ARG_MAX,
+  BV_CACHE_HITS,
+  BV_CACHE_MISSES,
+  BV_CHAR_BIT,
+  BV_CHAR_MAX,
+  BV_CHAR_MIN,
+  BV_CHILD_MAX,
+  BV_DBG,
+  BV_ENDIAN_BIG,
+  BV_ENDIAN_LITTLE,
+  BV_EOF,
+  BV_ERRNO,
+  BV_FILESIZEBITS,
+  BV_GID,
+  BV_INT_MAX,
+  BV_INT_MIN,
+  BV_INPUT_BUFF,
+  BV_LLONG_MAX,
+  BV_LLONG_MIN,
+  BV_LONG_BIT,
+  BV_LONG_MAX,
+  BV_LONG_MIN,
+  BV_NAME_MAX,
+  BV_NIL,
+  BV_NULL,
+  BV_OPEN_MAX,
+  BV_PAGESIZE,
+  BV_PAGE_SIZE,
+  BV_PATH_MAX,
+  BV_PID,
+  BV_PIPE_BUF,
+  BV_RAND,
+  BV_RAND_MAX,
+  BV_SCHAR_MAX,
+  BV_SCHAR_MIN,
+  BV_SHRT_MAX,
+  BV_SHRT_MIN,
+  BV_SIZEOF_CHAR,
+  BV_SIZEOF_INT,
+  BV_SIZEOF_LL,
+  BV_SIZEOF_LONG,
+  BV_SIZEOF_SHORT,
+  BV_SIZEOF_VOID,
+  BV_STDERR_FILENO,
+  BV_STDIN_FILENO,
+  BV_STDOUT_FILENO,
+  BV_TIME,
+  BV_UCHAR_MAX,
+  BV_UID,
+  BV_UINT_MAX,
+  BV_ULLONG_MAX,
+  BV_ULONG_MAX,
+  BV_USHRT_MAX,
+  BV_WORD_BIT
+} builtin_id;
 
-  /* NB: Keep in sync with builtin_var_names */
-  if (strcmp(name, "ENDIAN_BIG") == 0)
-    *val = (ULONG)isbe;
-  else if (strcmp(name, "ENDIAN_LITTLE") == 0)
-    *val = (ULONG)!isbe;
-  else if (strcmp(name, "time") == 0)
-#if defined (__atarist__)
-    *val = (ULONG)tos_time_now();
-#else
-    *val = (ULONG)time(NULL);
-#endif
-  else if (strcmp(name, "rand") == 0)
-#if defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811)
-    *val = (ULONG)arc4random_uniform((uint32_t)RAND_MAX + 1);
-#else
-    *val = (ULONG)rand();
-#endif
-  else if (strcmp(name, "dbg") == 0)
-    *val = 0x82969;
-#if !defined (NO_GETPID)
-  else if (strcmp(name, "pid") == 0)
-    *val = (ULONG)getpid();
-#endif
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_GETUID)
-  else if (strcmp(name, "uid") == 0)
-    *val = (ULONG)getuid();
-#endif
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_GETGID)
-  else if (strcmp(name, "gid") == 0)
-    *val = (ULONG)getgid();
-#endif
-  else if (strcmp(name, "errno") == 0)
-    *val = (ULONG)errno;
-#if defined (USE_LONG_LONG)
-  else if (strcmp(name, "ULLONG_MAX") == 0)
-    *val = (ULONG)ULLONG_MAX;
-  else if (strcmp(name, "LLONG_MAX") == 0)
-    *val = (ULONG)LLONG_MAX;
-  else if (strcmp(name, "LLONG_MIN") == 0)
-    *val = (ULONG)LLONG_MIN;
-#endif
-  else if (strcmp(name, "LONG_MAX") == 0)
-    *val = (ULONG)LONG_MAX;
-  else if (strcmp(name, "LONG_MIN") == 0)
-    *val = (ULONG)LONG_MIN;
-  else if (strcmp(name, "INT_MAX") == 0)
-    *val = (ULONG)INT_MAX;
-  else if (strcmp(name, "INT_MIN") == 0)
-    *val = (ULONG)INT_MIN;
-  else if (strcmp(name, "INPUT_BUFF") == 0)
-    *val = (ULONG)INPUT_BUFF;
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
-  else if (strcmp(name, "ARG_MAX") == 0)
-    *val = (ULONG)sysconf(_SC_ARG_MAX);
-#endif
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
-  else if (strcmp(name, "CHILD_MAX") == 0)
-    *val = (ULONG)sysconf(_SC_CHILD_MAX);
-#endif
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
-  else if (strcmp(name, "OPEN_MAX") == 0)
-    *val = (ULONG)sysconf(_SC_OPEN_MAX);
-#endif
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_PATHCONF)
-  else if (strcmp(name, "PATH_MAX") == 0)
-    *val = (ULONG)pathconf("/", _PC_PATH_MAX);
-#endif
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_PATHCONF)
-  else if (strcmp(name, "NAME_MAX") == 0)
-    *val = (ULONG)pathconf(".", _PC_NAME_MAX);
-#endif
-  else if (strcmp(name, "CHAR_BIT") == 0)
-    *val = (ULONG)CHAR_BIT;
-  else if (strcmp(name, "CHAR_MAX") == 0)
-    *val = (ULONG)CHAR_MAX;
-  else if (strcmp(name, "CHAR_MIN") == 0)
-    *val = (ULONG)CHAR_MIN;
-  else if (strcmp(name, "SCHAR_MAX") == 0)
-    *val = (ULONG)SCHAR_MAX;
-  else if (strcmp(name, "SCHAR_MIN") == 0)
-    *val = (ULONG)SCHAR_MIN;
-  else if (strcmp(name, "UCHAR_MAX") == 0)
-    *val = (ULONG)UCHAR_MAX;
-#if defined (PIPE_BUF)
-  else if (strcmp(name, "PIPE_BUF") == 0)
-    *val = (ULONG)PIPE_BUF;
-#endif
-#if defined (_PC_FILESIZEBITS) && !defined (NO_PATHCONF)
-  else if (strcmp(name, "FILESIZEBITS") == 0)
-    *val = (ULONG)pathconf(".", _PC_FILESIZEBITS);
-#endif
-  else if (strcmp(name, "NULL") == 0)
-    *val = 0;
-  else if (strcmp(name, "nil") == 0)
-    *val = 0;
-#if defined (WORD_BIT)
-  else if (strcmp(name, "WORD_BIT") == 0)
-    *val = (ULONG)WORD_BIT;
-#endif
-#if defined (LONG_BIT)
-  else if (strcmp(name, "LONG_BIT") == 0)
-    *val = (ULONG)LONG_BIT;
-#endif
-#if defined (PAGESIZE)
-  else if (strcmp(name, "PAGESIZE") == 0)
-    *val = (ULONG)PAGESIZE;
-#endif
-#if defined (PAGE_SIZE)
-  else if (strcmp(name, "PAGE_SIZE") == 0)
-    *val = (ULONG)PAGE_SIZE;
-#endif
-  else if (strcmp(name, "SHRT_MAX") == 0)
-    *val = (ULONG)SHRT_MAX;
-  else if (strcmp(name, "SHRT_MIN") == 0)
-    *val = (ULONG)SHRT_MIN;
-  else if (strcmp(name, "USHRT_MAX") == 0)
-    *val = (ULONG)USHRT_MAX;
-  else if (strcmp(name, "UINT_MAX") == 0)
-    *val = (ULONG)UINT_MAX;
-  else if (strcmp(name, "ULONG_MAX") == 0)
-    *val = (ULONG)ULONG_MAX;
-  else if (strcmp(name, "RAND_MAX") == 0)
-    *val = (ULONG)RAND_MAX;
-  else if (strcmp(name, "EOF") == 0)
-    *val = (ULONG)EOF;
-#if !defined (_MSC_VER)
-  else if (strcmp(name, "STDIN_FILENO") == 0)
-    *val = (ULONG)STDIN_FILENO;
-  else if (strcmp(name, "STDOUT_FILENO") == 0)
-    *val = (ULONG)STDOUT_FILENO;
-  else if (strcmp(name, "STDERR_FILENO") == 0)
-    *val = (ULONG)STDERR_FILENO;
-#endif
-  else if (strcmp(name, "sizeof_char") == 0)
-    *val = (ULONG)sizeof(char);
-  else if (strcmp(name, "sizeof_short") == 0)
-    *val = (ULONG)sizeof(short);
-  else if (strcmp(name, "sizeof_int") == 0)
-    *val = (ULONG)sizeof(int);
-  else if (strcmp(name, "sizeof_long") == 0)
-    *val = (ULONG)sizeof(long);
-  else if (strcmp(name, "sizeof_ll") == 0)
-    *val = (ULONG)sizeof(LONG);
-  else if (strcmp(name, "sizeof_void") == 0)
-    *val = (ULONG)sizeof(void *);
-  else
-    return 0;
+/**************************************************************************************************/
 
-  return 1;
+static const struct
+builtin_var
+{
+  const char *name;
+  builtin_id id;
 }
 
 /**************************************************************************************************/
 
-static const char *
-builtin_var_names [] =
-{
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF)
-  "ARG_MAX",
-#endif
-  "CHAR_BIT",
-  "CHAR_MAX",
-  "CHAR_MIN",
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF)
-  "CHILD_MAX",
-#endif
-  "dbg",
-  "ENDIAN_BIG",
-  "ENDIAN_LITTLE",
-  "EOF",
-  "errno",
+builtin_table [] =
+{
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
+  { "ARG_MAX",       BV_ARG_MAX        },
+#endif
+  { "cache_hits",    BV_CACHE_HITS     },
+  { "cache_misses",  BV_CACHE_MISSES   },
+  { "CHAR_BIT",      BV_CHAR_BIT       },
+  { "CHAR_MAX",      BV_CHAR_MAX       },
+  { "CHAR_MIN",      BV_CHAR_MIN       },
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
+  { "CHILD_MAX",     BV_CHILD_MAX      },
+#endif
+  { "dbg",           BV_DBG            },
+  { "ENDIAN_BIG",    BV_ENDIAN_BIG     },
+  { "ENDIAN_LITTLE", BV_ENDIAN_LITTLE  },
+  { "EOF",           BV_EOF            },
+  { "errno",         BV_ERRNO          },
 #if defined (_PC_FILESIZEBITS) && !defined (NO_PATHCONF)
-  "FILESIZEBITS",
+  { "FILESIZEBITS",  BV_FILESIZEBITS   },
 #endif
 #if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_GETGID)
-  "gid",
+  { "gid",           BV_GID            },
+#endif
+  { "INT_MAX",       BV_INT_MAX        },
+  { "INT_MIN",       BV_INT_MIN        },
+  { "INPUT_BUFF",    BV_INPUT_BUFF     },
+#if defined (USE_LONG_LONG)
+  { "LLONG_MAX",     BV_LLONG_MAX      },
 #endif
-  "INT_MAX",
-  "INT_MIN",
-  "INPUT_BUFF",
 #if defined (USE_LONG_LONG)
-  "LLONG_MAX",
-  "LLONG_MIN",
+  { "LLONG_MIN",     BV_LLONG_MIN      },
 #endif
 #if defined (LONG_BIT)
-  "LONG_BIT",
+  { "LONG_BIT",      BV_LONG_BIT       },
 #endif
-  "LONG_MAX",
-  "LONG_MIN",
+  { "LONG_MAX",      BV_LONG_MAX       },
+  { "LONG_MIN",      BV_LONG_MIN       },
 #if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_PATHCONF)
-  "NAME_MAX",
+  { "NAME_MAX",      BV_NAME_MAX       },
 #endif
-  "nil",
-  "NULL",
-#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF)
-  "OPEN_MAX",
+  { "nil",           BV_NIL            },
+  { "NULL",          BV_NULL           },
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
+  { "OPEN_MAX",      BV_OPEN_MAX       },
 #endif
 #if defined (PAGESIZE)
-  "PAGESIZE",
+  { "PAGESIZE",      BV_PAGESIZE       },
 #endif
 #if defined (PAGE_SIZE)
-  "PAGE_SIZE",
+  { "PAGE_SIZE",     BV_PAGE_SIZE      },
 #endif
 #if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_PATHCONF)
-  "PATH_MAX",
+  { "PATH_MAX",      BV_PATH_MAX       },
 #endif
 #if !defined (NO_GETPID)
-  "pid",
+  { "pid",           BV_PID            },
 #endif
 #if defined (PIPE_BUF)
-  "PIPE_BUF",
-#endif
-  "rand",
-  "RAND_MAX",
-  "SCHAR_MAX",
-  "SCHAR_MIN",
-  "SHRT_MAX",
-  "SHRT_MIN",
-  "sizeof_char",
-  "sizeof_int",
-  "sizeof_ll",
-  "sizeof_long",
-  "sizeof_short",
-  "sizeof_void",
+  { "PIPE_BUF",      BV_PIPE_BUF       },
+#endif
+  { "rand",          BV_RAND           },
+  { "RAND_MAX",      BV_RAND_MAX       },
+  { "SCHAR_MAX",     BV_SCHAR_MAX      },
+  { "SCHAR_MIN",     BV_SCHAR_MIN      },
+  { "SHRT_MAX",      BV_SHRT_MAX       },
+  { "SHRT_MIN",      BV_SHRT_MIN       },
+  { "sizeof_char",   BV_SIZEOF_CHAR    },
+  { "sizeof_int",    BV_SIZEOF_INT     },
+  { "sizeof_ll",     BV_SIZEOF_LL      },
+  { "sizeof_long",   BV_SIZEOF_LONG    },
+  { "sizeof_short",  BV_SIZEOF_SHORT   },
+  { "sizeof_void",   BV_SIZEOF_VOID    },
+#if !defined (_MSC_VER)
+  { "STDERR_FILENO", BV_STDERR_FILENO  },
+#endif
 #if !defined (_MSC_VER)
-  "STDERR_FILENO",
-  "STDIN_FILENO",
-  "STDOUT_FILENO",
+  { "STDIN_FILENO",  BV_STDIN_FILENO   },
 #endif
-  "time",
-  "UCHAR_MAX",
+#if !defined (_MSC_VER)
+  { "STDOUT_FILENO", BV_STDOUT_FILENO  },
+#endif
+  { "time",          BV_TIME           },
+  { "UCHAR_MAX",     BV_UCHAR_MAX      },
 #if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_GETUID)
-  "uid",
+  { "uid",           BV_UID            },
 #endif
-  "UINT_MAX",
+  { "UINT_MAX",      BV_UINT_MAX       },
 #if defined (USE_LONG_LONG)
-  "ULLONG_MAX",
+  { "ULLONG_MAX",    BV_ULLONG_MAX     },
 #endif
-  "ULONG_MAX",
-  "USHRT_MAX",
+  { "ULONG_MAX",     BV_ULONG_MAX      },
+  { "USHRT_MAX",     BV_USHRT_MAX      },
 #if defined (WORD_BIT)
-  "WORD_BIT",
+  { "WORD_BIT",      BV_WORD_BIT       },
 #endif
-  NULL
+  { NULL,            (builtin_id)0     }
 };
 
 /**************************************************************************************************/
 
-typedef struct
-{
-  const char *name;
-  ULONG value;
-} var_entry;
-
-/**************************************************************************************************/
-
-typedef enum
+static void
+builtin_value(builtin_id id, ULONG *val)
 {
-  USER_VARS,
-  BUILTIN_VARS
-} varquery_type;
+  static int isbe;
+  static int endianed = 0;
 
-/**************************************************************************************************/
+  if (endianed == 0)
+    {
+      int tmp = 1;
+      isbe = (*((char *)&tmp) ? 0 : 1);
+      endianed = 1;
+    }
 
-static int
-compare_var_entries(const void *a, const void *b)
-{
-  const var_entry *var_a = (const var_entry *)a;
-  const var_entry *var_b = (const var_entry *)b;
+  switch (id)
+    {
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
+      case BV_ARG_MAX:
+        *val = (ULONG)sysconf(_SC_ARG_MAX);
+        break;
+#endif
 
-  return strcmp(var_a -> name, var_b -> name);
-}
+      case BV_CACHE_HITS:
+        *val = (ULONG)cache_hits;
+        break;
 
-/**************************************************************************************************/
+      case BV_CACHE_MISSES:
+        *val = (ULONG)cache_misses;
+        break;
 
-static var_entry *
-resize_var_entries(var_entry *entries, int count, int *capacity)
-{
-  if (count >= *capacity)
-    {
-      var_entry *new_entries;
-      *capacity *= 2;
-      new_entries = realloc(entries, (size_t)*capacity * sizeof(var_entry));
+      case BV_CHAR_BIT:
+        *val = (ULONG)CHAR_BIT;
+        break;
 
-      if (new_entries == NULL)
-        {
-          (void)fprintf(stderr, "ERROR: memory reallocation failed\n");
-          FREE(entries);
+      case BV_CHAR_MAX:
+        *val = (ULONG)CHAR_MAX;
+        break;
 
-          return NULL;
-        }
+      case BV_CHAR_MIN:
+        *val = (ULONG)CHAR_MIN;
+        break;
 
-      return new_entries;
-    }
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
+      case BV_CHILD_MAX:
+        *val = (ULONG)sysconf(_SC_CHILD_MAX);
+        break;
+#endif
 
-  return entries;
-}
+      case BV_DBG:
+        *val = 0x82969;
+        break;
 
-/**************************************************************************************************/
+      case BV_ENDIAN_BIG:
+        *val = (ULONG)isbe;
+        break;
 
-static variable *
-lookup_var(const char *name)
-{
-  variable *v;
+      case BV_ENDIAN_LITTLE:
+        *val = (ULONG)!isbe;
+        break;
 
-  for (v = vars; v; v = v -> next)
-    if (v -> name && strcmp(v -> name, name) == 0)
-      return v;
+      case BV_EOF:
+        *val = (ULONG)EOF;
+        break;
 
-  return NULL;
-}
+      case BV_ERRNO:
+        *val = (ULONG)errno;
+        break;
 
-/**************************************************************************************************/
+#if defined (_PC_FILESIZEBITS) && !defined (NO_PATHCONF)
+      case BV_FILESIZEBITS:
+        *val = (ULONG)pathconf(".", _PC_FILESIZEBITS);
+        break;
+#endif
 
-static int
-is_reserved_name(const char *name)
-{
-  if (name == NULL)
-    return 0;
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_GETGID)
+      case BV_GID:
+        *val = (ULONG)getgid();
+        break;
+#endif
 
-  if (strcmp(name, "vars"    ) == 0
-   || strcmp(name, "regs"    ) == 0
-   || strcmp(name, "help"    ) == 0
-   || strcmp(name, "take"    ) == 0
-   || strcmp(name, "mode"    ) == 0
-   || strcmp(name, "auto"    ) == 0
-   || strcmp(name, "signed"  ) == 0
-   || strcmp(name, "unsigned") == 0
-   || strcmp(name, "quit"    ) == 0)
-    return 1;
+      case BV_INT_MAX:
+        *val = (ULONG)INT_MAX;
+        break;
 
-  return 0;
-}
+      case BV_INT_MIN:
+        *val = (ULONG)INT_MIN;
+        break;
 
-/**************************************************************************************************/
+      case BV_INPUT_BUFF:
+        *val = (ULONG)INPUT_BUFF;
+        break;
 
-static variable *
-add_var(char *name, ULONG value)
-{
-  variable *v;
-  ULONG tmp;
+#if defined (USE_LONG_LONG)
+      case BV_LLONG_MAX:
+        *val = (ULONG)LLONG_MAX;
+        break;
+#endif
 
-  /* First make sure this isn't a reserved name or keyword */
+#if defined (USE_LONG_LONG)
+      case BV_LLONG_MIN:
+        *val = (ULONG)LLONG_MIN;
+        break;
+#endif
 
-  if (is_reserved_name(name))
-    {
-      (void)fprintf(stderr, "ERROR: can't assign/create '%s', is a reserved name.\n", name);
+#if defined (LONG_BIT)
+      case BV_LONG_BIT:
+        *val = (ULONG)LONG_BIT;
+        break;
+#endif
 
-      return NULL;
-    }
+      case BV_LONG_MAX:
+        *val = (ULONG)LONG_MAX;
+        break;
 
-  /* Next make sure this isn't an external read-only variable */
+      case BV_LONG_MIN:
+        *val = (ULONG)LONG_MIN;
+        break;
 
-  if (external_var_lookup)
-    if (external_var_lookup(name, &tmp) != 0)
-      {
-        (void)fprintf(stderr,
-            "ERROR: can't assign/create '%s', it is a read-only variable\n", name);
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_PATHCONF)
+      case BV_NAME_MAX:
+        *val = (ULONG)pathconf(".", _PC_NAME_MAX);
+        break;
+#endif
 
-        return NULL;
-      }
+      case BV_NIL:
+        *val = 0;
+        break;
 
-  v = malloc(sizeof ( variable ));
+      case BV_NULL:
+        *val = 0;
+        break;
 
-  if (v == NULL)
-    {
-      (void)fprintf(stderr, "ERROR: no memory to add variable '%s'\n", name);
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_SYSCONF) && !defined (_MSC_VER)
+      case BV_OPEN_MAX:
+        *val = (ULONG)sysconf(_SC_OPEN_MAX);
+        break;
+#endif
 
-      return NULL;
-    }
+#if defined (PAGESIZE)
+      case BV_PAGESIZE:
+        *val = (ULONG)PAGESIZE;
+        break;
+#endif
 
-  v -> name  = strdup(name);
-  v -> value = value;
-  v -> next  = vars;
+#if defined (PAGE_SIZE)
+      case BV_PAGE_SIZE:
+        *val = (ULONG)PAGE_SIZE;
+        break;
+#endif
 
-  vars = v; /* Set head of list to the new guy */
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_PATHCONF)
+      case BV_PATH_MAX:
+        *val = (ULONG)pathconf("/", _PC_PATH_MAX);
+        break;
+#endif
 
-  return v;
-}
+#if !defined (NO_GETPID)
+      case BV_PID:
+        *val = (ULONG)getpid();
+        break;
+#endif
 
-/**************************************************************************************************/
+#if defined (PIPE_BUF)
+      case BV_PIPE_BUF:
+        *val = (ULONG)PIPE_BUF;
+        break;
+#endif
 
-/*
- * This routine and the companion get_var() are external interfaces to the
- * variable manipulation routines.
- */
+      case BV_RAND:
+#if defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811)
+        *val = (ULONG)arc4random_uniform((uint32_t)RAND_MAX + 1);
+#else
+        *val = (ULONG)rand();
+#endif
+        break;
 
-#if defined (EXTERNAL)
-static void
-set_var(char *name, ULONG val)
-{
-  variable *v;
+      case BV_RAND_MAX:
+        *val = (ULONG)RAND_MAX;
+        break;
 
-  v = lookup_var(name);
+      case BV_SCHAR_MAX:
+        *val = (ULONG)SCHAR_MAX;
+        break;
 
-  if (v != NULL)
-    v -> value = val;
-  else
-    (void)add_var(name, val);
-}
+      case BV_SCHAR_MIN:
+        *val = (ULONG)SCHAR_MIN;
+        break;
+
+      case BV_SHRT_MAX:
+        *val = (ULONG)SHRT_MAX;
+        break;
+
+      case BV_SHRT_MIN:
+        *val = (ULONG)SHRT_MIN;
+        break;
+
+      case BV_SIZEOF_CHAR:
+        *val = (ULONG)sizeof(char);
+        break;
+
+      case BV_SIZEOF_INT:
+        *val = (ULONG)sizeof(int);
+        break;
+
+      case BV_SIZEOF_LL:
+        *val = (ULONG)sizeof(LONG);
+        break;
+
+      case BV_SIZEOF_LONG:
+        *val = (ULONG)sizeof(long);
+        break;
+
+      case BV_SIZEOF_SHORT:
+        *val = (ULONG)sizeof(short);
+        break;
+
+      case BV_SIZEOF_VOID:
+        *val = (ULONG)sizeof(void *);
+        break;
+
+#if !defined (_MSC_VER)
+      case BV_STDERR_FILENO:
+        *val = (ULONG)STDERR_FILENO;
+        break;
+#endif
+
+#if !defined (_MSC_VER)
+      case BV_STDIN_FILENO:
+        *val = (ULONG)STDIN_FILENO;
+        break;
+#endif
+
+#if !defined (_MSC_VER)
+      case BV_STDOUT_FILENO:
+        *val = (ULONG)STDOUT_FILENO;
+        break;
+#endif
+
+      case BV_TIME:
+#if defined (__atarist__)
+        *val = (ULONG)tos_time_now();
+#else
+        *val = (ULONG)time(NULL);
+#endif
+        break;
+
+      case BV_UCHAR_MAX:
+        *val = (ULONG)UCHAR_MAX;
+        break;
+
+#if !defined (__MINGW32__) && !defined (__MINGW64__) && !defined (NO_GETUID)
+      case BV_UID:
+        *val = (ULONG)getuid();
+        break;
+#endif
+
+      case BV_UINT_MAX:
+        *val = (ULONG)UINT_MAX;
+        break;
+
+#if defined (USE_LONG_LONG)
+      case BV_ULLONG_MAX:
+        *val = (ULONG)ULLONG_MAX;
+        break;
+#endif
+
+      case BV_ULONG_MAX:
+        *val = (ULONG)ULONG_MAX;
+        break;
+
+      case BV_USHRT_MAX:
+        *val = (ULONG)USHRT_MAX;
+        break;
+
+#if defined (WORD_BIT)
+      case BV_WORD_BIT:
+        *val = (ULONG)WORD_BIT;
+        break;
 #endif
 
+      default:
+        *val = 0;
+        break;
+    }
+}
+
 /**************************************************************************************************/
 
 /*
- * This function returns 1 on success of finding a variable and 0 on failure
- * to find a variable.  If a variable is found, val is filled with its value.
+ * Builtin names are found through a small open-addressing index over
+ * builtin_table, built on first use.  The set of builtins depends on the
+ * platform, so the index can't simply be generated ahead of time, but after
+ * the first lookup each name costs one hash and (almost always) one compare.
  */
 
-static int
-get_var(const char *name, ULONG *val)
+#define BUILTIN_INDEX_SIZE 128 /* Power of two, over twice the table size */
+
+static const struct builtin_var *
+find_builtin(const char *name, size_t len)
 {
-  variable *v;
+  static unsigned char index [BUILTIN_INDEX_SIZE]; /* Table position + 1 */
+  static int indexed = 0;
+  size_t i;
 
-  v = lookup_var(name);
+  if (indexed == 0)
+    {
+      size_t n;
 
-  if (v != NULL)
+      for (n = 0; builtin_table [n].name != NULL; n++)
+        {
+          const char *bname = builtin_table [n].name;
+
+          i = (size_t)hash32s(bname, strlen(bname), 0) & (BUILTIN_INDEX_SIZE - 1);
+
+          while (index [i] != 0)
+            i = (i + 1) & (BUILTIN_INDEX_SIZE - 1);
+
+          index [i] = (unsigned char)(n + 1);
+        }
+
+      indexed = 1;
+    }
+
+  i = (size_t)hash32s(name, len, 0) & (BUILTIN_INDEX_SIZE - 1);
+
+  while (index [i] != 0)
     {
-      *val = v -> value;
+      const struct builtin_var *b = &builtin_table [index [i] - 1];
 
-      return 1;
+      if (strncmp(b -> name, name, len) == 0 && b -> name [len] == '\0')
+        return b;
+
+      i = (i + 1) & (BUILTIN_INDEX_SIZE - 1);
     }
-  else if (external_var_lookup != NULL)
-    return external_var_lookup(name, val);
 
-  return 0;
+  return NULL;
 }
 
 /**************************************************************************************************/
 
 static int
-is_register(const char *name)
+builtin_vars(const char *name, size_t len, ULONG *val)
 {
-  if (name == NULL)
+  const struct builtin_var *b = find_builtin(name, len);
+
+  if (b == NULL)
     return 0;
 
-  if (strcmp(name, "GC")  == 0
-   || strcmp(name, "GS")  == 0
-   || strcmp(name, "GI")  == 0
-   || strcmp(name, "GL")  == 0
-   || strcmp(name, "GLL") == 0
-   || strcmp(name, "GT")  == 0)
-    return 1;
+  builtin_value(b -> id, val);
 
-  return 0;
+  return 1;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-truncate_register(const char *name, ULONG value)
+typedef struct
 {
-  if (strcmp(name, "GC") == 0)
-    return (unsigned char)value;
+  const char *name;
+  ULONG value;
+} var_entry;
+
+/**************************************************************************************************/
 
-  if (strcmp(name, "GS") == 0)
-    return (unsigned short)value;
+typedef enum
+{
+  USER_VARS,
+  BUILTIN_VARS
+} varquery_type;
 
-  if (strcmp(name, "GI") == 0) /*LINTED: E_CAST_INT_TO_SMALL_INT*/
-    return (unsigned int)value;
+/**************************************************************************************************/
 
-  if (strcmp(name, "GL") == 0)
-    return (unsigned long)value;
+static int
+compare_var_entries(const void *a, const void *b)
+{
+  const var_entry *var_a = (const var_entry *)a;
+  const var_entry *var_b = (const var_entry *)b;
 
-  return value;
+  return strcmp(var_a -> name, var_b -> name);
 }
 
 /**************************************************************************************************/
 
-static void
-list_vars(varquery_type type)
+static var_entry *
+resize_var_entries(var_entry *entries, int count, int *capacity)
 {
-  variable *v;
-  ULONG val;
-  int i;
-  int count = 0;
-  int capacity = 32;
+  if (count >= *capacity)
+    {
+      var_entry *new_entries;
+      *capacity *= 2;
+      new_entries = realloc(entries, (size_t)*capacity * sizeof(var_entry));
+
+      if (new_entries == NULL)
+        {
+          (void)fprintf(stderr, "ERROR: memory reallocation failed\n");
+          FREE(entries);
+
+          return NULL;
+        }
+
+      return new_entries;
+    }
+
+  return entries;
+}
+
+/**************************************************************************************************/
+
+/* Returns the slot holding name, or the empty slot where it would go */
+
+static size_t
+find_var_slot(const char *name, size_t len, uint32_t hash)
+{
+  size_t mask = var_table_size - 1;
+  size_t i    = (size_t)hash & mask;
+
+  while (var_table [i] != NULL)
+    {
+      if (var_table [i] -> hash == hash && var_table [i] -> len == len &&
+          memcmp(var_table [i] -> name, name, len) == 0)
+        return i;
+
+      i = (i + 1) & mask;
+    }
+
+  return i;
+}
+
+/**************************************************************************************************/
+
+static register_id
+find_register(const char *name, size_t len)
+{
+  if (len < 2 || len > 3 || name [0] != 'G')
+    return REG_NONE;
+
+  switch (name [1])
+    {
+      case 'T':
+        return len == 2 ? REG_GT : REG_NONE;
+
+      case 'C':
+        return len == 2 ? REG_GC : REG_NONE;
+
+      case 'S':
+        return len == 2 ? REG_GS : REG_NONE;
+
+      case 'I':
+        return len == 2 ? REG_GI : REG_NONE;
+
+      case 'L':
+        if (len == 2)
+          return REG_GL;
+
+        return name [2] == 'L' ? REG_GLL : REG_NONE;
+
+      default:
+        return REG_NONE;
+    }
+}
+
+/**************************************************************************************************/
+
+static variable *
+lookup_var(const char *name, size_t len)
+{
+  register_id reg = find_register(name, len);
+
+  if (reg != REG_NONE)
+    return &registers [reg];
+
+  if (var_count == 0)
+    return NULL;
+
+  return var_table [find_var_slot(name, len, hash32s(name, len, 0))];
+}
+
+/**************************************************************************************************/
+
+/* Double the table (keeping the load factor under 1/2), rehashing entries */
+
+static int
+grow_var_table(void)
+{
+  size_t i, j, new_size;
+  variable **new_table;
+
+  new_size  = var_table_size ? var_table_size * 2 : VAR_TABLE_MIN;
+  new_table = calloc(new_size, sizeof(variable *));
+
+  if (new_table == NULL)
+    return 0;
+
+  for (i = 0; i < var_table_size; i++)
+    if (var_table [i] != NULL)
+      {
+        j = (size_t)var_table [i] -> hash & (new_size - 1);
+
+        while (new_table [j] != NULL)
+          j = (j + 1) & (new_size - 1);
+
+        new_table [j] = var_table [i];
+      }
+
+  FREE(var_table);
+  var_table      = new_table;
+  var_table_size = new_size;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Compare a (name, len) view against a string literal */
+
+#define NAME_IS(name, len, lit) \
+  ((len) == sizeof(lit) - 1 && memcmp((name), (lit), sizeof(lit) - 1) == 0)
+
+/**************************************************************************************************/
+
+static int
+is_reserved_name(const char *name, size_t len)
+{
+  if (name == NULL)
+    return 0;
+
+  if (NAME_IS(name, len, "vars"    )
+   || NAME_IS(name, len, "regs"    )
+   || NAME_IS(name, len, "help"    )
+   || NAME_IS(name, len, "take"    )
+   || NAME_IS(name, len, "mode"    )
+   || NAME_IS(name, len, "auto"    )
+   || NAME_IS(name, len, "signed"  )
+   || NAME_IS(name, len, "unsigned")
+   || NAME_IS(name, len, "quit"    ))
+    return 1;
+
+  return 0;
+}
+
+/**************************************************************************************************/
+
+static variable *
+add_var(const char *name, size_t len, ULONG value)
+{
+  variable *v;
+  ULONG tmp;
+
+  /* First make sure this isn't a reserved name or keyword */
+
+  if (is_reserved_name(name, len))
+    {
+      (void)fprintf(stderr, "ERROR: can't assign/create '%.*s', is a reserved name.\n",
+                    (int)len, name);
+
+      return NULL;
+    }
+
+  /* Next make sure this isn't an external read-only variable */
+
+  if (external_var_lookup)
+    if (external_var_lookup(name, len, &tmp) != 0)
+      {
+        (void)fprintf(stderr,
+            "ERROR: can't assign/create '%.*s', it is a read-only variable\n", (int)len, name);
+
+        return NULL;
+      }
+
+  if ((var_count + 1) * 2 > var_table_size && !grow_var_table())
+    {
+      (void)fprintf(stderr, "ERROR: no memory to add variable '%.*s'\n", (int)len, name);
+
+      return NULL;
+    }
+
+  v = malloc(sizeof ( variable ));
+
+  if (v == NULL || (v -> name = malloc(len + 1)) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: no memory to add variable '%.*s'\n", (int)len, name);
+      FREE(v);
+
+      return NULL;
+    }
+
+  (void)memcpy(v -> name, name, len);
+  v -> name [len] = '\0';
+  v -> len   = len;
+  v -> hash  = hash32s(name, len, 0);
+  v -> value = value;
+  v -> reg   = REG_NONE;
+
+  var_table [find_var_slot(name, len, v -> hash)] = v;
+  var_count++;
+  var_generation++;
+
+  return v;
+}
+
+/**************************************************************************************************/
+
+/*
+ * This routine and the companion get_var() are external interfaces to the
+ * variable manipulation routines.
+ */
+
+#if defined (EXTERNAL)
+static void
+set_var(const char *name, ULONG val)
+{
+  variable *v;
+
+  v = lookup_var(name, strlen(name));
+
+  if (v != NULL)
+    v -> value = val;
+  else
+    (void)add_var(name, strlen(name), val);
+}
+#endif
+
+/**************************************************************************************************/
+
+/*
+ * This function returns 1 on success of finding a variable and 0 on failure
+ * to find a variable.  If a variable is found, val is filled with its value.
+ */
+
+#if defined (EXTERNAL)
+static int
+get_var(const char *name, size_t len, ULONG *val)
+{
+  variable *v;
+
+  v = lookup_var(name, len);
+
+  if (v != NULL)
+    {
+      *val = v -> value;
+
+      return 1;
+    }
+  else if (external_var_lookup != NULL)
+    return external_var_lookup(name, len, val);
+
+  return 0;
+}
+#endif
+
+/**************************************************************************************************/
+
+static ULONG
+truncate_register(const variable *v, ULONG value)
+{
+  if (v -> reg == REG_NONE)
+    return value;
+
+  return value & register_mask [v -> reg];
+}
+
+/**************************************************************************************************/
+
+static void
+list_vars(varquery_type type)
+{
+  variable *v;
+  ULONG val;
+  size_t slot;
+  int i;
+  int count = 0;
+  int capacity = 32;
 
   var_entry *entries = malloc((size_t)capacity * sizeof(var_entry));
 
@@ -2109,8 +2967,8 @@ list_vars(varquery_type type)
 
   if (type == USER_VARS)
     {
-      for (v = vars; v; v = v -> next)
-        if (v -> name && !is_register(v -> name))
+      for (slot = 0; slot < var_table_size; slot++)
+        if ((v = var_table [slot]) != NULL)
           {
             entries = resize_var_entries(entries, count, &capacity);
 
@@ -2125,19 +2983,20 @@ list_vars(varquery_type type)
     }
   else if (type == BUILTIN_VARS)
     {
-      for (i = 0; builtin_var_names [i] != NULL; i++)
-        if (get_var(builtin_var_names [i], &val))
-          {
-            entries = resize_var_entries(entries, count, &capacity);
+      for (i = 0; builtin_table [i].name != NULL; i++)
+        {
+          entries = resize_var_entries(entries, count, &capacity);
 
-            if (entries == NULL)
-              return;
+          if (entries == NULL)
+            return;
 
-            entries [count].name = builtin_var_names [i];
-            entries [count].value = val;
+          builtin_value(builtin_table [i].id, &val);
 
-            count++;
-          }
+          entries [count].name = builtin_table [i].name;
+          entries [count].value = val;
+
+          count++;
+        }
     }
   else
     {
@@ -2259,6 +3118,9 @@ print_time_reg(const char *name, ULONG value)
   size_t len;
   int retries = 0;
 
+  if (quiet)
+    return;
+
   /* xstrftime has errno extensions */
   errno = 0;
 
@@ -2303,74 +3165,23 @@ print_time_reg(const char *name, ULONG value)
 
 /**************************************************************************************************/
 
-/* Custom sort order for registers */
-
-static int
-get_reg_order(const char *name)
-{
-  if (strcmp(name, "GT") == 0)
-    return 0;
-
-  if (strcmp(name, "GC") == 0)
-    return 1;
-
-  if (strcmp(name, "GS") == 0)
-    return 2;
-
-  if (strcmp(name, "GI") == 0)
-    return 3;
-
-  if (strcmp(name, "GL") == 0)
-    return 4;
-
-  if (strcmp(name, "GLL") == 0)
-    return 5;
-
-  return 6;
-}
-
-/**************************************************************************************************/
-
-static int
-compare_reg_entries(const void *a, const void *b)
-{
-  const var_entry *var_a = (const var_entry *)a;
-  const var_entry *var_b = (const var_entry *)b;
-
-  return get_reg_order(var_a -> name) - get_reg_order(var_b -> name);
-}
-
-/**************************************************************************************************/
+/* Registers are listed in register_id order */
 
 static void
 list_regs(void)
 {
-  variable *v;
   int i;
-  int count = 0;
-  var_entry entries [6] = { 0 };
-
-  for (v = vars; v; v = v -> next)
-    if (v -> name && is_register(v -> name))
-      if (count < 6)
-        {
-          entries [count].name = v -> name;
-          entries [count].value = v -> value;
-          count++;
-        }
-
-  qsort(entries, (size_t)count, sizeof(var_entry), compare_reg_entries);
 
   (void)fprintf(stdout, "Registers:\n");
 
-  for (i = 0; i < count; i++)
+  for (i = 0; i < REG_COUNT; i++)
     {
-      if (strcmp(entries [i].name, "GT") == 0)
-        print_time_reg(entries [i].name, entries [i].value);
+      if (i == REG_GT)
+        print_time_reg(registers [i].name, registers [i].value);
       else
         {
-          (void)fprintf(stdout, "  %s:\n", entries [i].name);
-          print_result(entries [i].value);
+          (void)fprintf(stdout, "  %s:\n", registers [i].name);
+          print_result(registers [i].value);
         }
     }
 }
@@ -2567,1709 +3378,8724 @@ static char *skipwhite(char *str);
 
 /**************************************************************************************************/
 
-static void
-process_statement(char *statement)
-{
-  char *t_ptr = statement;
-  char *end;
-  ULONG value;
+/* Files being read by 'take', one inside another, and the steps of the innermost */
 
-  while (*t_ptr && isspace((unsigned char)*t_ptr))
-    t_ptr++;
+static int         take_nesting = 0;
+static taken_file *recording    = NULL;
 
-  end = t_ptr + strlen(t_ptr) - 1;
+/* Bumped when every compiled statement must be compiled again */
 
-  while (end > t_ptr && isspace((unsigned char)*end))
-    *end-- = '\0';
+static unsigned long compile_generation = 0;
 
-  if (*t_ptr == '\0')
-    return;
+/* Translating a file to C (see emit_c()), so statements aren't run */
 
-  if (strcmp(t_ptr, "take") == 0)
-    {
-      (void)fprintf(stderr, "ERROR: 'take': filename required.\n");
+static int emitting = 0;
 
-      return;
-    }
+/**************************************************************************************************/
 
-  if (strncmp(t_ptr, "take ", 5) == 0)
+static void *grow_array(void *array, size_t *size, size_t len, size_t elem_size);
+static void free_program(program *prog);
+static program *compile_statement(const char *str);
+static ULONG run_program(program *prog);
+
+/**************************************************************************************************/
+
+static void
+free_steps(taken_file *f)
+{
+  size_t i;
+
+  for (i = 0; i < f -> steps_len; i++)
     {
-      char *filename;
-      char *p = t_ptr + 5;
-      char *end_of_filename;
-      char *rest;
+      FREE(f -> steps [i].text);
+      free_program(f -> steps [i].prog);
+    }
 
-      p = skipwhite(p);
+  FREE(f -> steps);
+  f -> steps_len  = 0;
+  f -> steps_size = 0;
+  f -> bytes      = 0;
+}
 
-      if (*p == '\0')
-        {
-          (void)fprintf(stderr, "ERROR: 'take': filename required.\n");
+/**************************************************************************************************/
 
-          return;
-        }
+/*
+ * Note a step of the file being taken (which owns prog from now on).  Once
+ * the steps would hold more than the file's limit, they're let go, and the
+ * file isn't kept.
+ */
 
-      filename = p;
+static void
+add_step(step_kind kind, const char *text, program *prog)
+{
+  taken_file *f = recording;
+  char *copy = NULL;
+  step *st;
 
-      if (*p == '\'' || *p == '"')
-        {
-          char quote = *p;
-          filename = p + 1;
-          p = filename;
+  if (f == NULL || f -> broken)
+    {
+      free_program(prog);
 
-          while (*p && *p != quote)
-            p++;
+      return;
+    }
 
-          if (*p != quote)
-            {
-              (void)fprintf(stderr, "ERROR: 'take': unclosed quottion.\n");
+  f -> bytes += sizeof ( step ) + strlen(text) + 1;
 
-              return;
-            }
+  if (prog != NULL)
+    f -> bytes += sizeof ( program ) + prog -> code_len * sizeof ( instruction );
 
-          *p = '\0';
-          end_of_filename = p + 1;
-        }
-      else
-        {
-          while (*p && !isspace((unsigned char)*p))
-            p++;
+  if (f -> limit != 0 && f -> bytes > f -> limit)
+    st = NULL;
+  else if ((st = grow_array(f -> steps, &f -> steps_size, f -> steps_len, sizeof(step))) != NULL)
+    {
+      f -> steps = st;
+      copy       = strdup(text);
+    }
 
-          end_of_filename = p;
-        }
+  if (st == NULL || copy == NULL) /* Too big, or out of memory */
+    {
+      free_steps(f);
+      f -> broken = 1;
+      free_program(prog);
 
-      rest = skipwhite(end_of_filename);
+      return;
+    }
 
-      if (*rest != '\0')
+  st = &f -> steps [f -> steps_len++];
+  st -> kind = kind;
+  st -> text = copy;
+  st -> prog = prog;
+  st -> gen  = compile_generation;
+  st -> wave = 0;
+}
+
+/**************************************************************************************************/
+
+/* Whether a compiled step has to be compiled again before it's run */
+
+static int
+stale_step(const step *st)
+{
+  return st -> prog == NULL || st -> gen != compile_generation
+         || st -> prog -> mode != arithmetic_mode || st -> prog -> hook != external_var_lookup;
+}
+
+/**************************************************************************************************/
+
+/* Compile an expression step if need be (as parse_expression() would), returning 0 if that fails */
+
+static int
+ready_expression_step(step *st)
+{
+  if (stale_step(st))
+    {
+      free_program(st -> prog);
+      cache_misses++;
+      st -> gen = compile_generation;
+
+      if ((st -> prog = compile_statement(st -> text)) == NULL)
         {
-          (void)fprintf(stderr, "ERROR: 'take': extra characters after filename: '%s'\n", rest);
+          (void)fprintf(stderr, "ERROR: out of memory\n");
 
-          return;
+          return 0;
         }
-
-      take_file(filename);
     }
-  else if (strcmp(t_ptr, "vars") == 0)
+  else
+    cache_hits++;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static void
+run_expression_step(step *st)
+{
+  ULONG value;
+
+  if (!ready_expression_step(st))
+    return;
+
+  value = run_program(st -> prog);
+
+  if (!unset_mode)
+    print_result(value);
+}
+
+/**************************************************************************************************/
+
+static int is_word(const char *p, const char *end, const char *w);
+static int define_function(char *text);
+static void drop_functions(size_t count);
+static void react_to_statement(char *text);
+static void react_to_program(const program *prog);
+static void drop_rules(void);
+
+/**************************************************************************************************/
+
+/* Run one of the commands other than 'take', returning 0 if it isn't one */
+
+static int
+run_command(const char *cmd, size_t len)
+{
+  if (quiet && ( NAME_IS(cmd, len, "vars") || NAME_IS(cmd, len, "regs")
+                 || NAME_IS(cmd, len, "help") || NAME_IS(cmd, len, "mode") ))
+    return 1;
+
+  if (NAME_IS(cmd, len, "vars"))
     list_user_vars();
-  else if (strcmp(t_ptr, "regs") == 0)
+  else if (NAME_IS(cmd, len, "regs"))
     list_regs();
-  else if (strcmp(t_ptr, "help") == 0)
+  else if (NAME_IS(cmd, len, "help"))
     {
       print_current_mode();
       list_builtin_vars();
       list_regs();
       list_user_vars();
     }
-  else if (strcmp(t_ptr, "mode") == 0)
+  else if (NAME_IS(cmd, len, "mode"))
     print_current_mode();
-  else if (strcmp(t_ptr, "auto") == 0)
+  else if (NAME_IS(cmd, len, "auto"))
     {
       arithmetic_mode = MODE_AUTO;
-      (void)fprintf(stdout, "Mode set to 'auto'.\n");
+
+      if (!quiet)
+        (void)fprintf(stdout, "Mode set to 'auto'.\n");
     }
-  else if (strcmp(t_ptr, "signed") == 0)
+  else if (NAME_IS(cmd, len, "signed"))
     {
       arithmetic_mode = MODE_SIGNED;
-      (void)fprintf(stdout, "Mode set to 'signed'.\n");
+
+      if (!quiet)
+        (void)fprintf(stdout, "Mode set to 'signed'.\n");
     }
-  else if (strcmp(t_ptr, "unsigned") == 0)
+  else if (NAME_IS(cmd, len, "unsigned"))
     {
       arithmetic_mode = MODE_UNSIGNED;
-      (void)fprintf(stdout, "Mode set to 'unsigned'.\n");
+
+      if (!quiet)
+        (void)fprintf(stdout, "Mode set to 'unsigned'.\n");
+    }
+  else if (NAME_IS(cmd, len, "reactive"))
+    {
+      reactive = !reactive;
+
+      if (!reactive)
+        drop_rules();
+
+      if (!quiet)
+        (void)fprintf(stdout, "Reactive updates %s.\n", reactive ? "on" : "off");
+    }
+#if defined (WITH_THREADS)
+  else if (NAME_IS(cmd, len, "parallel"))
+    {
+      parallel = !parallel;
+
+      if (!quiet)
+        (void)fprintf(stdout, "Parallel execution %s.\n", parallel ? "on" : "off");
     }
-  else if (strcmp(t_ptr, "quit") == 0)
+#endif
+  else if (NAME_IS(cmd, len, "quit"))
     exit(0);
   else
+    return 0;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Whether run_command() knows a command, without running it */
+
+static int
+is_command(const char *cmd, size_t len)
+{
+  static const char *const names [] =
     {
-      value = parse_expression(t_ptr);
+      "vars", "regs", "help", "mode", "auto", "signed", "unsigned", "reactive", "quit"
+#if defined (WITH_THREADS)
+      , "parallel"
+#endif
+    };
+  size_t i;
 
-      if (!unset_mode)
-        print_result(value);
+  for (i = 0; i < sizeof ( names ) / sizeof ( names [0] ); i++)
+    if (strlen(names [i]) == len && memcmp(cmd, names [i], len) == 0)
+      return 1;
+
+  return 0;
+}
+
+/**************************************************************************************************/
+
+/*
+ * With --emit-c, a statement is noted as a step instead of being run.  An
+ * expression is compiled in the mode it will run in, so modes are followed,
+ * and functions are defined, so calls to them compile as calls.
+ */
+
+static void
+emit_statement(char *text)
+{
+  size_t len = strlen(text);
+  program *prog;
+
+  if (( is_word(text, text + len, "def") && define_function(text + 3) )
+      || strcmp(text, "take") == 0 || strncmp(text, "take ", 5) == 0 || is_command(text, len))
+    {
+      if (NAME_IS(text, len, "auto"))
+        arithmetic_mode = MODE_AUTO;
+      else if (NAME_IS(text, len, "signed"))
+        arithmetic_mode = MODE_SIGNED;
+      else if (NAME_IS(text, len, "unsigned"))
+        arithmetic_mode = MODE_UNSIGNED;
+
+      add_step(STEP_STATEMENT, text, NULL);
+    }
+  else if ((prog = compile_statement(text)) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+      recording -> broken = 1;
     }
+  else
+    add_step(STEP_EXPRESSION, text, prog);
 }
 
 /**************************************************************************************************/
 
 static void
-take_file(const char *filename)
+process_statement(char *statement)
 {
-  static int take_nesting = 0;
-  char buff [INPUT_BUFF];
-  char *input_line;
-#if !defined (WITH_STRTOK)
-  char *saveptr;
-#endif
-  char *token;
-  char *comment_ptr;
-  FILE *fp;
-  struct stat st;
+  char *t_ptr = statement;
+  char *end;
+  ULONG value;
 
-  if (take_nesting >= 16)
+  while (*t_ptr && isspace((unsigned char)*t_ptr))
+    t_ptr++;
+
+  end = t_ptr + strlen(t_ptr) - 1;
+
+  while (end > t_ptr && isspace((unsigned char)*end))
+    *end-- = '\0';
+
+  if (*t_ptr == '\0')
+    return;
+
+  if (emitting)
     {
-      (void)fprintf(stderr, "ERROR: 'take': nesting too deep\n");
+      emit_statement(t_ptr);
 
       return;
     }
 
-  fp = fopen(filename, "r");
+  if (recording != NULL)
+    add_step(STEP_STATEMENT, t_ptr, NULL);
 
-  if (fp == NULL)
+  if (strcmp(t_ptr, "take") == 0)
     {
-      (void)fprintf(stderr, "ERROR: 'take': '%s': %s\n", filename,
-                    (errno ? xstrerror_l (errno) : "Failed"));
+      (void)fprintf(stderr, "ERROR: 'take': filename required.\n");
 
       return;
     }
 
-  if (fstat(fileno(fp), &st) == 0 && S_ISDIR(st.st_mode))
+  if (strncmp(t_ptr, "take ", 5) == 0)
     {
-#if defined (EISDIR)
-      (void)fprintf(stderr, "ERROR: 'take': '%s': %s\n", filename, xstrerror_l(EISDIR));
-#else
-      (void)fprintf(stderr, "ERROR: 'take': '%s': Is a directory\n", filename);
-#endif
-      (void)fclose(fp);
+      char *filename;
+      char *p = t_ptr + 5;
+      char *end_of_filename;
+      char *rest;
 
-      return;
-    }
+      p = skipwhite(p);
 
-  take_nesting++;
+      if (*p == '\0')
+        {
+          (void)fprintf(stderr, "ERROR: 'take': filename required.\n");
 
-  while (always)
-    {
-#if defined (Retro68)
-      char *p = buff;
-      int c;
+          return;
+        }
 
-      if (feof(fp))
-        break;
+      filename = p;
 
-      while ((c = fgetc(fp)) != EOF && (p - buff < INPUT_BUFF - 1))
+      if (*p == '\'' || *p == '"')
         {
-          *p++ = c;
+          char quote = *p;
+          filename = p + 1;
+          p = filename;
+
+          while (*p && *p != quote)
+            p++;
 
-          if (c == '\r')
+          if (*p != quote)
             {
-              c = fgetc(fp);
+              (void)fprintf(stderr, "ERROR: 'take': unclosed quottion.\n");
 
-              if (c == '\n')
-                {
-                  if (p - buff < INPUT_BUFF - 1)
-                    *p++ = c;
-                  else
-                    ungetc(c, fp);
-                }
-              else if (c != EOF)
-                ungetc(c, fp);
-              break;
+              return;
             }
 
-          if (c == '\n')
-            break;
+          *p = '\0';
+          end_of_filename = p + 1;
         }
-
-      if (p > buff)
+      else
         {
-          char *q = p;
+          while (*p && !isspace((unsigned char)*p))
+            p++;
 
-          if (*(p-1) == '\n')
-            {
-              if (p - buff >= 2 && *(p-2) == '\r')
-                q = p - 2;
-              else
-                q = p - 1;
-            }
-          else if (*(p-1) == '\r')
-            {
-              q = p - 1;
-            }
+          end_of_filename = p;
+        }
+
+      rest = skipwhite(end_of_filename);
+
+      if (*rest != '\0')
+        {
+          (void)fprintf(stderr, "ERROR: 'take': extra characters after filename: '%s'\n", rest);
 
-          *q++ = '\n';
-          p = q;
+          return;
         }
 
-      *p = '\0';
+      take_file(filename);
+    }
+  else if (is_word(t_ptr, t_ptr + strlen(t_ptr), "def") && define_function(t_ptr + 3))
+    return;
+  else if (!run_command(t_ptr, strlen(t_ptr)))
+    {
+      if (recording != NULL && !recording -> broken)
+        recording -> steps [recording -> steps_len - 1].kind = STEP_EXPRESSION;
 
-      if (p == buff && feof(fp))
-        break;
-#else
-      if (fgets(buff, INPUT_BUFF, fp) == NULL)
-        break;
-#endif
-      if (take_nesting > 1)
-        (void)fprintf(stdout, "[%s]> %s", filename, buff);
+      if (reactive)
+        react_to_statement(t_ptr);
+      else if (recording != NULL && !recording -> broken) /* Compiled for the step, not the cache */
+        run_expression_step(&recording -> steps [recording -> steps_len - 1]);
       else
-        (void)fprintf(stdout, "%s", buff);
+        {
+          value = parse_expression(t_ptr);
 
-      input_line = strdup(buff);
+          if (!unset_mode)
+            print_result(value);
+        }
+    }
+}
 
-      if (input_line == NULL)
-        continue;
+/**************************************************************************************************/
 
-      comment_ptr = strchr(input_line, '#');
+static const char *control_keyword(char *p, const char *end);
+static block_status compile_block(const char *str, program **progp, size_t *used);
+static ULONG run_program(program *prog);
 
-      if (comment_ptr != NULL)
-        *comment_ptr = '\0';
+/**************************************************************************************************/
 
-#if defined (WITH_STRTOK)
-      token = strtok(input_line, ";");
-#else
-      token = strtok_r(input_line, ";", &saveptr);
-#endif
+static void
+forget_block(block_reader *r)
+{
+  FREE(r -> text);
+  r -> len  = 0;
+  r -> size = 0;
+
+  if (r -> held != NULL)
+    {
+      free_program(r -> held);
+      r -> held = NULL;
+    }
+}
+
+/**************************************************************************************************/
+
+static int
+append_line(block_reader *r, const char *line)
+{
+  size_t len = strlen(line);
+
+  while (len > 0 && ( line [len - 1] == '\n' || line [len - 1] == '\r' ))
+    len--;
+
+  if (r -> len + len + 2 > r -> size)
+    {
+      size_t new_size = ( r -> len + len + 2 ) * 2;
+      char *new_text  = realloc(r -> text, new_size);
 
-      while (token != NULL)
+      if (new_text == NULL)
         {
-          process_statement(token);
-#if defined (WITH_STRTOK)
-          token = strtok(NULL, ";");
-#else
-          token = strtok_r(NULL, ";", &saveptr);
-#endif
+          (void)fprintf(stderr, "ERROR: out of memory\n");
+          forget_block(r);
+
+          return 0;
         }
 
-      FREE(input_line);
+      r -> text = new_text;
+      r -> size = new_size;
     }
 
-  (void)fclose(fp);
-  take_nesting--;
+  (void)memcpy(r -> text + r -> len, line, len);
+  r -> len += len;
+  r -> text [r -> len++] = '\n';
+  r -> text [r -> len]   = '\0';
+
+  return 1;
 }
 
 /**************************************************************************************************/
 
-#if defined (__atarist__)
-static char *
-atarist_getline(char *buf, int size, int echo)
+static void
+run_block(program *prog)
 {
-  int i = 0;
-
-  if (size <= 1)
+  if (emitting)
     {
-      buf [0] = '\0';
+      add_step(STEP_BLOCK, prog -> source, prog);
 
-      return buf;
+      return;
     }
 
-  for (;;)
-    {
-      int c = Bconin(2) & 0xff;
+  (void)run_program(prog);
 
-      if (c == 0x0d || c == 0x9b)
-        {
-          if (echo)
-            {
-              Cconout('\r');
-              Cconout('\n');
-            }
+  if (reactive)
+    react_to_program(prog);
 
-          buf [i++] = '\n';
-          buf [i] = '\0';
+  if (recording != NULL)
+    add_step(STEP_BLOCK, prog -> source, prog);
+  else
+    free_program(prog);
+}
 
-          return buf;
-        }
+/**************************************************************************************************/
 
-      if (c == 0x1a || c == 0x04)
-        {
-          if (i == 0)
-            return NULL;
+static void process_line(char *line, block_reader *r);
 
-          buf [i] = '\0';
+/**************************************************************************************************/
 
-          return buf;
-        }
+/* See if the control statement read so far is complete, and if so run it */
 
-      if (c == 0x08 || c == 0x7f)
-        {
-          if (i > 0)
-            {
-              i--;
+static void
+check_block(block_reader *r)
+{
+  program *prog;
+  size_t used;
+  char *text;
+  block_status status = compile_block(r -> text, &prog, &used);
+
+  if (status == BLOCK_HELD)
+    r -> held = prog;
+  else if (status == BLOCK_ERROR)
+    {
+      if (recording != NULL)
+        recording -> broken = 1;
 
-              if (echo)
-                {
-                  Cconout('\b');
-                  Cconout(' ');
-                  Cconout('\b');
-                }
-            }
+      forget_block(r);
+    }
+  else if (status == BLOCK_DONE)
+    {
+      text      = r -> text;
+      r -> text = NULL;
+      forget_block(r);
 
-          continue;
-        }
+      run_block(prog);
+      process_line(text + used, r); /* Whatever follows it on the line */
+      FREE(text);
+    }
+}
 
-      if (i < size - 1)
-        {
-          buf [i++] = (char)c;
+/**************************************************************************************************/
 
-          if (echo)
-            Cconout(c);
-        }
-      else
-        {
-          buf [i] = '\0';
+static void
+run_held_block(block_reader *r)
+{
+  program *prog = r -> held;
 
-          return buf;
-        }
-    }
+  r -> held = NULL;
+  forget_block(r);
+
+  run_block(prog);
 }
-#endif
 
 /**************************************************************************************************/
 
+/*
+ * Process a line of input (with any comment already removed) as statements
+ * separated by ';', except that control statements are gathered up, over
+ * as many lines as they take, and then run.
+ */
+
 static void
-do_input(int echo)
+process_line(char *line, block_reader *r)
 {
-#if defined (WITH_READLINE) || \
-    defined (WITH_EDITLINE) || \
-    defined (WITH_LIBEDIT) || \
-    defined (WITH_LINENOISE)
-  char *line;
-#else
-  char buff [INPUT_BUFF];
-  char *line = buff;
-#endif
-  char *input_line;
+  char *line_end, *token, *start;
 #if !defined (WITH_STRTOK)
   char *saveptr;
 #endif
-  char *token;
-  char *comment_ptr;
-
-#if defined (WITH_READLINE) || \
-    defined (WITH_EDITLINE) || \
-    defined (WITH_LIBEDIT)
-  rl_completion_entry_function = editor_completion;
-  rl_attempted_completion_function = editor_completion_function;
-#endif
 
-#if defined (WITH_READLINE) || \
-    defined (WITH_EDITLINE) || \
-    defined (WITH_LIBEDIT)
-  while ((line = readline("")) != NULL)
-#elif defined (WITH_LINENOISE)
-  /* NB: An empty ("") prompt is not supported with upstream linenoise */
-  while ((line = linenoise(">")) != NULL)
-#elif defined (__atarist__)
-  while ((line = atarist_getline(buff, INPUT_BUFF, 1)) != NULL)
-#else
-  while (fgets(buff, INPUT_BUFF, stdin) != NULL)
-#endif
+  if (r -> text != NULL)
     {
+      start = skipwhite(line);
 
-      if (echo)
+      if (r -> held == NULL || is_word(start, start + strlen(start), "else"))
         {
-          size_t len = strlen(line);
+          if (r -> held != NULL)
+            {
+              free_program(r -> held);
+              r -> held = NULL;
+            }
 
-          while (len > 0 &&
-                 (line [len - 1] == '\n' || line [len - 1] == '\r'))
-            line [--len] = '\0';
+          if (append_line(r, line))
+            check_block(r);
 
-          (void)fprintf(stdout, "%s\n", line);
+          return;
         }
 
-#if !defined (WITH_READLINE) && !defined (WITH_EDITLINE) && \
-    !defined (WITH_LIBEDIT) && !defined (WITH_LINENOISE)
-      if (strlen(line) > 0 && line [strlen(line) - 1] == '\n')
-        line [strlen(line) - 1] = '\0';
-#endif
+      run_held_block(r);
+    }
 
-      input_line = strdup(line);
+  line_end = line + strlen(line);
 
-      if (input_line == NULL)
-        {
-#if defined (WITH_READLINE) || \
-    defined (WITH_EDITLINE) || \
-    defined (WITH_LIBEDIT)
-          FREE(line);
-#elif defined (WITH_LINENOISE)
-          linenoiseFree(line);
-          line = 0;
+#if defined (WITH_STRTOK)
+  token = strtok(line, ";");
+#else
+  token = strtok_r(line, ";", &saveptr);
 #endif
-          continue;
-        }
 
-#if defined (WITH_READLINE) || \
-    defined (WITH_EDITLINE) || \
-    defined (WITH_LIBEDIT)
-      if (*line)
-        add_history(line);
-#elif defined (WITH_LINENOISE)
-      if (*line)
-        linenoiseHistoryAdd(line);
-#endif
+  while (token != NULL)
+    {
+      start = skipwhite(token);
 
-      comment_ptr = strchr(input_line, '#');
+      if (control_keyword(start, start + strlen(start)) != NULL)
+        {
+          if (token + strlen(token) < line_end) /* Take back the rest of the line */
+            token [strlen(token)] = ';';
 
-      if (comment_ptr != NULL)
-        *comment_ptr = '\0';
+          if (append_line(r, start))
+            check_block(r);
 
-#if defined (WITH_STRTOK)
-      token = strtok(input_line, ";");
-#else
-      token = strtok_r(input_line, ";", &saveptr);
-#endif
+          return;
+        }
 
-      while (token != NULL)
-        {
-          process_statement(token);
+      process_statement(token);
 
 #if defined (WITH_STRTOK)
-          token = strtok(NULL, ";");
+      token = strtok(NULL, ";");
 #else
-          token = strtok_r(NULL, ";", &saveptr);
-#endif
-        }
-
-      FREE(input_line);
-#if defined (WITH_READLINE) || \
-    defined (WITH_EDITLINE) || \
-    defined (WITH_LIBEDIT)
-      FREE(line);
-#elif defined (WITH_LINENOISE)
-      linenoiseFree(line);
-      line = 0;
+      token = strtok_r(NULL, ";", &saveptr);
 #endif
     }
 }
 
 /**************************************************************************************************/
 
+/* At the end of input, run or complain about any control statement left */
+
 static void
-parse_args(int argc, char *argv [])
+finish_lines(block_reader *r)
 {
-  size_t i, len;
-  char *buff;
-#if !defined (WITH_STRTOK)
-  char *saveptr;
-#endif
-  char *token;
-
-  for (i = 1, len = 0; i < (size_t)argc; i++)
-    len += strlen(argv [i]) + 1;
+  if (r -> held != NULL)
+    run_held_block(r);
+  else if (r -> text != NULL)
+    {
+      (void)fprintf(stderr, "ERROR: end of input inside a control statement.\n");
+      forget_block(r);
 
-  len++;
+      if (recording != NULL)
+        recording -> broken = 1;
+    }
+}
 
-  buff = malloc(len * sizeof ( char ));
+/**************************************************************************************************/
 
-  if (buff == NULL)
-    return;
+/*
+ * Files taken are kept (up to FILE_CACHE_SIZE of them, the least recently
+ * taken going first) with the steps of taking them, and taken again from
+ * those as long as stat() finds the file unchanged.  A file can be taken
+ * while it's being taken (or evicted), so it's only freed by the last user.
+ */
 
-  buff [0] = '\0';
+#define FILE_CACHE_SIZE 16
 
-  for (i = 1; i < (size_t)argc; i++)
-    {
-      (void)strncat(buff, argv [i], len - strlen(buff) - 1);
-      (void)strncat(buff, " ", len - strlen(buff) - 1);
-    }
+static taken_file *taken_files = NULL;
+static size_t      taken_count = 0;
 
-#if defined (WITH_STRTOK)
-  token = strtok(buff, ";");
-#else
-  token = strtok_r(buff, ";", &saveptr);
-#endif
+/**************************************************************************************************/
 
-  while (token != NULL)
-    {
-      process_statement(token);
+static void
+free_taken(taken_file *f)
+{
+  free_steps(f);
+  FREE(f -> path);
+  FREE(f);
+}
 
-#if defined (WITH_STRTOK)
-      token = strtok(NULL, ";");
-#else
-      token = strtok_r(NULL, ";", &saveptr);
-#endif
-    }
+/**************************************************************************************************/
 
-  FREE(buff);
+static void
+release_taken(taken_file *f)
+{
+  if (--f -> users == 0 && !f -> cached)
+    free_taken(f);
 }
 
 /**************************************************************************************************/
 
-#if !(defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811))
-static uint32_t
-hash32s(const void *buf, size_t len, uint32_t h)
+static void
+uncache_taken(taken_file **link)
 {
-  const unsigned char *p = buf;
-  size_t i;
-
-  for (i = 0; i < len; i++)
-    h = h * 31 + p [i];
+  taken_file *f = *link;
 
-  h ^= h >> 17;
-  h *= UINT32_C(0xed5ad4bb);
-  h ^= h >> 11;
-  h *= UINT32_C(0xac4c1b51);
-  h ^= h >> 15;
-  h *= UINT32_C(0x31848bab);
-  h ^= h >> 14;
+  *link       = f -> next;
+  f -> next   = NULL;
+  f -> cached = 0;
+  taken_count--;
 
-  return h;
+  if (f -> users == 0)
+    free_taken(f);
 }
-#endif
 
 /**************************************************************************************************/
 
-int
-main(int argc, char *argv [])
+static taken_file *
+find_taken(const char *filename, const struct stat *st)
 {
-#if !(defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811))
-  FILE *f;
-  uint32_t h;
-  unsigned char rnd [4];
-#endif
+  taken_file **link;
+  taken_file *f;
 
-#if !defined (NO_LOCALE)
-  (void)setlocale (LC_ALL, "");
-#endif
+  for (link = &taken_files; ( f = *link ) != NULL; link = &f -> next)
+    if (strcmp(f -> path, filename) == 0)
+      {
+        if (f -> dev != st -> st_dev || f -> ino != st -> st_ino
+            || f -> mtime != st -> st_mtime || f -> size != st -> st_size)
+          {
+            uncache_taken(link);
 
-#if !(defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811))
-  /*LINTED: E_CAST_INT_TO_SMALL_INT*/
-  h = (uint32_t)time(NULL);
+            return NULL;
+          }
 
-# if !defined (DOSLIKE) && !defined (__atarist__) && !defined (__amiga__)
-  f = fopen("/dev/urandom", "rb");
+        *link       = f -> next; /* Now the newest */
+        f -> next   = taken_files;
+        taken_files = f;
 
-  if (f)
+        return f;
+      }
+
+  return NULL;
+}
+
+/**************************************************************************************************/
+
+static void
+cache_taken(taken_file *f)
+{
+  taken_file **link = &taken_files;
+
+  while (*link != NULL)
+    if (strcmp(( *link ) -> path, f -> path) == 0)
+      uncache_taken(link);
+    else
+      link = &( *link ) -> next;
+
+  if (taken_count == FILE_CACHE_SIZE)
     {
-      if (fread(&rnd, sizeof(rnd), 1, f) == 1)
-        h = hash32s(&rnd, sizeof(rnd), h);
+      for (link = &taken_files; ( *link ) -> next != NULL; link = &( *link ) -> next)
+        ;
 
-      (void)fclose(f);
+      uncache_taken(link);
     }
-# endif
 
-  srand(h);
+  f -> next   = taken_files;
+  f -> cached = 1;
+  taken_files = f;
+  taken_count++;
+}
+
+/**************************************************************************************************/
+
+static void
+replay_step(step *st, const char *filename)
+{
+  char *copy;
+  size_t used;
+
+  switch (st -> kind)
+    {
+      case STEP_ECHO:
+        if (quiet)
+          break;
+
+        if (take_nesting > 1)
+          (void)fprintf(stdout, "[%s]> %s", filename, st -> text);
+        else
+          (void)fputs(st -> text, stdout);
+
+        break;
+
+      case STEP_STATEMENT:
+        if ((copy = strdup(st -> text)) == NULL)
+          {
+            (void)fprintf(stderr, "ERROR: out of memory\n");
+
+            break;
+          }
+
+        process_statement(copy);
+        FREE(copy);
+        break;
+
+      case STEP_EXPRESSION:
+        if (reactive)
+          react_to_statement(st -> text);
+        else
+          run_expression_step(st);
+
+        break;
+
+      case STEP_BLOCK:
+        if (stale_step(st))
+          {
+            free_program(st -> prog);
+            st -> gen = compile_generation;
+
+            if (compile_block(st -> text, &st -> prog, &used) == BLOCK_ERROR)
+              break;
+          }
+
+        (void)run_program(st -> prog);
+
+        if (reactive)
+          react_to_program(st -> prog);
+
+        break;
+    }
+}
+
+/**************************************************************************************************/
+
+#if defined (WITH_THREADS)
+static int start_workers(void);
+static void plan_waves(taken_file *f);
+static void replay_parallel(taken_file *f, const char *filename);
 #endif
 
-  (void)set_var_lookup_hook(builtin_vars);
+/**************************************************************************************************/
+
+static void
+replay_taken(taken_file *f, const char *filename)
+{
+  taken_file *outer = recording;
+  size_t i;
 
-  (void)add_var("GC" , 0);
-  (void)add_var("GS",  0);
-  (void)add_var("GI",  0);
-  (void)add_var("GL",  0);
-  (void)add_var("GLL", 0);
-  (void)add_var("GT",  0);
+  f -> users++;
+  recording = NULL;
+  take_nesting++;
 
-  if (argc > 1)
-    parse_args(argc, argv);
+#if defined (WITH_THREADS)
+  if (parallel && start_workers())
+    replay_parallel(f, filename);
   else
-    {
-#if !defined (_MSC_VER)
-      if (isatty(STDIN_FILENO))
-#else
-      if (isatty(0))
 #endif
+  for (i = 0; i < f -> steps_len; i++)
+    replay_step(&f -> steps [i], filename);
+
+  take_nesting--;
+  recording = outer;
+  release_taken(f);
+}
+
+/**************************************************************************************************/
+
+/*
+ * Read a line of any length from fp into *buf, which is grown as needed
+ * (*size says how far) and kept for the next line, so reading a file
+ * doesn't allocate once it has seen its longest line.  The line keeps its
+ * newline (if it has one; a Mac OS line ending becomes one).  Returns *buf,
+ * or NULL at the end of the file.  If there isn't memory for a line, it's
+ * returned in pieces.
+ */
+
+static char *
+read_line(FILE *fp, char **buf, size_t *size)
+{
+  size_t len = 0;
+  char *new_buf;
+#if defined (Retro68)
+  int c;
+#endif
+
+  if (*size < INPUT_BUFF)
+    {
+      if ((new_buf = realloc(*buf, INPUT_BUFF)) == NULL)
         {
-#if defined (__atarist__)
-          if (!is_mint())
+          (void)fprintf(stderr, "ERROR: out of memory\n");
+
+          return NULL;
+        }
+
+      *buf  = new_buf;
+      *size = INPUT_BUFF;
+    }
+
+  while (always)
+    {
+      if (len + 2 > *size)
+        {
+          if ((new_buf = realloc(*buf, *size * 2)) == NULL)
             {
-              graf_mouse(M_OFF, 0);
-              Cursconf(1, 0);
+              (void)fprintf(stderr, "ERROR: out of memory\n");
+              ( *buf ) [len] = '\0';
+
+              return *buf;
             }
-#endif
-          print_herald();
+
+          *buf   = new_buf;
+          *size *= 2;
         }
 
-#if !defined (_MSC_VER)
-      do_input(!isatty(STDIN_FILENO));
+#if defined (Retro68)
+      if ((c = fgetc(fp)) == EOF)
+        break;
+
+      if (c == '\r') /* CR, or CR LF */
+        {
+          if ((c = fgetc(fp)) != '\n' && c != EOF)
+            (void)ungetc(c, fp);
+
+          c = '\n';
+        }
+
+      ( *buf ) [len++] = (char)c;
+
+      if (c == '\n')
+        break;
 #else
-      do_input(!isatty(0));
+      /*LINTED: E_ASSIGN_INT_TO_SMALL_INT*/
+      if (fgets(*buf + len, (int)( *size - len < INT_MAX ? *size - len : INT_MAX ), fp) == NULL)
+        break;
+
+      len += strlen(*buf + len);
+
+      if (len > 0 && ( *buf ) [len - 1] == '\n')
+        break;
 #endif
     }
 
-  return EXIT_SUCCESS;
+  ( *buf ) [len] = '\0';
+
+  return len > 0 ? *buf : NULL;
 }
 
 /**************************************************************************************************/
 
-#if defined (__amiga__)
-int
-WBmain(struct WBStartup *wbmsg)
+/* A file taken through mmap(), read from pos, or data is NULL if it's read with stdio */
+
+typedef struct mapped_file
 {
-  BPTR con = Open("CON:0/0/640/200/pc2", MODE_NEWFILE);
+  const char *data;
+  size_t      len;
+  size_t      pos;
+} mapped_file;
 
-  if (con)
+/**************************************************************************************************/
+
+/*
+ * Map a regular file read-only, so its lines are found in place rather
+ * than read into stdio's buffer first.  Anything else (or any file, if
+ * mmap() isn't to be had or fails) is read with stdio.
+ */
+
+static void
+map_file(FILE *fp, mapped_file *m)
+{
+#if !defined (NO_MMAP)
+  struct stat st;
+  void *data;
+#endif
+
+  m -> data = NULL;
+  m -> len  = 0;
+  m -> pos  = 0;
+
+#if !defined (NO_MMAP)
+  if (fstat(fileno(fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0
+      || (off_t)(size_t)st.st_size != st.st_size)
+    return;
+
+  data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+  if (data == MAP_FAILED)
+    return;
+
+# if defined (MADV_SEQUENTIAL)
+  (void)madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+# endif
+
+  m -> data = data;
+  m -> len  = (size_t)st.st_size;
+#else
+  (void)fp;
+#endif
+}
+
+/**************************************************************************************************/
+
+static void
+unmap_file(mapped_file *m)
+{
+#if !defined (NO_MMAP)
+  if (m -> data != NULL)
+    (void)munmap((void *)m -> data, m -> len);
+#endif
+
+  m -> data = NULL;
+}
+
+/**************************************************************************************************/
+
+/*
+ * The next line of a file, as read_line() would, from its mapping (if it
+ * has one).  The line is still copied to *buf, as it's edited in place as
+ * it's run.
+ */
+
+static char *
+next_line(FILE *fp, mapped_file *m, char **buf, size_t *size)
+{
+  const char *line, *nl;
+  size_t len;
+  char *new_buf;
+
+  if (m -> data == NULL)
+    return read_line(fp, buf, size);
+
+  if (m -> pos >= m -> len)
+    return NULL;
+
+  line = m -> data + m -> pos;
+  nl   = memchr(line, '\n', m -> len - m -> pos);
+  /*LINTED: E_PTRDIFF_OVERFLOW*/
+  len  = nl != NULL ? (size_t)(nl - line) + 1 : m -> len - m -> pos;
+
+  if (len + 1 > *size)
     {
-      SelectOutput(con);
-      SelectInput(con);
-      SelectError(con);
+      if ((new_buf = realloc(*buf, len + 1 > INPUT_BUFF ? len + 1 : INPUT_BUFF)) == NULL)
+        {
+          (void)fprintf(stderr, "ERROR: out of memory\n");
+
+          return NULL;
+        }
+
+      *buf  = new_buf;
+      *size = len + 1 > INPUT_BUFF ? len + 1 : INPUT_BUFF;
     }
 
-  char *argv [] = { "pc", NULL };
-  int rc = main(1, argv);
+  (void)memcpy(*buf, line, len);
+  ( *buf ) [len] = '\0';
+  m -> pos += len;
+
+  return *buf;
+}
+
+/**************************************************************************************************/
+
+static void
+take_file(const char *filename)
+{
+  char *buff = NULL;
+  size_t buff_size = 0;
+  char *comment_ptr;
+  block_reader reader = { NULL, 0, 0, NULL };
+  mapped_file map;
+  FILE *fp;
+  struct stat st;
+  taken_file *outer = recording;
+  taken_file *cached;
+
+  if (take_nesting >= 16)
+    {
+      (void)fprintf(stderr, "ERROR: 'take': nesting too deep\n");
+
+      return;
+    }
+
+  if (stat(filename, &st) == 0 && ( cached = find_taken(filename, &st) ) != NULL)
+    {
+      replay_taken(cached, filename);
+
+      return;
+    }
+
+  fp = fopen(filename, "r");
+
+  if (fp == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: 'take': '%s': %s\n", filename,
+                    (errno ? xstrerror_l (errno) : "Failed"));
+
+      return;
+    }
+
+  if (fstat(fileno(fp), &st) == 0 && S_ISDIR(st.st_mode))
+    {
+#if defined (EISDIR)
+      (void)fprintf(stderr, "ERROR: 'take': '%s': %s\n", filename, xstrerror_l(EISDIR));
+#else
+      (void)fprintf(stderr, "ERROR: 'take': '%s': Is a directory\n", filename);
+#endif
+      (void)fclose(fp);
+
+      return;
+    }
+
+  recording = NULL;
+
+  if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+      && st.st_mtime < time(NULL) - 1 /* Else it could change again unseen */
+      && st.st_size <= TAKE_CACHE_BYTES /* Else its lines would be copied, only to be let go */
+      && ( recording = calloc(1, sizeof ( taken_file )) ) != NULL)
+    {
+      recording -> dev   = st.st_dev;
+      recording -> ino   = st.st_ino;
+      recording -> mtime = st.st_mtime;
+      recording -> size  = st.st_size;
+      recording -> limit = TAKE_CACHE_BYTES;
+
+      if ((recording -> path = strdup(filename)) == NULL)
+        recording -> broken = 1;
+    }
+
+  take_nesting++;
+  map_file(fp, &map);
+
+  while (next_line(fp, &map, &buff, &buff_size) != NULL)
+    {
+      if (!quiet && take_nesting > 1)
+        (void)fprintf(stdout, "[%s]> %s", filename, buff);
+      else if (!quiet)
+        (void)fputs(buff, stdout);
+
+      if (recording != NULL)
+        add_step(STEP_ECHO, buff, NULL);
+
+      comment_ptr = strchr(buff, '#');
+
+      if (comment_ptr != NULL)
+        *comment_ptr = '\0';
+
+      process_line(buff, &reader); /* In place, as it's been echoed and noted */
+    }
+
+  FREE(buff);
+  finish_lines(&reader);
+
+  if (( map.data != NULL ? map.pos < map.len : ferror(fp) || !feof(fp) ) /* Or stopped short */
+      && recording != NULL)
+    recording -> broken = 1;
+
+  unmap_file(&map);
+  (void)fclose(fp);
+  take_nesting--;
+
+  if (recording != NULL)
+    {
+      if (recording -> broken)
+        free_taken(recording);
+      else
+        {
+#if defined (WITH_THREADS)
+          plan_waves(recording);
+#endif
+          cache_taken(recording);
+        }
+    }
+
+  recording = outer;
+}
+
+/**************************************************************************************************/
+
+/*
+ * pc --emit-c file translates a file, as it would be taken, into C: each
+ * expression and control statement becomes a function, as does the body of
+ * each function for each mode (and set of functions) it's called with.  The
+ * result includes pcrt.h, a small runtime for variables, printing, modes
+ * and calls, and never the interpreter, so whatever only the interpreter
+ * can do ('take', 'reactive', 'parallel', 'vars', 'help', and defining a
+ * function again) can't be translated.
+ */
+
+static program *compile_function(function *fn, arithmetic_mode_t mode);
+
+/* A function body to translate: for a mode, with the first so many functions defined */
+
+typedef struct emitted_body
+{
+  size_t            index;
+  arithmetic_mode_t mode;
+  size_t            functions;
+} emitted_body;
+
+static emitted_body *emit_bodies      = NULL;
+static size_t        emit_bodies_len  = 0;
+static size_t        emit_bodies_size = 0;
+static size_t        emit_functions   = 0; /* Defined when the program emitted was compiled */
+
+static void
+emit_string(FILE *out, const char *text, size_t len)
+{
+  size_t i;
+
+  (void)fputc('"', out);
+
+  for (i = 0; i < len; i++)
+    {
+      unsigned char c = (unsigned char)text [i];
+
+      if (c == '"' || c == '\\' || c == '?') /* '?' for trigraphs */
+        (void)fprintf(out, "\\%c", c);
+      else if (c == '\n')
+        (void)fputs("\\n", out);
+      else if (isprint(c))
+        (void)fputc(c, out);
+      else
+        (void)fprintf(out, "\\%03o", c);
+    }
+
+  (void)fputc('"', out);
+}
+
+/**************************************************************************************************/
+
+static void
+emit_ulong(FILE *out, ULONG value)
+{
+#if defined (USE_LONG_LONG)
+  (void)fprintf(out, "(ULONG)0x%llxULL", value);
+#else
+  (void)fprintf(out, "(ULONG)0x%lxUL", value);
+#endif
+}
+
+/**************************************************************************************************/
+
+static const char *
+mode_name(arithmetic_mode_t mode)
+{
+  return mode == MODE_SIGNED ? "MODE_SIGNED" : mode == MODE_UNSIGNED ? "MODE_UNSIGNED" : "MODE_AUTO";
+}
+
+/**************************************************************************************************/
+
+/* The C for one instruction, doing just what execute() does for it */
+
+static int
+emit_instruction(FILE *out, const program *prog, const instruction *ip)
+{
+  static const char *const compare [] = { "==", "!=", "<", "<=", ">", ">=" };
+  static const char operator [] = "|&^+-*/%<>"; /* By token, from TOK_OR */
+  const char *pop = "  val = *sp--;\n";
+  const char *ref;
+  size_t arg = (size_t)ip -> arg;
+
+  switch (ip -> op)
+    {
+      case OP_END:
+        (void)fprintf(out, "  return *sp;\n");
+        break;
+
+      case OP_PUSH:
+      case OP_CONST:
+        (void)fprintf(out, "  %s*++sp = ", ip -> op == OP_CONST ? "errno = 0;\n  " : "");
+        emit_ulong(out, ip -> arg);
+        (void)fprintf(out, ";\n");
+        break;
+
+      case OP_LAST:
+        (void)fprintf(out, "  *++sp = last_result;\n");
+        break;
+
+      case OP_SET_LAST:
+        (void)fprintf(out, "  last_result = *sp;\n");
+        break;
+
+      case OP_SHOW_GT:
+        (void)fprintf(out, "  *++sp = registers [REG_GT].value;\n"
+                           "  print_time_reg(registers [REG_GT].name, *sp);\n");
+        break;
+
+      case OP_LOAD:
+        (void)fprintf(out, "  (void)load_var(&refs [%lu], ++sp);\n", (unsigned long)arg);
+        break;
+
+      case OP_LOAD_INC:
+      case OP_LOAD_DEC:
+        (void)fprintf(out, "  if (load_var(&refs [%lu], ++sp))\n"
+                           "    *sp = step_var(&refs [%lu], *sp, %d);\n",
+                      (unsigned long)arg, (unsigned long)arg, ip -> op == OP_LOAD_INC ? 1 : -1);
+        break;
+
+      case OP_PRE_INC:
+      case OP_PRE_DEC:
+        (void)fprintf(out, "  if ((v = ref_var(&refs [%lu])) != NULL\n"
+                           "      || (v = add_var(&refs [%lu], 0)) != NULL)\n"
+                           "    {\n"
+                           "      v -> value %s;\n"
+                           "      v -> value = truncate_register(v, v -> value);\n"
+                           "      *sp = v -> value;\n"
+                           "    }\n",
+                      (unsigned long)arg, (unsigned long)arg, ip -> op == OP_PRE_INC ? "++" : "--");
+        break;
+
+      case OP_ASSIGN:
+        (void)fprintf(out, "  store_var(&refs [%lu], *sp);\n", (unsigned long)arg);
+        break;
+
+      case OP_ASSIGN_OP:
+        (void)fprintf(out, "  *sp = assign_operator(&refs [%lu], '%c', *sp);\n", (unsigned long)arg,
+                      operator [ip -> aux - TOK_OR]);
+        break;
+
+      case OP_REMOVE:
+      case OP_UNSET:
+        ref = prog -> refs [arg].name;
+        (void)fprintf(out, "  existed = remove_var(refs [%lu].name, refs [%lu].len);\n",
+                      (unsigned long)arg, (unsigned long)arg);
+
+        if (!ip -> aux)
+          {
+            (void)fprintf(out, "  if (existed)\n"
+                               "    (void)fprintf(stdout, \"Variable '%%.*s' unset.\\n\", %d, ",
+                          (int)prog -> refs [arg].len);
+            emit_string(out, ref, prog -> refs [arg].len);
+            (void)fprintf(out, ");\n");
+
+            if (ip -> op == OP_UNSET)
+              {
+                (void)fprintf(out, "  else\n"
+                                   "    (void)fprintf(stderr, \"Warning: no such variable "
+                                   "'%%.*s'.\\n\", %d, ", (int)prog -> refs [arg].len);
+                emit_string(out, ref, prog -> refs [arg].len);
+                (void)fprintf(out, ");\n");
+              }
+          }
+        else
+          (void)fprintf(out, "  (void)existed;\n");
+
+        if (ip -> op == OP_UNSET)
+          (void)fprintf(out, "  *++sp = 0;\n");
+        break;
+
+      case OP_DIAG:
+        (void)fprintf(out, "  (void)fprintf(stderr, msgs [%lu].format, msgs [%lu].len, "
+                           "msgs [%lu].text);\n", (unsigned long)arg, (unsigned long)arg,
+                      (unsigned long)arg);
+        break;
+
+      case OP_WARN_CONVERT:
+        (void)fprintf(out, "  errno = %d;\n"
+                           "  (void)fprintf(stderr, \"Warning when converting input%%s%%.*s%%s: "
+                           "%%s\\n\",\n"
+                           "                msgs [%lu].len > 0 ? \" '\" : \"\", msgs [%lu].len, "
+                           "msgs [%lu].text,\n"
+                           "                msgs [%lu].len > 0 ? \"'\" : \"\", "
+                           "xstrerror_l(errno));\n", ip -> aux, (unsigned long)arg, (unsigned long)arg,
+                      (unsigned long)arg, (unsigned long)arg);
+        break;
+
+      case OP_WARN_CHAR:
+        (void)fprintf(out, "  (void)fprintf(stderr, \"Warning: character constant not "
+                           "terminated or too long (max len == %%ld bytes)\\n\", (long)sizeof ( LONG ));\n");
+        break;
+
+      case OP_NEG:
+        (void)fprintf(out, "  *sp = (ULONG)0 - *sp;\n");
+        break;
+
+      case OP_NOT:
+        (void)fprintf(out, "  *sp = !*sp;\n");
+        break;
+
+      case OP_COMPL:
+        (void)fprintf(out, "  *sp = ~*sp;\n");
+        break;
+
+      case OP_LOGOR:
+      case OP_LOGAND:
+        (void)fprintf(out, "%s  *sp = ( val %s *sp );\n", pop, ip -> op == OP_LOGOR ? "||" : "&&");
+        break;
+
+      case OP_OR:
+      case OP_XOR:
+      case OP_AND:
+        (void)fprintf(out, "%s  *sp %s= val;\n", pop,
+                      ip -> op == OP_OR ? "|" : ip -> op == OP_XOR ? "^" : "&");
+        break;
+
+      case OP_EQ:
+      case OP_NE:
+        (void)fprintf(out, "%s  *sp = ( *sp %s val );\n", pop, compare [ip -> op - OP_EQ]);
+        break;
+
+      case OP_LT:
+      case OP_LE:
+      case OP_GT:
+      case OP_GE:
+        (void)fprintf(out, "%s  *sp = ((LONG)*sp %s (LONG)val );\n", pop,
+                      compare [ip -> op - OP_LT + 2]);
+        break;
+
+      case OP_ULT:
+      case OP_ULE:
+      case OP_UGT:
+      case OP_UGE:
+        (void)fprintf(out, "%s  *sp = (*sp %s val);\n", pop, compare [ip -> op - OP_ULT + 2]);
+        break;
+
+      case OP_SHL:
+      case OP_SHR:
+        (void)fprintf(out, "%s"
+                           "  if (val >= sizeof(ULONG) * CHAR_BIT)\n"
+                           "    {\n"
+                           "      errno = EINVAL;\n"
+                           "      (void)fprintf(stderr, \"Warning: %%s (Shift too many bits)\\n\",\n"
+                           "                    xstrerror_l(errno));\n"
+                           "    }\n"
+                           "  bits = val;\n"
+                           "  *sp %s= bits;\n", pop, ip -> op == OP_SHL ? "<<" : ">>");
+        break;
+
+      case OP_ADD:
+        (void)fprintf(out, "%s"
+                           "  if (*sp > (ULONG)-1 - val)\n"
+                           "    errno = ERANGE;\n"
+                           "  *sp += val;\n", pop);
+        break;
+
+      case OP_SUB:
+        (void)fprintf(out, "%s"
+                           "  if (sub_overflows(*sp, val))\n"
+                           "    errno = ERANGE;\n"
+                           "  *sp -= val;\n", pop);
+        break;
+
+      case OP_MUL:
+        (void)fprintf(out, "%s"
+                           "  if (val != 0 && *sp > (ULONG)-1 / val)\n"
+                           "    errno = ERANGE;\n"
+                           "  *sp *= val;\n", pop);
+        break;
+
+      case OP_DIV:
+      case OP_SDIV:
+      case OP_MOD:
+      case OP_SMOD:
+        (void)fprintf(out, "%s"
+                           "  if (val == 0)\n"
+                           "    {\n"
+                           "      errno = EDOM;\n"
+                           "      (void)fprintf(stderr, \"Warning: %%s (%s by zero)\\n\", "
+                           "xstrerror_l(errno));\n"
+                           "      *sp = 0;\n"
+                           "    }\n"
+                           "  else\n"
+                           "    %s;\n", pop,
+                      ip -> op == OP_DIV || ip -> op == OP_SDIV ? "Division" : "Modulo",
+                      ip -> op == OP_DIV ? "*sp /= val" : ip -> op == OP_MOD ? "*sp %= val"
+                      : ip -> op == OP_SDIV ? "*sp = (ULONG)((LONG)*sp / (LONG)val)"
+                      : "*sp = (ULONG)((LONG)*sp % (LONG)val)");
+        break;
+
+      case OP_SADD:
+      case OP_SSUB:
+      case OP_SMUL:
+        (void)fprintf(out, "%s  *sp = (ULONG)((LONG)*sp %c (LONG)val);\n", pop,
+                      ip -> op == OP_SADD ? '+' : ip -> op == OP_SSUB ? '-' : '*');
+        break;
+
+      case OP_STORE_LAST:
+        (void)fprintf(out, "  last_result = ");
+        emit_ulong(out, ip -> arg);
+        (void)fprintf(out, ";\n");
+        break;
+
+      case OP_MUL_POW2:
+        (void)fprintf(out, "%s  if (*sp > (ULONG)-1 >> %lu)\n"
+                           "    errno = ERANGE;\n"
+                           "  *sp <<= %lu;\n", ip -> aux ? "  errno = 0;\n" : "",
+                      (unsigned long)arg, (unsigned long)arg);
+        break;
+
+      case OP_DIV_POW2:
+        (void)fprintf(out, "%s  *sp >>= %lu;\n", ip -> aux ? "  errno = 0;\n" : "",
+                      (unsigned long)arg);
+        break;
+
+      case OP_MOD_POW2:
+        (void)fprintf(out, "%s  *sp &= ", ip -> aux ? "  errno = 0;\n" : "");
+        emit_ulong(out, ip -> arg);
+        (void)fprintf(out, ";\n");
+        break;
+
+      case OP_JUMP:
+        (void)fprintf(out, "  goto L%lu;\n", (unsigned long)arg);
+        break;
+
+      case OP_JUMP_FALSE:
+        (void)fprintf(out, "  if (*sp-- == 0)\n"
+                           "    goto L%lu;\n", (unsigned long)arg);
+        break;
+
+      case OP_POP:
+        (void)fprintf(out, "  sp--;\n");
+        break;
+
+      case OP_PRINT:
+        (void)fprintf(out, "  print_result(*sp--);\n");
+        break;
+
+      case OP_COMMAND: /* 'vars' and 'help' need the interpreter's tables */
+        if (prog -> msgs [arg].len == 4 && ( memcmp(prog -> msgs [arg].text, "vars", 4) == 0
+                                              || memcmp(prog -> msgs [arg].text, "help", 4) == 0 ))
+          return 0;
+
+        (void)fprintf(out, "  run_command(");
+        emit_string(out, prog -> msgs [arg].text, (size_t)prog -> msgs [arg].len);
+        (void)fprintf(out, ");\n");
+        break;
+
+      case OP_ARG:
+        (void)fprintf(out, "  *++sp = args [%lu];\n", (unsigned long)arg);
+        break;
+
+      case OP_CALL:
+        (void)fprintf(out, "  val = call_function(&functions [%lu], fn_%lu_%d_%lu, sp + 1 - %d,\n"
+                           "                      %s);\n"
+                           "  if (call_failed)\n"
+                           "    return 0;\n"
+                           "  sp  = sp + 1 - %d;\n"
+                           "  *sp = val;\n", (unsigned long)arg, (unsigned long)arg,
+                      (int)prog -> mode, (unsigned long)emit_functions, ip -> aux,
+                      mode_name(prog -> mode), ip -> aux);
+        break;
+
+      default:
+        return 0;
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Note a body to translate, called from the program being emitted (0 if out of memory) */
+
+static int
+emit_body(size_t index, arithmetic_mode_t mode)
+{
+  emitted_body *b;
+  size_t i;
+
+  for (i = 0; i < emit_bodies_len; i++)
+    if (emit_bodies [i].index == index && emit_bodies [i].mode == mode
+        && emit_bodies [i].functions == emit_functions)
+      return 1;
+
+  b = grow_array(emit_bodies, &emit_bodies_size, emit_bodies_len, sizeof(emitted_body));
+
+  if (b == NULL)
+    return 0;
+
+  emit_bodies    = b;
+  b              = &emit_bodies [emit_bodies_len++];
+  b -> index     = index;
+  b -> mode      = mode;
+  b -> functions = emit_functions;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* What a name was, when translated, for pcrt.h: a variable, a reserved name, or a builtin */
+
+#define CHANGING(id) { id, #id }
+
+static void
+emit_ref(FILE *out, const var_ref *r)
+{
+  static const struct { builtin_id id; const char *name; } changing [] =
+    {
+      CHANGING(BV_ARG_MAX),   CHANGING(BV_CACHE_HITS), CHANGING(BV_CACHE_MISSES),
+      CHANGING(BV_CHILD_MAX), CHANGING(BV_ERRNO),     CHANGING(BV_FILESIZEBITS),
+      CHANGING(BV_GID),       CHANGING(BV_NAME_MAX),  CHANGING(BV_OPEN_MAX),
+      CHANGING(BV_PATH_MAX),  CHANGING(BV_PID),       CHANGING(BV_RAND),
+      CHANGING(BV_TIME),      CHANGING(BV_UID)
+    };
+  const struct builtin_var *b;
+  ULONG value = 0;
+  size_t i;
+
+  (void)fprintf(out, "      { ");
+  emit_string(out, r -> name, r -> len);
+  (void)fprintf(out, ", %lu, ", (unsigned long)r -> len);
+
+  if (is_reserved_name(r -> name, r -> len))
+    (void)fprintf(out, "REF_RESERVED, 0");
+  else if ((b = find_builtin(r -> name, r -> len)) == NULL) /* Registers included */
+    (void)fprintf(out, "REF_VARIABLE, 0");
+  else
+    {
+      for (i = 0; i < sizeof ( changing ) / sizeof ( changing [0] ); i++)
+        if (changing [i].id == b -> id)
+          break;
+
+      if (i < sizeof ( changing ) / sizeof ( changing [0] ))
+        (void)fprintf(out, "REF_BUILTIN, %s", changing [i].name);
+      else
+        {
+          builtin_value(b -> id, &value);
+          (void)fprintf(out, "REF_CONSTANT, ");
+          emit_ulong(out, value);
+        }
+    }
+
+  (void)fprintf(out, ", NULL, (unsigned long)-1 },\n");
+}
+
+#undef CHANGING
+
+/**************************************************************************************************/
+
+/* A program as a C function (name, with its parameters), with the stack as a local array */
+
+static int
+emit_program(FILE *out, const program *prog, const char *name)
+{
+  unsigned char *target;
+  size_t i;
+
+  if ((target = calloc(prog -> code_len + 1, 1)) == NULL)
+    return 0;
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_JUMP || prog -> code [i].op == OP_JUMP_FALSE)
+      target [prog -> code [i].arg] = 1;
+    else if (prog -> code [i].op == OP_CALL)
+      {
+        if (!emit_body((size_t)prog -> code [i].arg, prog -> mode))
+          {
+            FREE(target);
+
+            return 0;
+          }
+
+        (void)fprintf(out, "static ULONG fn_%lu_%d_%lu(const ULONG *args);\n",
+                      (unsigned long)prog -> code [i].arg, (int)prog -> mode,
+                      (unsigned long)emit_functions);
+      }
+
+  (void)fprintf(out, "/*\n * ");
+
+  for (i = 0; prog -> source [i] != '\0'; i++)
+    if (prog -> source [i] == '\n')
+      (void)fputs(prog -> source [i + 1] != '\0' ? "\n * " : "", out);
+    else
+      {
+        if (i > 0 && ( prog -> source [i] == '/' || prog -> source [i] == '*' )
+            && ( prog -> source [i - 1] == '/' || prog -> source [i - 1] == '*' ))
+          (void)fputc(' ', out); /* Neither ending the comment nor starting one */
+
+        (void)fputc(prog -> source [i], out);
+      }
+
+  (void)fprintf(out, "\n */\n\nstatic ULONG\n%s\n{\n", name);
+
+  if (prog -> refs_len > 0)
+    {
+      (void)fprintf(out, "  static var_ref refs [] =\n    {\n");
+
+      for (i = 0; i < prog -> refs_len; i++)
+        emit_ref(out, &prog -> refs [i]);
+
+      (void)fprintf(out, "    };\n");
+    }
+
+  if (prog -> msgs_len > 0)
+    {
+      (void)fprintf(out, "  static const message msgs [] =\n    {\n");
+
+      for (i = 0; i < prog -> msgs_len; i++)
+        {
+          (void)fprintf(out, "      { ");
+
+          if (prog -> msgs [i].format != NULL)
+            emit_string(out, prog -> msgs [i].format, strlen(prog -> msgs [i].format));
+          else
+            (void)fprintf(out, "NULL");
+
+          (void)fprintf(out, ", ");
+          emit_string(out, prog -> msgs [i].text, (size_t)prog -> msgs [i].len);
+          (void)fprintf(out, ", %d },\n", prog -> msgs [i].len);
+        }
+
+      (void)fprintf(out, "    };\n");
+    }
+
+  /* Shifts by too many bits do what the machine does, as in execute(), not what's folded */
+
+  (void)fprintf(out, "  ULONG stack [%lu] = { 0 }, *sp = stack, val = 0;\n"
+                     "  volatile ULONG bits = 0;\n"
+                     "  variable *v = NULL;\n"
+                     "  int existed = 0;\n\n"
+                     "  (void)val;\n"
+                     "  (void)bits;\n"
+                     "  (void)v;\n"
+                     "  (void)existed;\n%s\n", (unsigned long)prog -> max_depth + 1,
+                strncmp(name, "fn_", 3) == 0 ? "  (void)args;\n" : "");
+
+  for (i = 0; i < prog -> code_len; i++)
+    {
+      if (target [i])
+        (void)fprintf(out, "L%lu:\n", (unsigned long)i);
+
+      if (!emit_instruction(out, prog, &prog -> code [i]))
+        {
+          FREE(target);
+
+          return 0;
+        }
+    }
+
+  (void)fprintf(out, "}\n\n");
+  FREE(target);
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Read a file as 'take' would, noting its steps without running them (for the option named) */
+
+static taken_file *
+record_file(const char *filename, const char *option)
+{
+  char *buff = NULL;
+  size_t buff_size = 0;
+  char *comment_ptr;
+  block_reader reader = { NULL, 0, 0, NULL };
+  mapped_file map;
+  taken_file *f;
+  FILE *fp;
+
+  if ((fp = fopen(filename, "r")) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: '%s': '%s': %s\n", option, filename,
+                    (errno ? xstrerror_l (errno) : "Failed"));
+
+      return NULL;
+    }
+
+  if ((f = calloc(1, sizeof ( taken_file ))) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+      (void)fclose(fp);
+
+      return NULL;
+    }
+
+  recording = f;
+  emitting  = 1;
+
+  map_file(fp, &map);
+
+  while (next_line(fp, &map, &buff, &buff_size) != NULL)
+    {
+      add_step(STEP_ECHO, buff, NULL);
+
+      comment_ptr = strchr(buff, '#');
+
+      if (comment_ptr != NULL)
+        *comment_ptr = '\0';
+
+      process_line(buff, &reader);
+    }
+
+  FREE(buff);
+  finish_lines(&reader);
+
+  if (map.data != NULL ? map.pos < map.len : ferror(fp) || !feof(fp))
+    f -> broken = 1;
+
+  unmap_file(&map);
+  (void)fclose(fp);
+  emitting  = 0;
+  recording = NULL;
+
+  return f;
+}
+
+/**************************************************************************************************/
+
+/* Whether a step can be translated, counting definitions (each a new function) */
+
+static int
+emit_checks(const step *st, unsigned long *gen, size_t *defs)
+{
+  size_t len = strlen(st -> text);
+
+  if (st -> kind != STEP_STATEMENT)
+    return 1;
+
+  if (is_word(st -> text, st -> text + len, "def"))
+    {
+      if (st -> gen == *gen) /* It failed, so nothing was defined */
+        return 0;
+
+      *gen = st -> gen;
+      (*defs)++;
+
+      return 1;
+    }
+
+  return NAME_IS(st -> text, len, "auto") || NAME_IS(st -> text, len, "signed")
+         || NAME_IS(st -> text, len, "unsigned") || NAME_IS(st -> text, len, "mode")
+         || NAME_IS(st -> text, len, "regs") || NAME_IS(st -> text, len, "quit");
+}
+
+/**************************************************************************************************/
+
+/* A definition, as main() runs it: memos let go of, then what compiling the body reports */
+
+static int
+emit_definition(FILE *out, size_t index, arithmetic_mode_t mode)
+{
+  size_t i, count = function_count;
+  program *prog;
+
+  for (i = 0; i < index; i++)
+    if (functions [i].pure)
+      (void)fprintf(out, "  (void)memset(memo_%lu, 0, sizeof ( memo_%lu ));\n",
+                    (unsigned long)i, (unsigned long)i);
+
+  function_count = index + 1;
+  prog           = compile_function(&functions [index], mode);
+  function_count = count;
+
+  if (prog == NULL)
+    return 0;
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_DIAG)
+      {
+        const message *m = &prog -> msgs [prog -> code [i].arg];
+
+        (void)fprintf(out, "  (void)fprintf(stderr, ");
+        emit_string(out, m -> format, strlen(m -> format));
+        (void)fprintf(out, ", %d, ", m -> len);
+        emit_string(out, m -> text, (size_t)m -> len);
+        (void)fprintf(out, ");\n");
+      }
+
+  free_program(prog);
+  functions [index].prog [mode] = NULL;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static int
+emit_c(const char *filename)
+{
+  arithmetic_mode_t mode = arithmetic_mode;
+  unsigned long gen = compile_generation;
+  char name [64];
+  emitted_body body;
+  program *prog;
+  taken_file *f;
+  size_t i, count, defs = 0;
+  int ok = 1;
+
+  if ((f = record_file(filename, "--emit-c")) == NULL)
+    return 0;
+
+  for (i = 0; ok && !f -> broken && i < f -> steps_len; i++)
+    if (!emit_checks(&f -> steps [i], &gen, &defs))
+      {
+        (void)fprintf(stderr, "ERROR: '--emit-c': '%s': '%.*s' can't be translated.\n", filename,
+                      (int)strcspn(f -> steps [i].text, "\n"), f -> steps [i].text);
+        ok = 0;
+      }
+
+  if (ok && !f -> broken && defs != function_count)
+    {
+      (void)fprintf(stderr, "ERROR: '--emit-c': '%s': a function defined again can't be "
+                            "translated.\n", filename);
+      ok = 0;
+    }
+
+  if (!ok || f -> broken)
+    {
+      if (ok)
+        (void)fprintf(stderr, "ERROR: '--emit-c': '%s' can't be translated.\n", filename);
+
+      free_taken(f);
+
+      return 0;
+    }
+
+  (void)fprintf(stdout, "/* Translated from '%s' by pc --emit-c; compile with pcrt.h from pc */\n\n"
+#if defined (USE_LONG_LONG)
+                        "#define USE_LONG_LONG\n"
+#endif
+#if defined (WITH_ROMAN)
+                        "#define WITH_ROMAN\n"
+#endif
+#if defined (WITH_TERNARY)
+                        "#define WITH_TERNARY\n"
+#endif
+#if defined (WITH_BASE36)
+                        "#define WITH_BASE36\n"
+#endif
+                        "#include \"pcrt.h\"\n\n"
+                        "/* Must be built for the same width as it was translated by */\n\n"
+                        "typedef char ulong_width [sizeof ( ULONG ) == %lu ? 1 : -1];\n\n",
+                filename, (unsigned long)sizeof ( ULONG ));
+
+  if (function_count > 0)
+    {
+      for (i = 0; i < function_count; i++)
+        if (functions [i].pure)
+          (void)fprintf(stdout, "static memo memo_%lu [MEMO_SIZE];\n", (unsigned long)i);
+
+      (void)fprintf(stdout, "\nstatic const function functions [] =\n  {\n");
+
+      for (i = 0; i < function_count; i++)
+        {
+          (void)fprintf(stdout, "    { ");
+          emit_string(stdout, functions [i].name, functions [i].len);
+          (void)fprintf(stdout, ", %lu, %d, ", (unsigned long)functions [i].len,
+                        functions [i].nargs);
+
+          if (functions [i].pure)
+            (void)fprintf(stdout, "memo_%lu },\n", (unsigned long)i);
+          else
+            (void)fprintf(stdout, "NULL },\n");
+        }
+
+      (void)fprintf(stdout, "  };\n\n");
+    }
+
+  for (emit_functions = 0, i = 0; ok && i < f -> steps_len; i++)
+    if (f -> steps [i].kind == STEP_STATEMENT && f -> steps [i].text [0] == 'd')
+      emit_functions++; /* A definition: no command starts with 'd' */
+    else if (f -> steps [i].prog != NULL)
+      {
+        (void)snprintf(name, sizeof ( name ), "step_%lu(void)", (unsigned long)i);
+
+        if (!(ok = emit_program(stdout, f -> steps [i].prog, name)))
+          (void)fprintf(stderr, "ERROR: '--emit-c': '%s': '%.*s' can't be translated.\n", filename,
+                        (int)strcspn(f -> steps [i].text, "\n"), f -> steps [i].text);
+      }
+
+  for (i = 0; ok && i < emit_bodies_len; i++) /* Which can add more */
+    {
+      body           = emit_bodies [i];
+      count          = function_count;
+      function_count = body.functions;
+      prog           = compile_function(&functions [body.index], body.mode);
+      function_count = count;
+      emit_functions = body.functions;
+
+      (void)snprintf(name, sizeof ( name ), "fn_%lu_%d_%lu(const ULONG *args)",
+                     (unsigned long)body.index, (int)body.mode, (unsigned long)body.functions);
+
+      ok = prog != NULL && emit_program(stdout, prog, name);
+
+      if (!ok)
+        (void)fprintf(stderr, "ERROR: '--emit-c': '%s': 'def %.*s' can't be translated.\n",
+                      filename, (int)functions [body.index].len, functions [body.index].name);
+
+      free_program(functions [body.index].prog [body.mode]);
+      functions [body.index].prog [body.mode] = NULL;
+    }
+
+  if (ok)
+    (void)fprintf(stdout, "int\nmain(void)\n{\n  startup();\n\n");
+
+  for (defs = 0, i = 0; ok && i < f -> steps_len; i++)
+    {
+      const step *st = &f -> steps [i];
+
+      if (st -> kind == STEP_ECHO)
+        {
+          (void)fprintf(stdout, "  (void)fputs(");
+          emit_string(stdout, st -> text, strlen(st -> text));
+          (void)fprintf(stdout, ", stdout);\n");
+        }
+      else if (st -> kind == STEP_STATEMENT && st -> text [0] == 'd')
+        ok = emit_definition(stdout, defs++, mode);
+      else if (st -> kind == STEP_STATEMENT)
+        {
+          if (strcmp(st -> text, "auto") == 0)
+            mode = MODE_AUTO;
+          else if (strcmp(st -> text, "signed") == 0)
+            mode = MODE_SIGNED;
+          else if (strcmp(st -> text, "unsigned") == 0)
+            mode = MODE_UNSIGNED;
+
+          (void)fprintf(stdout, "  run_command(");
+          emit_string(stdout, st -> text, strlen(st -> text));
+          (void)fprintf(stdout, ");\n");
+        }
+      else if (st -> kind == STEP_EXPRESSION) /* As the first take compiles (and counts) each */
+        (void)fprintf(stdout, "  cache_misses++;\n"
+                              "  run_expression(step_%lu, %d);\n", (unsigned long)i,
+                      st -> prog -> unset_mode);
+      else
+        (void)fprintf(stdout, "  run_block(step_%lu);\n", (unsigned long)i);
+    }
+
+  if (ok)
+    (void)fprintf(stdout, "\n  return EXIT_SUCCESS;\n}\n");
+
+  FREE(emit_bodies);
+  emit_bodies_len = emit_bodies_size = 0;
+  free_taken(f);
+
+  return ok;
+}
+
+/**************************************************************************************************/
+
+#if defined (__atarist__)
+static char *
+atarist_getline(char *buf, int size, int echo)
+{
+  int i = 0;
+
+  if (size <= 1)
+    {
+      buf [0] = '\0';
+
+      return buf;
+    }
+
+  for (;;)
+    {
+      int c = Bconin(2) & 0xff;
+
+      if (c == 0x0d || c == 0x9b)
+        {
+          if (echo)
+            {
+              Cconout('\r');
+              Cconout('\n');
+            }
+
+          buf [i++] = '\n';
+          buf [i] = '\0';
+
+          return buf;
+        }
+
+      if (c == 0x1a || c == 0x04)
+        {
+          if (i == 0)
+            return NULL;
+
+          buf [i] = '\0';
+
+          return buf;
+        }
+
+      if (c == 0x08 || c == 0x7f)
+        {
+          if (i > 0)
+            {
+              i--;
+
+              if (echo)
+                {
+                  Cconout('\b');
+                  Cconout(' ');
+                  Cconout('\b');
+                }
+            }
+
+          continue;
+        }
+
+      if (i < size - 1)
+        {
+          buf [i++] = (char)c;
+
+          if (echo)
+            Cconout(c);
+        }
+      else
+        {
+          buf [i] = '\0';
+
+          return buf;
+        }
+    }
+}
+#endif
+
+/**************************************************************************************************/
+
+static void
+do_input(int echo)
+{
+#if defined (WITH_READLINE) || \
+    defined (WITH_EDITLINE) || \
+    defined (WITH_LIBEDIT) || \
+    defined (WITH_LINENOISE)
+  char *line;
+#elif defined (__atarist__)
+  char buff [INPUT_BUFF];
+  char *line;
+#else
+  char *buff = NULL;
+  size_t buff_size = 0;
+  char *line;
+#endif
+  char *comment_ptr;
+  block_reader reader = { NULL, 0, 0, NULL };
+
+#if defined (WITH_READLINE) || \
+    defined (WITH_EDITLINE) || \
+    defined (WITH_LIBEDIT)
+  rl_completion_entry_function = editor_completion;
+  rl_attempted_completion_function = editor_completion_function;
+#endif
+
+#if defined (WITH_READLINE) || \
+    defined (WITH_EDITLINE) || \
+    defined (WITH_LIBEDIT)
+  while ((line = readline("")) != NULL)
+#elif defined (WITH_LINENOISE)
+  /* NB: An empty ("") prompt is not supported with upstream linenoise */
+  while ((line = linenoise(">")) != NULL)
+#elif defined (__atarist__)
+  while ((line = atarist_getline(buff, INPUT_BUFF, 1)) != NULL)
+#else
+  while ((line = read_line(stdin, &buff, &buff_size)) != NULL)
+#endif
+    {
+
+      if (echo)
+        {
+          size_t len = strlen(line);
+
+          while (len > 0 &&
+                 (line [len - 1] == '\n' || line [len - 1] == '\r'))
+            line [--len] = '\0';
+
+          (void)fprintf(stdout, "%s\n", line);
+        }
+
+#if !defined (WITH_READLINE) && !defined (WITH_EDITLINE) && \
+    !defined (WITH_LIBEDIT) && !defined (WITH_LINENOISE)
+      if (strlen(line) > 0 && line [strlen(line) - 1] == '\n')
+        line [strlen(line) - 1] = '\0';
+#endif
+
+#if defined (WITH_READLINE) || \
+    defined (WITH_EDITLINE) || \
+    defined (WITH_LIBEDIT)
+      if (*line)
+        add_history(line);
+#elif defined (WITH_LINENOISE)
+      if (*line)
+        linenoiseHistoryAdd(line);
+#endif
+
+      comment_ptr = strchr(line, '#'); /* In place, once it's in the history */
+
+      if (comment_ptr != NULL)
+        *comment_ptr = '\0';
+
+      process_line(line, &reader);
+#if defined (WITH_READLINE) || \
+    defined (WITH_EDITLINE) || \
+    defined (WITH_LIBEDIT)
+      FREE(line);
+#elif defined (WITH_LINENOISE)
+      linenoiseFree(line);
+      line = 0;
+#endif
+    }
+
+#if !defined (WITH_READLINE) && !defined (WITH_EDITLINE) && \
+    !defined (WITH_LIBEDIT) && !defined (WITH_LINENOISE) && !defined (__atarist__)
+  FREE(buff);
+#endif
+  finish_lines(&reader);
+}
+
+/**************************************************************************************************/
+
+static void
+parse_args(int argc, char *argv [])
+{
+  size_t i, len;
+  char *buff;
+  block_reader reader = { NULL, 0, 0, NULL };
+
+  for (i = 1, len = 0; i < (size_t)argc; i++)
+    len += strlen(argv [i]) + 1;
+
+  len++;
+
+  buff = malloc(len * sizeof ( char ));
+
+  if (buff == NULL)
+    return;
+
+  buff [0] = '\0';
+
+  for (i = 1; i < (size_t)argc; i++)
+    {
+      (void)strncat(buff, argv [i], len - strlen(buff) - 1);
+      (void)strncat(buff, " ", len - strlen(buff) - 1);
+    }
+
+  process_line(buff, &reader);
+  finish_lines(&reader);
+  FREE(buff);
+}
+
+/**************************************************************************************************/
+
+/* What's done before reading any input (pcrt.h has its own for translated files) */
+
+static void
+startup(void)
+{
+#if !(defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811))
+  FILE *f;
+  uint32_t h;
+  unsigned char rnd [4];
+#endif
+
+#if !defined (NO_LOCALE)
+  (void)setlocale (LC_ALL, "");
+#endif
+
+#if !(defined (__OpenBSD__) && defined (OpenBSD) && (OpenBSD >= 200811))
+  /*LINTED: E_CAST_INT_TO_SMALL_INT*/
+  h = (uint32_t)time(NULL);
+
+# if !defined (DOSLIKE) && !defined (__atarist__) && !defined (__amiga__)
+  f = fopen("/dev/urandom", "rb");
+
+  if (f)
+    {
+      if (fread(&rnd, sizeof(rnd), 1, f) == 1)
+        h = hash32s(&rnd, sizeof(rnd), h);
+
+      (void)fclose(f);
+    }
+# endif
+
+  srand(h);
+#endif
+
+#if !defined (__ELKS__) && !( defined (DOSLIKE) && !defined (__DJGPP__) )
+# if !defined (_MSC_VER)
+  if (!isatty(STDOUT_FILENO)) /* A terminal stays line buffered */
+# else
+  if (!isatty(1))
+# endif
+    (void)setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFF);
+#endif
+
+  (void)set_var_lookup_hook(builtin_vars);
+}
+
+/**************************************************************************************************/
+
+static int specialize(char *inputs, const char *filename);
+static int run_results(char *names, const char *filename);
+
+/**************************************************************************************************/
+
+int
+main(int argc, char *argv [])
+{
+  startup();
+
+  if (argc == 3 && strcmp(argv [1], "--emit-c") == 0)
+    return emit_c(argv [2]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if (argc == 4 && strcmp(argv [1], "--specialize") == 0)
+    return specialize(argv [2], argv [3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if (argc == 4 && strcmp(argv [1], "--results") == 0)
+    return run_results(argv [2], argv [3]) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+  if (argc > 1)
+    parse_args(argc, argv);
+  else
+    {
+#if !defined (_MSC_VER)
+      if (isatty(STDIN_FILENO))
+#else
+      if (isatty(0))
+#endif
+        {
+#if defined (__atarist__)
+          if (!is_mint())
+            {
+              graf_mouse(M_OFF, 0);
+              Cursconf(1, 0);
+            }
+#endif
+          print_herald();
+        }
+
+#if !defined (_MSC_VER)
+      do_input(!isatty(STDIN_FILENO));
+#else
+      do_input(!isatty(0));
+#endif
+    }
+
+  return EXIT_SUCCESS;
+}
+
+/**************************************************************************************************/
+
+#if defined (__amiga__)
+int
+WBmain(struct WBStartup *wbmsg)
+{
+  BPTR con = Open("CON:0/0/640/200/pc2", MODE_NEWFILE);
+
+  if (con)
+    {
+      SelectOutput(con);
+      SelectInput(con);
+      SelectError(con);
+    }
+
+  char *argv [] = { "pc", NULL };
+  int rc = main(1, argv);
+
+  if (con)
+    Close(con);
+
+  return rc;
+}
+#endif
+
+/**************************************************************************************************/
+
+/*
+ * Statements are split into a flat array of tokens by tokenize() before
+ * being parsed, so each character is classified only once.  Literals are
+ * decoded here, but any warnings about them are left for the parser, which
+ * issues them (and sets errno) in the order the values are used.
+ *
+ * Groups are matched first, in one pass over the statement, recording where
+ * each '(', '{' or '[' is closed (counting only brackets of the same kind).
+ * A group token then holds the index of its closer token, and the parser
+ * treats the closer of the innermost group it is in (expr_end) just like the
+ * end of the statement.
+ */
+
+#define NO_GROUP ((size_t)-1)
+
+#define CHAR_BAD_ESCAPE 1 /* Character constant problems, in token.err */
+#define CHAR_TOO_LONG   2
+
+static size_t *group_close      = NULL; /* Offset of closer, by opener offset */
+static size_t  group_close_size = 0;
+static token  *tokens           = NULL;
+static size_t  tokens_size      = 0;
+static token  *expr_end         = NULL;
+
+/**************************************************************************************************/
+
+static int
+match_groups(char *str, char *end)
+{
+  size_t i, k, len, top [3] = { NO_GROUP, NO_GROUP, NO_GROUP };
+  char *p;
+
+  /*LINTED: E_PTRDIFF_OVERFLOW*/
+  len = (size_t)(end - str);
+
+  if (len > group_close_size)
+    {
+      size_t *new_close = realloc(group_close, len * sizeof(size_t));
+
+      if (new_close == NULL)
+        return 0;
+
+      group_close      = new_close;
+      group_close_size = len;
+    }
+
+  /* Unclosed openers are chained through their own slots until the end */
+
+  for (p = strpbrk(str, "(){}[]"); p != NULL; p = strpbrk(p + 1, "(){}[]"))
+    {
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      i = (size_t)(p - str);
+
+      switch (*p)
+        {
+          case LPAREN:   k = 0; break;
+          case LBRACE:   k = 1; break;
+          case LBRACKET: k = 2; break;
+          case RPAREN:   k = 3; break;
+          case RBRACE:   k = 4; break;
+          case RBRACKET: k = 5; break;
+          default:       continue;
+        }
+
+      if (k < 3)
+        {
+          group_close [i] = top [k];
+          top [k] = i;
+        }
+      else if (top [k - 3] != NO_GROUP)
+        {
+          size_t open = top [k - 3];
+
+          top [k - 3] = group_close [open];
+          group_close [open] = i;
+        }
+    }
+
+  for (k = 0; k < 3; k++)
+    while (top [k] != NO_GROUP)
+      {
+        size_t open = top [k];
+
+        top [k] = group_close [open];
+        group_close [open] = NO_GROUP;
+      }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Operators are one token per character; the parser recognises "<<", "+="
+ * and so on as runs of adjacent tokens (see followed_by()), exactly as when
+ * it used to peek at the next character.
+ */
+
+static token_kind
+char_token(char c)
+{
+  switch (c)
+    {
+      case OR:              return TOK_OR;
+      case AND:             return TOK_AND;
+      case XOR:             return TOK_XOR;
+      case PLUS:            return TOK_PLUS;
+      case MINUS:           return TOK_MINUS;
+      case TIMES:           return TOK_TIMES;
+      case DIVISION:        return TOK_DIVISION;
+      case MODULO:          return TOK_MODULO;
+      case LESS_THAN:       return TOK_LESS_THAN;
+      case GREATER_THAN:    return TOK_GREATER_THAN;
+      case EQUAL:           return TOK_EQUAL;
+      case BANG:            return TOK_BANG;
+      case TWIDDLE:         return TOK_TWIDDLE;
+      case SEMI_COLON:      return TOK_SEMI_COLON;
+      case QUESTION:        return TOK_QUESTION;
+      case COLON:           return TOK_COLON;
+      case USE_LAST_RESULT: return TOK_DOT;
+      case LPAREN:          return TOK_LPAREN;
+      case LBRACE:          return TOK_LBRACE;
+      case LBRACKET:        return TOK_LBRACKET;
+      case RPAREN:          return TOK_RPAREN;
+      case RBRACE:          return TOK_RBRACE;
+      case RBRACKET:        return TOK_RBRACKET;
+      default:              return TOK_OTHER;
+    }
+}
+
+/**************************************************************************************************/
+
+/* Scan a character constant at *p, which may not run past limit */
+
+static void
+lex_char_constant(token *t, char **p, const char *limit)
+{
+  unsigned int i;
+  ULONG val = 0;
+
+  *p = *p + 1; /* Advance over the leading quote */
+
+  for (i = 0; *p < limit && **p != SINGLE_QUOTE && i < sizeof ( LONG ); *p += 1, i++)
+    {
+      if (**p == '\\') /* Escape the next char */
+        {
+          *p += 1;
+
+          if (*p >= limit)
+            {
+              t -> err = CHAR_BAD_ESCAPE;
+
+              return;
+            }
+        }
+
+      val <<= CHAR_BIT;
+      val  |= (ULONG)((unsigned)**p );
+    }
+
+  t -> value = val;
+
+  if (**p != SINGLE_QUOTE) /* Constant must have been too long */
+    {
+      t -> err = CHAR_TOO_LONG;
+
+      while (*p < limit && **p != SINGLE_QUOTE)
+        *p += 1;
+    }
+  else
+    *p += 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Split str into tokens, ending with a TOK_END.  Returns the number of
+ * tokens before it, or -1 if out of memory.
+ */
+
+static long
+tokenize(char *str)
+{
+  char *p = str, *end = str + strlen(str), *limit = end;
+  size_t n, top = NO_GROUP;
+  int saved_errno = errno;
+
+  if (!match_groups(str, end))
+    return -1;
+
+  /* At worst two tokens per character, plus the end */
+
+  /*LINTED: E_PTRDIFF_OVERFLOW*/
+  if ((size_t)(end - str) * 2 + 1 > tokens_size)
+    {
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      size_t new_size = (size_t)(end - str) * 2 + 1;
+      token *new_tokens = realloc(tokens, new_size * sizeof(token));
+
+      if (new_tokens == NULL)
+        return -1;
+
+      tokens      = new_tokens;
+      tokens_size = new_size;
+    }
+
+  for (n = 0;; n++)
+    {
+      token *t = &tokens [n];
+
+      while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\f')
+        p++;
+
+      t -> text  = p;
+      t -> len   = 1;
+      t -> value = 0;
+      t -> err   = 0;
+      t -> close = NO_GROUP;
+
+      if (p == limit && top != NO_GROUP) /* Close the innermost group */
+        {
+          size_t outer = tokens [top].close;
+
+          t -> kind = char_token(*p++);
+          tokens [top].close = n;
+          top = outer;
+
+          /*LINTED: E_PTRDIFF_OVERFLOW*/
+          limit = top == NO_GROUP ? end : str + group_close [tokens [top].text - str];
+
+          continue;
+        }
+
+      if (*p == '\0')
+        {
+          t -> kind = TOK_END;
+          t -> len  = 0;
+          break;
+        }
+
+      if (*p == LPAREN || *p == LBRACE || *p == LBRACKET)
+        {
+          /*LINTED: E_PTRDIFF_OVERFLOW*/
+          size_t close = group_close [p - str];
+
+          t -> kind = char_token(*p);
+
+          /* Groups crossing the end of the enclosing one are mismatched */
+
+          if (close != NO_GROUP && str + close < limit)
+            {
+              t -> close = top; /* Chain of open groups, until closed */
+              top   = n;
+              limit = str + close;
+            }
+
+          p++;
+        }
+      else if (isdigit((unsigned char)*p)) /* A regular number */
+        {
+          char *num_end;
+
+          errno = 0;
+          t -> kind  = TOK_NUMBER;
+          t -> value = xstrtoUL(p, &num_end, 0);
+          t -> err   = errno;
+          /*LINTED: E_PTRDIFF_OVERFLOW*/
+          t -> len   = (size_t)(num_end - p);
+
+          if (num_end == p) /* Nothing converted, so the parse stops here */
+            {
+              n++;
+              t = &tokens [n];
+              t -> kind  = TOK_OTHER;
+              t -> text  = p++;
+              t -> len   = 1;
+              t -> value = 0;
+              t -> err   = 0;
+              t -> close = NO_GROUP;
+            }
+          else
+            p = num_end;
+        }
+      else if (isalpha((unsigned char)*p) || *p == '_') /* A variable name */
+        {
+          t -> kind = TOK_IDENT;
+
+          while (isalnum((unsigned char)*p) || *p == '_')
+            p++;
+
+          /*LINTED: E_PTRDIFF_OVERFLOW*/
+          t -> len = (size_t)(p - t -> text);
+        }
+      else if (*p == SINGLE_QUOTE) /* A character constant */
+        {
+          t -> kind = TOK_CHAR;
+          lex_char_constant(t, &p, limit);
+          /*LINTED: E_PTRDIFF_OVERFLOW*/
+          t -> len = (size_t)(p - t -> text);
+        }
+      else
+        t -> kind = char_token(*p++);
+    }
+
+  errno = saved_errno;
+
+  return (long)n;
+}
+
+/**************************************************************************************************/
+
+/* Is t directly followed, with no white space between, by a token of this kind? */
+
+static int
+followed_by(const token *t, token_kind kind)
+{
+  return t -> kind != TOK_END && t [1].kind == kind && t [1].text == t -> text + 1;
+}
+
+/**************************************************************************************************/
+
+/* Number of characters from the current token to the end of the group */
+
+static int
+rest_len(const token *t)
+{
+  /*LINTED: E_CAST_INT_TO_SMALL_INT*/
+  return (int)(expr_end -> text - t -> text);
+}
+
+/**************************************************************************************************/
+
+static int
+remove_var(const char *name, size_t len)
+{
+  size_t i, j, k, mask;
+  variable *v;
+
+  if (name == NULL || var_count == 0)
+    return 0;
+
+  mask = var_table_size - 1;
+  i    = find_var_slot(name, len, hash32s(name, len, 0));
+  v    = var_table [i];
+
+  if (v == NULL)
+    return 0;
+
+  /*
+   * Backward-shift deletion: pull later members of the probe run into the
+   * hole whenever their home slot doesn't lie cyclically between the hole
+   * and their current position, so no tombstones are ever needed.
+   */
+
+  for (j = i;;)
+    {
+      j = (j + 1) & mask;
+
+      if (var_table [j] == NULL)
+        break;
+
+      k = (size_t)var_table [j] -> hash & mask;
+
+      if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
+        {
+          var_table [i] = var_table [j];
+          i = j;
+        }
+    }
+
+  var_table [i] = NULL;
+  var_count--;
+  var_generation++;
+
+  FREE(v -> name);
+  FREE(v);
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Code generation.  The parsing functions below append instructions to the
+ * program being compiled, tracking how deep the stack will get.
+ */
+
+static program *compiling = NULL;
+
+/**************************************************************************************************/
+
+/*
+ * Make room for element len of a growable array, returning the (possibly
+ * moved) array, or NULL if out of memory.
+ */
+
+static void *
+grow_array(void *array, size_t *size, size_t len, size_t elem_size)
+{
+  void *new_array;
+  size_t new_size;
+
+  if (len < *size)
+    return array;
+
+  new_size  = *size ? *size * 2 : 16;
+  new_array = realloc(array, new_size * elem_size);
+
+  if (new_array != NULL)
+    *size = new_size;
+
+  return new_array;
+}
+
+/**************************************************************************************************/
+
+/* Net effect of each instruction on the stack depth */
+
+static int
+stack_effect(opcode op)
+{
+  switch (op)
+    {
+      case OP_PUSH:
+      case OP_CONST:
+      case OP_LAST:
+      case OP_SHOW_GT:
+      case OP_LOAD:
+      case OP_LOAD_INC:
+      case OP_LOAD_DEC:
+      case OP_UNSET:
+      case OP_ARG:
+        return 1;
+
+      case OP_END:
+      case OP_SET_LAST:
+      case OP_PRE_INC:
+      case OP_PRE_DEC:
+      case OP_ASSIGN:
+      case OP_ASSIGN_OP:
+      case OP_REMOVE:
+      case OP_DIAG:
+      case OP_WARN_CONVERT:
+      case OP_WARN_CHAR:
+      case OP_NEG:
+      case OP_NOT:
+      case OP_COMPL:
+      case OP_STORE_LAST:
+      case OP_MUL_POW2:
+      case OP_DIV_POW2:
+      case OP_MOD_POW2:
+      case OP_JUMP:
+      case OP_COMMAND:
+        return 0;
+
+      default: /* Binary operators */
+        return -1;
+    }
+}
+
+/**************************************************************************************************/
+
+static void
+append(opcode op, int aux, ULONG arg)
+{
+  program *prog = compiling;
+  instruction *in;
+
+  if (prog == NULL)
+    return;
+
+  in = grow_array(prog -> code, &prog -> code_size, prog -> code_len, sizeof(instruction));
+
+  if (in == NULL)
+    {
+      compiling = NULL; /* compile_statement() notices */
+
+      return;
+    }
+
+  prog -> code = in;
+  in = &prog -> code [prog -> code_len++];
+  in -> op  = op;
+  in -> aux = aux;
+  in -> arg = arg;
+
+  if (op == OP_CALL) /* The result replaces the arguments */
+    prog -> depth = prog -> depth + 1 - (size_t)aux;
+  else if (stack_effect(op) < 0)
+    prog -> depth--;
+  else
+    prog -> depth += (size_t)stack_effect(op);
+
+  if (prog -> depth > prog -> max_depth)
+    prog -> max_depth = prog -> depth;
+}
+
+/**************************************************************************************************/
+
+/* Does a - b overflow, taken as signed?  (Subtraction sets errno to ERANGE if so) */
+
+static int
+sub_overflows(ULONG a, ULONG b)
+{
+#if defined (USE_LONG_LONG)
+  return ( (LONG)b > 0 && (LONG)a < LLONG_MIN + (LONG)b )
+      || ( (LONG)b < 0 && (LONG)a > LLONG_MAX + (LONG)b );
+#else
+  return ( (LONG)b > 0 && (LONG)a < LONG_MIN + (LONG)b )
+      || ( (LONG)b < 0 && (LONG)a > LONG_MAX + (LONG)b );
+#endif
+}
+
+/**************************************************************************************************/
+
+/*
+ * Work out a op b at compile time.  Returns 0, leaving it to run time, if
+ * doing it would set errno or print a warning.
+ */
+
+static int
+fold_binary(opcode op, ULONG a, ULONG b, ULONG *result)
+{
+  switch (op)
+    {
+      case OP_LOGOR:  *result = ( b || a );               break;
+      case OP_LOGAND: *result = ( b && a );               break;
+      case OP_OR:     *result = a | b;                    break;
+      case OP_XOR:    *result = a ^ b;                    break;
+      case OP_AND:    *result = a & b;                    break;
+      case OP_EQ:     *result = ( a == b );               break;
+      case OP_NE:     *result = ( a != b );               break;
+      case OP_LT:     *result = ( (LONG)a <  (LONG)b );   break;
+      case OP_LE:     *result = ( (LONG)a <= (LONG)b );   break;
+      case OP_GT:     *result = ( (LONG)a >  (LONG)b );   break;
+      case OP_GE:     *result = ( (LONG)a >= (LONG)b );   break;
+      case OP_ULT:    *result = ( a <  b );               break;
+      case OP_ULE:    *result = ( a <= b );               break;
+      case OP_UGT:    *result = ( a >  b );               break;
+      case OP_UGE:    *result = ( a >= b );               break;
+      case OP_SADD:   *result = a + b;                    break;
+      case OP_SSUB:   *result = a - b;                    break;
+      case OP_SMUL:   *result = a * b;                    break;
+
+      case OP_SHL:
+      case OP_SHR:
+        if (b >= sizeof(ULONG) * CHAR_BIT)
+          return 0;
+
+        *result = op == OP_SHL ? a << b : a >> b;
+        break;
+
+      case OP_ADD:
+        if (a > (ULONG)-1 - b)
+          return 0;
+
+        *result = a + b;
+        break;
+
+      case OP_SUB:
+        if (sub_overflows(a, b))
+          return 0;
+
+        *result = a - b;
+        break;
+
+      case OP_MUL:
+        if (b != 0 && a > (ULONG)-1 / b)
+          return 0;
+
+        *result = a * b;
+        break;
+
+      case OP_DIV:
+      case OP_MOD:
+        if (b == 0)
+          return 0;
+
+        *result = op == OP_DIV ? a / b : a % b;
+        break;
+
+      case OP_SDIV:
+      case OP_SMOD:
+        if (b == 0 || (LONG)b == -1) /* Leave LONG_MIN / -1 alone too */
+          return 0;
+
+        *result = (ULONG)( op == OP_SDIV ? (LONG)a / (LONG)b : (LONG)a % (LONG)b );
+        break;
+
+      default:
+        return 0;
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* A push of a constant, with no effect beyond its value and errno? */
+
+#define IS_CONSTANT(in) ( (in) -> op == OP_CONST || (in) -> op == OP_PUSH )
+
+/*
+ * Optimize op into the instructions already compiled, returning 1 if that
+ * took care of it.  Operations on constants are folded, and unsigned
+ * multiplication, division and remainder by a power of two become shifts
+ * and masks.  A folded operation would set errno no differently than its
+ * last constant (if at all), and anything that would set it otherwise or
+ * warn is left for run time.
+ */
+
+static int
+fold(opcode op)
+{
+  program *prog = compiling;
+  instruction *x, *y;
+  ULONG val;
+  int k;
+
+  if (prog -> code_len <= prog -> barrier
+      || !IS_CONSTANT(&prog -> code [prog -> code_len - 1]))
+    return 0;
+
+  y = &prog -> code [prog -> code_len - 1];
+  x = prog -> code_len > prog -> barrier + 1 ? y - 1 : NULL;
+
+  switch (op)
+    {
+      case OP_NEG:
+        y -> arg = (ULONG)0 - y -> arg;
+
+        return 1;
+
+      case OP_NOT:
+        y -> arg = !y -> arg;
+
+        return 1;
+
+      case OP_COMPL:
+        y -> arg = ~y -> arg;
+
+        return 1;
+
+      case OP_SET_LAST: /* Keep the constant last, for whatever comes next */
+        op      = y -> op;
+        y -> op = OP_STORE_LAST;
+        append(op, 0, y -> arg);
+
+        return 1;
+
+      default:
+        break;
+    }
+
+  if (stack_effect(op) >= 0 || op == OP_JUMP_FALSE || op == OP_POP || op == OP_PRINT
+      || op == OP_CALL)
+    return 0;
+
+  if (x != NULL && IS_CONSTANT(x) && fold_binary(op, x -> arg, y -> arg, &val))
+    {
+      if (y -> op == OP_CONST)
+        x -> op = OP_CONST;
+
+      x -> arg = val;
+      prog -> code_len--;
+      prog -> depth--;
+
+      return 1;
+    }
+
+  if (( op != OP_MUL && op != OP_DIV && op != OP_MOD ) || y -> arg == 0
+      || ( y -> arg & ( y -> arg - 1 ) ) != 0)
+    return 0;
+
+  for (k = 0; ( y -> arg >> k ) != 1; k++)
+    continue;
+
+  y -> aux = ( y -> op == OP_CONST ); /* Literal resets errno */
+
+  if (op == OP_MUL)
+    {
+      y -> op  = OP_MUL_POW2;
+      y -> arg = (ULONG)k;
+    }
+  else if (op == OP_DIV)
+    {
+      y -> op  = OP_DIV_POW2;
+      y -> arg = (ULONG)k;
+    }
+  else
+    {
+      y -> op   = OP_MOD_POW2;
+      y -> arg -= 1;
+    }
+
+  prog -> depth--;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static void
+emit(opcode op, int aux, ULONG arg)
+{
+  if (compiling != NULL && !fold(op))
+    append(op, aux, arg);
+}
+
+/**************************************************************************************************/
+
+/* Refer to the variable named by t, reusing an earlier reference to it */
+
+static ULONG
+var_ref_index(const token *t)
+{
+  program *prog = compiling;
+  var_ref *r;
+  size_t i;
+
+  if (prog == NULL)
+    return 0;
+
+  for (i = 0; i < prog -> refs_len; i++)
+    if (prog -> refs [i].len == t -> len && memcmp(prog -> refs [i].name, t -> text, t -> len) == 0)
+      return i;
+
+  r = grow_array(prog -> refs, &prog -> refs_size, prog -> refs_len, sizeof(var_ref));
+
+  if (r == NULL)
+    {
+      compiling = NULL;
+
+      return 0;
+    }
+
+  prog -> refs = r;
+  r = &prog -> refs [prog -> refs_len];
+  r -> name = t -> text;
+  r -> len  = t -> len;
+  r -> var  = NULL;
+  r -> gen  = var_generation - 1;
+
+  return prog -> refs_len++;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Compile an instruction that prints a message, quoting len characters of
+ * text (which lives in the program's copy of the source) if it says so.
+ */
+
+static void
+emit_message(opcode op, int aux, const char *format, const char *text, int len)
+{
+  program *prog = compiling;
+  message *m;
+
+  if (prog == NULL)
+    return;
+
+  m = grow_array(prog -> msgs, &prog -> msgs_size, prog -> msgs_len, sizeof(message));
+
+  if (m == NULL)
+    {
+      compiling = NULL;
+
+      return;
+    }
+
+  prog -> msgs = m;
+  m = &prog -> msgs [prog -> msgs_len];
+  m -> format = format;
+  m -> text   = text;
+  m -> len    = len;
+
+  emit(op, aux, (ULONG)prog -> msgs_len++);
+}
+
+/**************************************************************************************************/
+
+static void
+emit_diag(const char *format, const char *text, int len)
+{
+  if (hide_diags == 0)
+    emit_message(OP_DIAG, 0, format, text, len);
+}
+
+/**************************************************************************************************/
+
+static void
+free_program(program *prog)
+{
+  if (prog == NULL)
+    return;
+
+#if defined (PC_JIT)
+  if (prog -> jit != NULL)
+    (void)munmap(prog -> jit, prog -> jit_size);
+#endif
+
+  FREE(prog -> source);
+  FREE(prog -> code);
+  FREE(prog -> refs);
+  FREE(prog -> msgs);
+  FREE(prog);
+}
+
+/**************************************************************************************************/
+
+static program *
+compile_statement(const char *str)
+{
+  program *prog;
+  token *tok;
+  long n;
+
+  if ((prog = calloc(1, sizeof ( program ))) == NULL)
+    return NULL;
+
+  if ((prog -> source = malloc(strlen(str) + 1)) == NULL || (n = tokenize(
+      strcpy(prog -> source, str))) < 0)
+    {
+      free_program(prog);
+
+      return NULL;
+    }
+
+  prog -> mode = arithmetic_mode;
+  prog -> hook = external_var_lookup;
+  compiling    = prog;
+  tok          = tokens;
+
+  compile_span(&tok, tokens + n);
+  emit(OP_END, 0, 0);
+
+  if (compiling == NULL) /* Out of memory */
+    {
+      free_program(prog);
+
+      return NULL;
+    }
+
+  compiling = NULL;
+  prog -> unset_mode = unset_mode;
+
+  return prog;
+}
+
+/**************************************************************************************************/
+
+static variable *
+ref_var(var_ref *r)
+{
+  if (r -> gen != var_generation)
+    {
+      r -> var = lookup_var(r -> name, r -> len);
+      r -> gen = var_generation;
+    }
+
+  return r -> var;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Fetch a variable's value, creating it as zero if there is no such thing.
+ * Returns 0 if that fails, so x++ is then left alone.
+ */
+
+static int
+load_var(var_ref *r, ULONG *val)
+{
+  variable *v = ref_var(r);
+
+  if (v != NULL)
+    *val = v -> value;
+  else if (external_var_lookup == NULL || external_var_lookup(r -> name, r -> len, val) == 0)
+    {
+      (void)fprintf(stderr, "No such variable: %.*s (assigning value of zero)\n",
+                    (int)r -> len, r -> name);
+      *val = 0;
+
+      if (add_var(r -> name, r -> len, 0) == NULL)
+        return 0;
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static ULONG
+step_var(var_ref *r, ULONG val, int delta)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL)
+    {
+      (void)fprintf(stderr, "%.*s is a read-only variable\n", (int)r -> len, r -> name);
+
+      return val;
+    }
+
+  if (delta > 0)
+    v -> value++;
+  else
+    v -> value--;
+
+  v -> value = truncate_register(v, v -> value);
+
+  return v -> value;
+}
+
+/**************************************************************************************************/
+
+static void
+store_var(var_ref *r, ULONG val)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL)
+    (void)add_var(r -> name, r -> len, val);
+  else
+    {
+      v -> value = truncate_register(v, val);
+
+      if (v -> reg == REG_GT)
+        print_time_reg(v -> name, v -> value);
+    }
+}
+
+/**************************************************************************************************/
+
+static ULONG
+assign_operator(var_ref *r, token_kind operator, ULONG val)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL)
+    {
+      v = add_var(r -> name, r -> len, 0);
+
+      if (v == NULL)
+        return 0;
+    }
+
+  if (operator == TOK_PLUS)
+    {
+      if (v -> value > (ULONG)-1 - val)
+        errno = ERANGE;
+
+      v -> value += val;
+    }
+  else if (operator == TOK_MINUS)
+    {
+      if (sub_overflows(v -> value, val))
+        errno = ERANGE;
+
+      v -> value -= val;
+    }
+  else if (operator == TOK_AND)
+    v -> value &= val;
+  else if (operator == TOK_XOR)
+    v -> value ^= val;
+  else if (operator == TOK_OR)
+    v -> value |= val;
+  else if (operator == TOK_LESS_THAN)
+    {
+      if (val >= sizeof(ULONG) * CHAR_BIT)
+        {
+          errno = EINVAL;
+          (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n",
+                        xstrerror_l(errno));
+        }
+
+      v -> value <<= val;
+    }
+  else if (operator == TOK_GREATER_THAN)
+    {
+      if (val >= sizeof(ULONG) * CHAR_BIT)
+        {
+          errno = EINVAL;
+          (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n", xstrerror_l(errno));
+        }
+
+      v -> value >>= val;
+    }
+  else if (operator == TOK_TIMES)
+    {
+      if (val != 0 && v -> value > (ULONG)-1 / val)
+        errno = ERANGE;
+
+      v -> value *= val;
+    }
+  else if (operator == TOK_DIVISION)
+    {
+      if (val == 0) /* Check, but still get the result! */
+        {
+          errno = EDOM;
+          (void)fprintf(stderr, "Warning: %s (Division by zero)\n", xstrerror_l(errno));
+          v -> value = 0;
+        }
+      else
+        v -> value /= val;
+    }
+  else if (operator == TOK_MODULO)
+    {
+      if (val == 0) /* Check, but still get the result! */
+        {
+          errno = EDOM;
+          (void)fprintf(stderr, "Warning: %s (Modulo by zero)\n", xstrerror_l(errno));
+          v -> value = 0;
+        }
+      else
+        v -> value %= val;
+    }
+
+  v -> value = truncate_register(v, v -> value);
+
+  if (v -> reg == REG_GT)
+    print_time_reg(v -> name, v -> value);
+
+  return v -> value;
+}
+
+/**************************************************************************************************/
+
+static THREAD_LOCAL ULONG  *vm_stack      = NULL;
+static THREAD_LOCAL size_t  vm_stack_size = 0;
+static THREAD_LOCAL int     call_failed   = 0; /* Abandon the statement */
+
+static int call_depth = 0;
+
+#if defined (WITH_THREADS)
+static THREAD_LOCAL int in_worker = 0; /* Running statements for replay_parallel() */
+#else
+# define in_worker 0
+#endif
+
+static ULONG call_function(function *fn, arithmetic_mode_t mode, size_t args);
+
+/**************************************************************************************************/
+
+#if defined (PC_JIT)
+
+/*
+ * Programs run often (JIT_THRESHOLD times, or once if they loop) are
+ * translated to x86-64 machine code, one instruction after another as
+ * execute() would run them, keeping the stack in vm_stack.  rbx points at
+ * the program's stack, r13 at any arguments, and r12 at errno; each stack
+ * slot's offset is known from the depth there.  Anything more than
+ * arithmetic is done by calling the same functions execute() does, and a
+ * program with instructions the JIT doesn't know (calls, unsets, and
+ * messages) is always interpreted.
+ */
+
+# define JIT_THRESHOLD 16
+
+typedef struct jit_buffer
+{
+  unsigned char *code;
+  size_t         len;
+  size_t         size;
+  int            failed;
+} jit_buffer;
+
+typedef ULONG (*jit_code)(ULONG *stack, const ULONG *args, int *err);
+
+/* Registers, as numbered in instructions */
+
+# define RAX 0
+# define RCX 1
+# define RDX 2
+# define RSI 6
+# define RDI 7
+
+/**************************************************************************************************/
+
+static void
+jit_bytes(jit_buffer *b, const char *bytes, size_t n)
+{
+  unsigned char *code;
+
+  if (b -> failed)
+    return;
+
+  if (b -> len + n > b -> size)
+    {
+      if ((code = realloc(b -> code, ( b -> len + n ) * 2)) == NULL)
+        {
+          b -> failed = 1;
+
+          return;
+        }
+
+      b -> code = code;
+      b -> size = ( b -> len + n ) * 2;
+    }
+
+  (void)memcpy(b -> code + b -> len, bytes, n);
+  b -> len += n;
+}
+
+/**************************************************************************************************/
+
+static void
+jit_le(jit_buffer *b, ULONG value, size_t n) /* Little-endian */
+{
+  char bytes [8];
+  size_t i;
+
+  for (i = 0; i < n; i++, value >>= CHAR_BIT)
+    bytes [i] = (char)(value & 0xff);
+
+  jit_bytes(b, bytes, n);
+}
+
+/**************************************************************************************************/
+
+/* mov reg, [rbx + 8 * slot], or the other way */
+
+static void
+jit_slot(jit_buffer *b, int store, int reg, long slot)
+{
+  char bytes [3];
+
+  bytes [0] = '\x48';
+  bytes [1] = store ? '\x89' : '\x8b';
+  bytes [2] = (char)(0x83 | reg << 3);
+  jit_bytes(b, bytes, 3);
+  jit_le(b, (ULONG)(slot * 8), 4);
+}
+
+# define jit_load(b, reg, slot)  jit_slot((b), 0, (reg), (slot))
+# define jit_store(b, reg, slot) jit_slot((b), 1, (reg), (slot))
+
+/**************************************************************************************************/
+
+static void
+jit_imm(jit_buffer *b, int reg, ULONG value) /* mov reg, value */
+{
+  char bytes [2];
+
+  bytes [0] = '\x48';
+  bytes [1] = (char)(0xb8 + reg);
+  jit_bytes(b, bytes, 2);
+  jit_le(b, value, 8);
+}
+
+/**************************************************************************************************/
+
+static void
+jit_call(jit_buffer *b, ULONG function_address)
+{
+  jit_imm(b, RAX, function_address);
+  jit_bytes(b, "\xff\xd0", 2); /* call rax */
+}
+
+# define JIT_ADDRESS(x) ((ULONG)(uintptr_t)( x ))
+
+/**************************************************************************************************/
+
+static void
+jit_set_errno(jit_buffer *b, int value) /* mov dword [r12], value */
+{
+  jit_bytes(b, "\x41\xc7\x04\x24", 4);
+  jit_le(b, (ULONG)value, 4);
+}
+
+/**************************************************************************************************/
+
+/* A jump (with a 32-bit offset) to be pointed at an instruction later */
+
+static size_t
+jit_jump(jit_buffer *b, const char *opcode, size_t n)
+{
+  jit_bytes(b, opcode, n);
+  jit_le(b, 0, 4);
+
+  return b -> len;
+}
+
+/**************************************************************************************************/
+
+static void
+jit_land(jit_buffer *b, size_t jump) /* Point a jump here */
+{
+  ULONG offset = (ULONG)( b -> len - jump );
+  size_t i;
+
+  if (!b -> failed)
+    for (i = 0; i < 4; i++, offset >>= CHAR_BIT)
+      b -> code [jump - 4 + i] = (unsigned char)(offset & 0xff);
+}
+
+/**************************************************************************************************/
+
+/* What execute() does for the instructions that aren't just arithmetic */
+
+static void
+jit_load_var(var_ref *r, ULONG *slot)
+{
+  (void)load_var(r, slot);
+}
+
+static void
+jit_load_step(var_ref *r, ULONG *slot, int delta)
+{
+  if (load_var(r, slot))
+    *slot = step_var(r, *slot, delta);
+}
+
+static void
+jit_pre_step(var_ref *r, ULONG *slot, int delta)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL && (v = add_var(r -> name, r -> len, 0)) == NULL)
+    return;
+
+  v -> value += (ULONG)(LONG)delta;
+  v -> value  = truncate_register(v, v -> value);
+  *slot       = v -> value;
+}
+
+static void
+jit_show_gt(ULONG *slot)
+{
+  *slot = registers [REG_GT].value;
+  print_time_reg(registers [REG_GT].name, *slot);
+}
+
+static void
+jit_warn_shift(void)
+{
+  errno = EINVAL;
+  (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n", xstrerror_l(errno));
+}
+
+static void
+jit_warn_zero(int division)
+{
+  errno = EDOM;
+  (void)fprintf(stderr, "Warning: %s (%s by zero)\n", xstrerror_l(errno),
+                division ? "Division" : "Modulo");
+}
+
+/**************************************************************************************************/
+
+/*
+ * Leave in rax the variable that r (in rdi) refers to, if the reference is
+ * still good, and if plain, it isn't a register.  Otherwise take one of the
+ * jumps (returned in slow) to do it the long way, with a function.
+ */
+
+static size_t
+jit_var(jit_buffer *b, const var_ref *r, int plain, size_t *slow)
+{
+  size_t n = 0;
+
+  jit_imm(b, RDI, JIT_ADDRESS(r));
+  jit_imm(b, RAX, JIT_ADDRESS(&var_generation));
+  jit_bytes(b, "\x48\x8b\x00\x48\x3b\x87", 6);    /* mov rax, [rax]; cmp rax, [rdi + gen] */
+  jit_le(b, (ULONG)offsetof(var_ref, gen), 4);
+  slow [n++] = jit_jump(b, "\x0f\x85", 2);
+  jit_bytes(b, "\x48\x8b\x87", 3);                 /* mov rax, [rdi + var] */
+  jit_le(b, (ULONG)offsetof(var_ref, var), 4);
+  jit_bytes(b, "\x48\x85\xc0", 3);
+  slow [n++] = jit_jump(b, "\x0f\x84", 2);
+
+  if (plain)
+    {
+      jit_bytes(b, "\x83\xb8", 2);                  /* cmp dword [rax + reg], REG_NONE */
+      jit_le(b, (ULONG)offsetof(variable, reg), 4);
+      jit_bytes(b, "\xff", 1);
+      slow [n++] = jit_jump(b, "\x0f\x85", 2);
+    }
+
+  return n;
+}
+
+/**************************************************************************************************/
+
+/* In rax (or another register), the value of the variable rax points to, or the other way */
+
+static void
+jit_value(jit_buffer *b, int store, int reg)
+{
+  char bytes [3];
+
+  bytes [0] = '\x48';
+  bytes [1] = store ? '\x89' : '\x8b';
+  bytes [2] = (char)(0x80 | reg << 3);
+  jit_bytes(b, bytes, 3);
+  jit_le(b, (ULONG)offsetof(variable, value), 4);
+}
+
+/**************************************************************************************************/
+
+/* The stack depth before each instruction, or NULL if it can't be known (or compiled) */
+
+static long *
+jit_depths(const program *prog)
+{
+  long *depth = malloc(prog -> code_len * sizeof(long));
+  long d = 0;
+  size_t i, to;
+
+  if (depth == NULL)
+    return NULL;
+
+  for (i = 0; i < prog -> code_len; i++)
+    depth [i] = -1;
+
+  for (i = 0; i < prog -> code_len; i++)
+    {
+      const instruction *ip = &prog -> code [i];
+
+      if (depth [i] >= 0 && d >= 0 && depth [i] != d)
+        break;
+
+      if (depth [i] < 0)
+        depth [i] = d < 0 ? 0 : d; /* Unreachable, if d < 0 */
+
+      d = depth [i];
+
+      switch (ip -> op)
+        {
+          case OP_CALL:
+          case OP_COMMAND:
+          case OP_REMOVE:
+          case OP_UNSET:
+          case OP_DIAG:
+          case OP_WARN_CONVERT:
+          case OP_WARN_CHAR:
+            FREE(depth);
+
+            return NULL;
+
+          case OP_JUMP:
+          case OP_JUMP_FALSE:
+            d += ip -> op == OP_JUMP_FALSE ? -1 : 0;
+            to = (size_t)ip -> arg;
+
+            if (to >= prog -> code_len || ( depth [to] >= 0 && depth [to] != d ))
+              {
+                FREE(depth);
+
+                return NULL;
+              }
+
+            depth [to] = d;
+
+            if (ip -> op == OP_JUMP)
+              d = -1; /* Whatever jumps to the next one says */
+            break;
+
+          default:
+            d += stack_effect(ip -> op);
+            break;
+        }
+
+      if (d > (long)prog -> max_depth)
+        break;
+    }
+
+  if (i < prog -> code_len)
+    FREE(depth);
+
+  return depth;
+}
+
+/**************************************************************************************************/
+
+/* Compare the top two slots, leaving 0 or 1 in the lower */
+
+static void
+jit_compare(jit_buffer *b, long top, int setcc)
+{
+  char set [3];
+
+  set [0] = '\x0f';
+  set [1] = (char)setcc;
+  set [2] = '\xc0';
+
+  jit_load(b, RAX, top - 1);
+  jit_load(b, RCX, top);
+  jit_bytes(b, "\x48\x39\xc8", 3); /* cmp rax, rcx */
+  jit_bytes(b, set, 3);            /* setcc al     */
+  jit_bytes(b, "\x0f\xb6\xc0", 3); /* movzx eax, al */
+  jit_store(b, RAX, top - 1);
+}
+
+/**************************************************************************************************/
+
+static int
+jit_instruction(jit_buffer *b, const program *prog, size_t i, long d, size_t *from, size_t *to,
+                size_t *jumps)
+{
+  const instruction *ip = &prog -> code [i];
+  const var_ref *r = NULL;
+  long top = d - 1;
+  size_t skip, done, n, slow [3];
+
+  switch (ip -> op)
+    {
+      case OP_END:
+        if (d > 0)
+          jit_load(b, RAX, top);
+        else
+          jit_bytes(b, "\x31\xc0", 2);             /* xor eax, eax */
+
+        jit_bytes(b, "\x41\x5d\x41\x5c\x5b\xc3", 6); /* pop r13, r12, rbx; ret */
+        break;
+
+      case OP_CONST:
+        jit_set_errno(b, 0);
+        /*FALLTHRU*/ /* fall through */
+
+      case OP_PUSH:
+        jit_imm(b, RAX, ip -> arg);
+        jit_store(b, RAX, d);
+        break;
+
+      case OP_LAST:
+        jit_imm(b, RAX, JIT_ADDRESS(&last_result));
+        jit_bytes(b, "\x48\x8b\x00", 3);           /* mov rax, [rax] */
+        jit_store(b, RAX, d);
+        break;
+
+      case OP_SET_LAST:
+      case OP_STORE_LAST:
+        if (ip -> op == OP_SET_LAST)
+          jit_load(b, RCX, top);
+        else
+          jit_imm(b, RCX, ip -> arg);
+
+        jit_imm(b, RAX, JIT_ADDRESS(&last_result));
+        jit_bytes(b, "\x48\x89\x08", 3);           /* mov [rax], rcx */
+        break;
+
+      case OP_SHOW_GT:
+        jit_bytes(b, "\x48\x8d\xbb", 3);           /* lea rdi, [rbx + 8 * d] */
+        jit_le(b, (ULONG)(d * 8), 4);
+        jit_call(b, JIT_ADDRESS(jit_show_gt));
+        break;
+
+      case OP_LOAD:
+        r = &prog -> refs [ip -> arg];
+        n = jit_var(b, r, 0, slow);
+        jit_value(b, 0, RAX);
+        jit_store(b, RAX, d);
+        done = jit_jump(b, "\xe9", 1);
+
+        while (n > 0)
+          jit_land(b, slow [--n]);
+
+        jit_bytes(b, "\x48\x8d\xb3", 3);           /* lea rsi, [rbx + 8 * d] */
+        jit_le(b, (ULONG)(d * 8), 4);
+        jit_call(b, JIT_ADDRESS(jit_load_var));
+        jit_land(b, done);
+        break;
+
+      case OP_LOAD_INC:
+      case OP_LOAD_DEC:
+      case OP_PRE_INC:
+      case OP_PRE_DEC:
+        r = &prog -> refs [ip -> arg];
+        jit_imm(b, RDI, JIT_ADDRESS(r));
+        jit_bytes(b, "\x48\x8d\xb3", 3);           /* lea rsi, [rbx + 8 * slot] */
+        jit_le(b, (ULONG)(( ip -> op == OP_PRE_INC || ip -> op == OP_PRE_DEC ? top : d ) * 8), 4);
+
+        jit_bytes(b, "\xba", 1);                   /* mov edx, delta */
+        jit_le(b, (ULONG)( ip -> op == OP_LOAD_INC || ip -> op == OP_PRE_INC ? 1 : -1 ), 4);
+        jit_call(b, ip -> op == OP_LOAD_INC || ip -> op == OP_LOAD_DEC
+                 ? JIT_ADDRESS(jit_load_step) : JIT_ADDRESS(jit_pre_step));
+        break;
+
+      case OP_ASSIGN:
+        r = &prog -> refs [ip -> arg];
+        jit_load(b, RSI, top);
+        n = jit_var(b, r, 1, slow);
+        jit_value(b, 1, RSI);
+        done = jit_jump(b, "\xe9", 1);
+
+        while (n > 0)
+          jit_land(b, slow [--n]);
+
+        jit_call(b, JIT_ADDRESS(store_var));
+        jit_land(b, done);
+        break;
+
+      case OP_ASSIGN_OP:
+        r = &prog -> refs [ip -> arg];
+        jit_load(b, RDX, top);
+        n    = 0;
+        done = 0;
+
+        if (ip -> aux == TOK_PLUS || ip -> aux == TOK_MINUS || ip -> aux == TOK_AND
+            || ip -> aux == TOK_OR || ip -> aux == TOK_XOR)
+          {
+            n = jit_var(b, r, 1, slow);
+            jit_value(b, 0, RCX);
+
+            switch (ip -> aux)
+              {
+                case TOK_PLUS:  jit_bytes(b, "\x48\x01\xd1\x73\x08", 5); break; /* add; jnc */
+                case TOK_MINUS: jit_bytes(b, "\x48\x29\xd1\x71\x08", 5); break; /* sub; jno */
+                case TOK_AND:   jit_bytes(b, "\x48\x21\xd1", 3); break;
+                case TOK_OR:    jit_bytes(b, "\x48\x09\xd1", 3); break;
+                default:        jit_bytes(b, "\x48\x31\xd1", 3); break;
+              }
+
+            if (ip -> aux == TOK_PLUS || ip -> aux == TOK_MINUS)
+              jit_set_errno(b, ERANGE);
+
+            jit_value(b, 1, RCX);
+            jit_store(b, RCX, top);
+            done = jit_jump(b, "\xe9", 1);
+
+            while (n > 0)
+              jit_land(b, slow [--n]);
+          }
+        else
+          jit_imm(b, RDI, JIT_ADDRESS(r));
+
+        jit_bytes(b, "\xbe", 1);                   /* mov esi, operator */
+        jit_le(b, (ULONG)ip -> aux, 4);
+        jit_call(b, JIT_ADDRESS(assign_operator));
+        jit_store(b, RAX, top);
+
+        if (done != 0)
+          jit_land(b, done);
+        break;
+
+      case OP_NEG:
+      case OP_COMPL:
+        jit_load(b, RAX, top);
+        jit_bytes(b, ip -> op == OP_NEG ? "\x48\xf7\xd8" : "\x48\xf7\xd0", 3); /* neg/not rax */
+        jit_store(b, RAX, top);
+        break;
+
+      case OP_NOT:
+        jit_load(b, RAX, top);
+        jit_bytes(b, "\x48\x85\xc0\x0f\x94\xc0\x0f\xb6\xc0", 9); /* test; sete al; movzx */
+        jit_store(b, RAX, top);
+        break;
+
+      case OP_LOGOR:
+      case OP_LOGAND:
+        jit_load(b, RAX, top - 1);
+        jit_load(b, RCX, top);
+        jit_bytes(b, "\x48\x85\xc0\x0f\x95\xc0\x48\x85\xc9\x0f\x95\xc1", 12); /* al, cl = != 0 */
+        jit_bytes(b, ip -> op == OP_LOGOR ? "\x08\xc8" : "\x20\xc8", 2);      /* or/and al, cl */
+        jit_bytes(b, "\x0f\xb6\xc0", 3);
+        jit_store(b, RAX, top - 1);
+        break;
+
+      case OP_OR:
+      case OP_XOR:
+      case OP_AND:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_SADD:
+      case OP_SSUB:
+        jit_load(b, RAX, top - 1);
+        jit_load(b, RCX, top);
+
+        switch (ip -> op)
+          {
+            case OP_OR:  jit_bytes(b, "\x48\x09\xc8", 3); break;
+            case OP_XOR: jit_bytes(b, "\x48\x31\xc8", 3); break;
+            case OP_AND: jit_bytes(b, "\x48\x21\xc8", 3); break;
+            case OP_ADD:
+            case OP_SADD: jit_bytes(b, "\x48\x01\xc8", 3); break;
+            default:      jit_bytes(b, "\x48\x29\xc8", 3); break;
+          }
+
+        if (ip -> op == OP_ADD || ip -> op == OP_SUB) /* Carry, or signed overflow */
+          {
+            jit_bytes(b, ip -> op == OP_ADD ? "\x73\x08" : "\x71\x08", 2); /* jnc/jno +8 */
+            jit_set_errno(b, ERANGE);
+          }
+
+        jit_store(b, RAX, top - 1);
+        break;
+
+      case OP_MUL:
+      case OP_SMUL:
+        jit_load(b, RAX, top - 1);
+        jit_load(b, RCX, top);
+
+        if (ip -> op == OP_MUL)
+          {
+            jit_bytes(b, "\x48\xf7\xe1\x73\x08", 5); /* mul rcx; jnc +8 */
+            jit_set_errno(b, ERANGE);
+          }
+        else
+          jit_bytes(b, "\x48\x0f\xaf\xc1", 4);       /* imul rax, rcx */
+
+        jit_store(b, RAX, top - 1);
+        break;
+
+      case OP_DIV:
+      case OP_MOD:
+      case OP_SDIV:
+      case OP_SMOD:
+        jit_load(b, RCX, top);
+        jit_bytes(b, "\x48\x85\xc9", 3);            /* test rcx, rcx */
+        skip = jit_jump(b, "\x0f\x85", 2);          /* jnz */
+        jit_bytes(b, "\xbf", 1);                    /* mov edi, division */
+        jit_le(b, (ULONG)( ip -> op == OP_DIV || ip -> op == OP_SDIV ), 4);
+        jit_call(b, JIT_ADDRESS(jit_warn_zero));
+        jit_bytes(b, "\x31\xc0", 2);                /* xor eax, eax */
+        done = jit_jump(b, "\xe9", 1);
+        jit_land(b, skip);
+        jit_load(b, RAX, top - 1);
+
+        if (ip -> op == OP_DIV || ip -> op == OP_MOD)
+          jit_bytes(b, "\x31\xd2\x48\xf7\xf1", 5);  /* xor edx, edx; div rcx */
+        else
+          {
+            size_t plain, minus;
+
+            jit_bytes(b, "\x48\x83\xf9\xff", 4);    /* cmp rcx, -1 (don't trap) */
+            plain = jit_jump(b, "\x0f\x85", 2);
+            jit_bytes(b, ip -> op == OP_SDIV ? "\x48\xf7\xd8" : "\x31\xc0", /* neg rax, or 0 */
+                      ip -> op == OP_SDIV ? 3 : 2);
+            jit_bytes(b, "\x31\xd2", 2);            /* xor edx, edx */
+            minus = jit_jump(b, "\xe9", 1);
+            jit_land(b, plain);
+            jit_bytes(b, "\x48\x99\x48\xf7\xf9", 5); /* cqo; idiv rcx */
+            jit_land(b, minus);
+          }
+
+        if (ip -> op == OP_MOD || ip -> op == OP_SMOD)
+          jit_bytes(b, "\x48\x89\xd0", 3);          /* mov rax, rdx */
+
+        jit_land(b, done);
+        jit_store(b, RAX, top - 1);
+        break;
+
+      case OP_SHL:
+      case OP_SHR:
+        jit_load(b, RCX, top);
+        jit_bytes(b, "\x48\x83\xf9\x3f", 4);        /* cmp rcx, 63 */
+        skip = jit_jump(b, "\x0f\x86", 2);          /* jbe */
+        jit_call(b, JIT_ADDRESS(jit_warn_shift));
+        jit_load(b, RCX, top);
+        jit_land(b, skip);
+        jit_load(b, RAX, top - 1);
+        jit_bytes(b, ip -> op == OP_SHL ? "\x48\xd3\xe0" : "\x48\xd3\xe8", 3); /* shl/shr rax, cl */
+        jit_store(b, RAX, top - 1);
+        break;
+
+      case OP_EQ:  jit_compare(b, top, 0x94); break;
+      case OP_NE:  jit_compare(b, top, 0x95); break;
+      case OP_LT:  jit_compare(b, top, 0x9c); break;
+      case OP_LE:  jit_compare(b, top, 0x9e); break;
+      case OP_GT:  jit_compare(b, top, 0x9f); break;
+      case OP_GE:  jit_compare(b, top, 0x9d); break;
+      case OP_ULT: jit_compare(b, top, 0x92); break;
+      case OP_ULE: jit_compare(b, top, 0x96); break;
+      case OP_UGT: jit_compare(b, top, 0x97); break;
+      case OP_UGE: jit_compare(b, top, 0x93); break;
+
+      case OP_MUL_POW2:
+      case OP_DIV_POW2:
+      case OP_MOD_POW2:
+        if (ip -> aux)
+          jit_set_errno(b, 0);
+
+        jit_load(b, RAX, top);
+
+        if (ip -> op == OP_MUL_POW2)
+          {
+            jit_imm(b, RCX, (ULONG)-1 >> ip -> arg);
+            jit_bytes(b, "\x48\x39\xc8\x76\x08", 5); /* cmp rax, rcx; jbe +8 */
+            jit_set_errno(b, ERANGE);
+          }
+
+        if (ip -> op == OP_MOD_POW2)
+          {
+            jit_imm(b, RCX, ip -> arg);
+            jit_bytes(b, "\x48\x21\xc8", 3);         /* and rax, rcx */
+          }
+        else
+          {
+            jit_bytes(b, ip -> op == OP_MUL_POW2 ? "\x48\xc1\xe0" : "\x48\xc1\xe8", 3);
+            jit_le(b, ip -> arg, 1);                 /* shl/shr rax, arg */
+          }
+
+        jit_store(b, RAX, top);
+        break;
+
+      case OP_JUMP:
+      case OP_JUMP_FALSE:
+        if (ip -> op == OP_JUMP_FALSE)
+          {
+            jit_load(b, RAX, top);
+            jit_bytes(b, "\x48\x85\xc0", 3);         /* test rax, rax */
+          }
+
+        from [*jumps] = ip -> op == OP_JUMP ? jit_jump(b, "\xe9", 1) : jit_jump(b, "\x0f\x84", 2);
+        to [( *jumps )++] = (size_t)ip -> arg;
+        break;
+
+      case OP_POP:
+        break;
+
+      case OP_PRINT:
+        jit_load(b, RDI, top);
+        jit_call(b, JIT_ADDRESS(print_result));
+        break;
+
+      case OP_ARG:
+        jit_bytes(b, "\x49\x8b\x85", 3);             /* mov rax, [r13 + 8 * arg] */
+        jit_le(b, ip -> arg * 8, 4);
+        jit_store(b, RAX, d);
+        break;
+
+      default:
+        return 0;
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Translate prog, leaving prog -> jit NULL (for good) if it can't be */
+
+static void
+jit_compile(program *prog)
+{
+  jit_buffer b = { NULL, 0, 0, 0 };
+  size_t *offset = NULL, *from = NULL, *to = NULL;
+  size_t i, jumps = 0;
+  long *depth;
+  void *code;
+
+  prog -> jit_tried = 1;
+
+  if ((depth = jit_depths(prog)) == NULL)
+    return;
+
+  offset = malloc(( prog -> code_len + 1 ) * sizeof(size_t));
+  from   = malloc(( prog -> code_len + 1 ) * sizeof(size_t));
+  to     = malloc(( prog -> code_len + 1 ) * sizeof(size_t));
+
+  if (offset == NULL || from == NULL || to == NULL)
+    b.failed = 1;
+
+  /* push rbx, r12, r13; mov rbx, rdi; mov r13, rsi; mov r12, rdx */
+
+  jit_bytes(&b, "\x53\x41\x54\x41\x55\x48\x89\xfb\x49\x89\xf5\x49\x89\xd4", 14);
+
+  for (i = 0; !b.failed && i < prog -> code_len; i++)
+    {
+      offset [i] = b.len;
+
+      if (!jit_instruction(&b, prog, i, depth [i], from, to, &jumps))
+        b.failed = 1;
+    }
+
+  for (i = 0; !b.failed && i < jumps; i++)
+    {
+      size_t at = b.len;
+
+      b.len = offset [to [i]]; /* Land it there */
+      jit_land(&b, from [i]);
+      b.len = at;
+    }
+
+  if (!b.failed)
+    {
+      code = mmap(NULL, b.len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+      if (code != MAP_FAILED)
+        {
+          (void)memcpy(code, b.code, b.len);
+
+          if (mprotect(code, b.len, PROT_READ | PROT_EXEC) == 0)
+            {
+              prog -> jit      = code;
+              prog -> jit_size = b.len;
+            }
+          else
+            (void)munmap(code, b.len);
+        }
+    }
+
+  FREE(b.code);
+  FREE(offset);
+  FREE(from);
+  FREE(to);
+  FREE(depth);
+}
+
+/**************************************************************************************************/
+
+static int
+has_loop(const program *prog)
+{
+  size_t i;
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_JUMP && prog -> code [i].arg <= i)
+      return 1;
+
+  return 0;
+}
+
+#endif /* defined (PC_JIT) */
+
+/**************************************************************************************************/
+
+/*
+ * Run prog with its stack starting at vm_stack [base], and (for a function
+ * body) its arguments at vm_stack [args].  The stack may be moved by a call,
+ * so after one the stack pointer is found again from its index.
+ */
+
+static ULONG
+execute(program *prog, size_t base, size_t args)
+{
+  const instruction *ip;
+  ULONG *sp, val;
+
+  if (base + prog -> max_depth > vm_stack_size)
+    {
+      ULONG *new_stack = realloc(vm_stack, ( base + prog -> max_depth ) * sizeof(ULONG));
+
+      if (new_stack == NULL)
+        {
+          (void)fprintf(stderr, "ERROR: out of memory\n");
+          call_failed = 1;
+
+          return 0;
+        }
+
+      vm_stack      = new_stack;
+      vm_stack_size = base + prog -> max_depth;
+    }
+
+#if defined (PC_JIT)
+  if (!in_worker && prog -> jit == NULL && !prog -> jit_tried
+      && ( ++prog -> runs >= JIT_THRESHOLD || has_loop(prog) ))
+    jit_compile(prog);
+
+  if (prog -> jit != NULL && !in_worker) /* It sets the main thread's '.' */
+    {
+      jit_code code;
+
+      (void)memcpy(&code, &prog -> jit, sizeof ( code ));
+
+      return code(vm_stack + base, vm_stack + args, &errno);
+    }
+#endif
+
+  sp = vm_stack + base - 1; /* Points at the top of the stack */
+
+  ip = prog -> code;
+
+  while (always)
+    {
+      switch (ip -> op)
+        {
+          case OP_END:
+            return *sp;
+
+          case OP_PUSH:
+            *++sp = ip -> arg;
+            break;
+
+          case OP_CONST:
+            errno = 0;
+            *++sp = ip -> arg;
+            break;
+
+          case OP_LAST:
+            *++sp = last_result;
+            break;
+
+          case OP_SET_LAST:
+            last_result = *sp;
+            break;
+
+          case OP_SHOW_GT:
+            *++sp = registers [REG_GT].value;
+            print_time_reg(registers [REG_GT].name, *sp);
+            break;
+
+          case OP_LOAD:
+            (void)load_var(&prog -> refs [ip -> arg], ++sp);
+            break;
+
+          case OP_LOAD_INC:
+          case OP_LOAD_DEC:
+            if (load_var(&prog -> refs [ip -> arg], ++sp))
+              *sp = step_var(&prog -> refs [ip -> arg], *sp, ip -> op == OP_LOAD_INC ? 1 : -1);
+            break;
+
+          case OP_PRE_INC:
+          case OP_PRE_DEC:
+            {
+              var_ref *r = &prog -> refs [ip -> arg];
+              variable *v = ref_var(r);
+
+              if (v == NULL && (v = add_var(r -> name, r -> len, 0)) == NULL)
+                break;
+
+              if (ip -> op == OP_PRE_INC)
+                v -> value++;
+              else
+                v -> value--;
+
+              v -> value = truncate_register(v, v -> value);
+              *sp = v -> value;
+            }
+            break;
+
+          case OP_ASSIGN:
+            store_var(&prog -> refs [ip -> arg], *sp);
+            break;
+
+          case OP_ASSIGN_OP:
+            *sp = assign_operator(&prog -> refs [ip -> arg], (token_kind)ip -> aux, *sp);
+            break;
+
+          case OP_REMOVE:
+          case OP_UNSET:
+            {
+              var_ref *r = &prog -> refs [ip -> arg];
+              int existed = remove_var(r -> name, r -> len);
+
+              if (existed && !ip -> aux && !quiet)
+                (void)fprintf(stdout, "Variable '%.*s' unset.\n", (int)r -> len, r -> name);
+              else if (!existed && !ip -> aux && ip -> op == OP_UNSET)
+                (void)fprintf(stderr, "Warning: no such variable '%.*s'.\n",
+                              (int)r -> len, r -> name);
+
+              if (ip -> op == OP_UNSET)
+                *++sp = 0;
+            }
+            break;
+
+          case OP_DIAG:
+            {
+              const message *m = &prog -> msgs [ip -> arg];
+
+              (void)fprintf(stderr, m -> format, m -> len, m -> text);
+            }
+            break;
+
+          case OP_WARN_CONVERT:
+            {
+              const message *m = &prog -> msgs [ip -> arg];
+
+              errno = ip -> aux;
+              (void)fprintf(stderr, "Warning when converting input%s%.*s%s: %s\n",
+                            m -> len > 0 ? " '" : "", m -> len, m -> text,
+                            m -> len > 0 ? "'" : "", xstrerror_l(errno));
+            }
+            break;
+
+          case OP_WARN_CHAR:
+            (void)fprintf(stderr,
+                "Warning: character constant not terminated or too long (max len == %ld bytes)\n",
+                          (long)sizeof ( LONG ));
+            break;
+
+          case OP_NEG:
+#if defined (_MSC_VER)
+# pragma warning( disable : 4146 )
+#endif
+#if defined (USE_LONG_LONG)
+            *sp *= -(ULONG)1LL;
+#else
+            *sp *= -(ULONG)1L;
+#endif
+#if defined (_MSC_VER)
+# pragma warning( default : 4146 )
+#endif
+            break;
+
+          case OP_NOT:
+            *sp = !*sp;
+            break;
+
+          case OP_COMPL:
+            *sp = ~*sp;
+            break;
+
+          case OP_LOGOR:
+            val = *sp--;
+            *sp = ( val || *sp );
+            break;
+
+          case OP_LOGAND:
+            val = *sp--;
+            *sp = ( val && *sp );
+            break;
+
+          case OP_OR:
+            val  = *sp--;
+            *sp |= val;
+            break;
+
+          case OP_XOR:
+            val  = *sp--;
+            *sp ^= val;
+            break;
+
+          case OP_AND:
+            val  = *sp--;
+            *sp &= val;
+            break;
+
+          case OP_EQ:
+            val = *sp--;
+            *sp = ( *sp == val );
+            break;
+
+          case OP_NE:
+            val = *sp--;
+            *sp = ( *sp != val );
+            break;
+
+          case OP_LT:
+            val = *sp--;
+            *sp = ((LONG)*sp < (LONG)val );
+            break;
+
+          case OP_LE:
+            val = *sp--;
+            *sp = ((LONG)*sp <= (LONG)val );
+            break;
+
+          case OP_GT:
+            val = *sp--;
+            *sp = ((LONG)*sp > (LONG)val );
+            break;
+
+          case OP_GE:
+            val = *sp--;
+            *sp = ((LONG)*sp >= (LONG)val );
+            break;
+
+          case OP_ULT:
+            val = *sp--;
+            *sp = (*sp < val);
+            break;
+
+          case OP_ULE:
+            val = *sp--;
+            *sp = (*sp <= val);
+            break;
+
+          case OP_UGT:
+            val = *sp--;
+            *sp = (*sp > val);
+            break;
+
+          case OP_UGE:
+            val = *sp--;
+            *sp = (*sp >= val);
+            break;
+
+          case OP_SHL:
+          case OP_SHR:
+            val = *sp--;
+
+            if (val >= sizeof(ULONG) * CHAR_BIT)
+              {
+                errno = EINVAL;
+                (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n",
+                              xstrerror_l(errno));
+              }
+
+            if (ip -> op == OP_SHL)
+              *sp <<= val;
+            else
+              *sp >>= val;
+            break;
+
+          case OP_ADD:
+            val = *sp--;
+
+            if (*sp > (ULONG)-1 - val)
+              errno = ERANGE;
+
+            *sp += val;
+            break;
+
+          case OP_SUB:
+            val = *sp--;
+
+            if (sub_overflows(*sp, val))
+              errno = ERANGE;
+
+            *sp -= val;
+            break;
+
+          case OP_MUL:
+            val = *sp--;
+
+            if (val != 0 && *sp > (ULONG)-1 / val)
+              errno = ERANGE;
+
+            *sp *= val;
+            break;
+
+          case OP_DIV:
+          case OP_SDIV:
+          case OP_MOD:
+          case OP_SMOD:
+            val = *sp--;
+
+            if (val == 0)
+              {
+                errno = EDOM;
+                (void)fprintf(stderr, "Warning: %s (%s by zero)\n", xstrerror_l(errno),
+                              ip -> op == OP_DIV || ip -> op == OP_SDIV ? "Division" : "Modulo");
+                *sp = 0;
+              }
+            else if (ip -> op == OP_DIV)
+              *sp /= val;
+            else if (ip -> op == OP_SDIV)
+              *sp = (ULONG)((LONG)*sp / (LONG)val);
+            else if (ip -> op == OP_MOD)
+              *sp %= val;
+            else
+              *sp = (ULONG)((LONG)*sp % (LONG)val);
+            break;
+
+          case OP_SADD:
+            val = *sp--;
+            *sp = (ULONG)((LONG)*sp + (LONG)val);
+            break;
+
+          case OP_SSUB:
+            val = *sp--;
+            *sp = (ULONG)((LONG)*sp - (LONG)val);
+            break;
+
+          case OP_SMUL:
+            val = *sp--;
+            *sp = (ULONG)((LONG)*sp * (LONG)val);
+            break;
+
+          case OP_STORE_LAST:
+            last_result = ip -> arg;
+            break;
+
+          case OP_MUL_POW2:
+            if (ip -> aux)
+              errno = 0;
+
+            if (*sp > (ULONG)-1 >> ip -> arg)
+              errno = ERANGE;
+
+            *sp <<= ip -> arg;
+            break;
+
+          case OP_DIV_POW2:
+            if (ip -> aux)
+              errno = 0;
+
+            *sp >>= ip -> arg;
+            break;
+
+          case OP_MOD_POW2:
+            if (ip -> aux)
+              errno = 0;
+
+            *sp &= ip -> arg;
+            break;
+
+          case OP_JUMP:
+            ip = prog -> code + ip -> arg;
+            continue;
+
+          case OP_JUMP_FALSE:
+            if (*sp-- == 0)
+              {
+                ip = prog -> code + ip -> arg;
+                continue;
+              }
+            break;
+
+          case OP_POP:
+            sp--;
+            break;
+
+          case OP_PRINT:
+            print_result(*sp--);
+            break;
+
+          case OP_COMMAND:
+            {
+              const message *m = &prog -> msgs [ip -> arg];
+
+              (void)run_command(m -> text, (size_t)m -> len);
+            }
+            break;
+
+          case OP_ARG:
+            *++sp = vm_stack [args + ip -> arg];
+            break;
+
+          case OP_CALL:
+            {
+              /*LINTED: E_PTRDIFF_OVERFLOW*/
+              size_t first = (size_t)(sp + 1 - vm_stack) - (size_t)ip -> aux;
+
+              val = call_function(&functions [ip -> arg], prog -> mode, first);
+
+              if (call_failed)
+                return 0;
+
+              sp  = vm_stack + first;
+              *sp = val;
+            }
+            break;
+
+#if !defined (__func__)
+# define __func__ "execute" /* //-V1059 */
+# if defined (PC_FUNC)
+#  undef PC_FUNC
+# endif
+# define PC_FUNC
+#endif
+
+          default:
+            (void)fprintf(stderr, "FATAL: Bugcheck: unknown opcode at %s [%s:%d]\n",
+                          __FILE__, __func__, __LINE__);
+            abort();
+
+#if defined (PC_FUNC)
+# undef __func__
+# undef PC_FUNC
+#endif
+        }
+
+      ip++;
+    }
+
+  /*NOTREACHED*/ /* unreachable */
+  return 0;
+}
+
+/**************************************************************************************************/
+
+static ULONG
+run_program(program *prog)
+{
+  ULONG val;
+
+  call_failed = 0;
+  val = execute(prog, 0, 0);
+
+  if (call_failed) /* Nothing to print */
+    {
+      unset_mode = 1;
+
+      return 0;
+    }
+
+  unset_mode = prog -> unset_mode;
+
+  return val;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Compiled statements are kept in a small cache, so evaluating the same text
+ * again (in the same mode) skips straight to run_program().  Entries are
+ * found by a hash of the statement text, which process_statement() has
+ * already trimmed, and the least recently used one goes when it is full.
+ */
+
+#define PROGRAM_CACHE_SIZE 64
+#define PROGRAM_BUCKETS    128 /* Power of two */
+
+static program *program_bucket [PROGRAM_BUCKETS];
+static program *newest_program = NULL;
+static program *oldest_program = NULL;
+static size_t   program_count  = 0;
+
+/**************************************************************************************************/
+
+static program *
+find_program(const char *str, uint32_t hash)
+{
+  program *prog;
+
+  for (prog = program_bucket [hash & (PROGRAM_BUCKETS - 1)]; prog != NULL; prog = prog -> chain)
+    if (prog -> hash == hash && prog -> mode == arithmetic_mode
+        && prog -> hook == external_var_lookup && strcmp(prog -> source, str) == 0)
+      return prog;
+
+  return NULL;
+}
+
+/**************************************************************************************************/
+
+static void
+unlink_program(program *prog)
+{
+  if (prog -> newer != NULL)
+    prog -> newer -> older = prog -> older;
+  else
+    newest_program = prog -> older;
+
+  if (prog -> older != NULL)
+    prog -> older -> newer = prog -> newer;
+  else
+    oldest_program = prog -> newer;
+}
+
+/**************************************************************************************************/
+
+static void
+make_newest(program *prog)
+{
+  prog -> newer = NULL;
+  prog -> older = newest_program;
+
+  if (newest_program != NULL)
+    newest_program -> newer = prog;
+  else
+    oldest_program = prog;
+
+  newest_program = prog;
+}
+
+/**************************************************************************************************/
+
+static void
+drop_oldest_program(void)
+{
+  program *prog = oldest_program;
+  program **link = &program_bucket [prog -> hash & (PROGRAM_BUCKETS - 1)];
+
+  while (*link != prog)
+    link = &( *link ) -> chain;
+
+  *link = prog -> chain;
+  unlink_program(prog);
+  free_program(prog);
+  program_count--;
+}
+
+/**************************************************************************************************/
+
+static ULONG
+parse_expression(char *str)
+{
+  program *prog;
+  uint32_t hash;
+
+  if (str == NULL)
+    return last_result;
+
+  prog = newest_program; /* Checked first: no need to hash a repeat */
+
+  if (prog != NULL && prog -> mode == arithmetic_mode && prog -> hook == external_var_lookup
+      && strcmp(prog -> source, str) == 0)
+    {
+      cache_hits++;
+
+      return run_program(prog);
+    }
+
+  hash = hash32s(str, strlen(str), (uint32_t)arithmetic_mode);
+
+  if ((prog = find_program(str, hash)) != NULL)
+    {
+      cache_hits++;
+      unlink_program(prog);
+      make_newest(prog);
+    }
+  else
+    {
+      cache_misses++;
+
+      if ((prog = compile_statement(str)) == NULL)
+        {
+          (void)fprintf(stderr, "ERROR: out of memory\n");
+
+          return 0;
+        }
+
+      if (program_count == PROGRAM_CACHE_SIZE)
+        drop_oldest_program();
+
+      prog -> hash  = hash;
+      prog -> chain = program_bucket [hash & (PROGRAM_BUCKETS - 1)];
+      program_bucket [hash & (PROGRAM_BUCKETS - 1)] = prog;
+      make_newest(prog);
+      program_count++;
+    }
+
+  return run_program(prog);
+}
+
+/**************************************************************************************************/
+
+/* Compile text aside from any statement being run, leaving the compiler's state alone */
+
+static program *
+compile_in_mode(const char *text, arithmetic_mode_t mode)
+{
+  arithmetic_mode_t old_mode = arithmetic_mode;
+  int old_unset = unset_mode, old_silent = unset_silent, old_assigns = statement_assigns;
+  program *prog;
+
+  arithmetic_mode = mode;
+  prog            = compile_statement(text);
+
+  arithmetic_mode   = old_mode;
+  unset_mode        = old_unset;
+  unset_silent      = old_silent;
+  statement_assigns = old_assigns;
+
+  return prog;
+}
+
+/**************************************************************************************************/
+
+#define WATCH_BUCKETS_MIN 64 /* Power of two */
+
+#define USE_READ  1
+#define USE_WRITE 2
+
+static watch       **watch_bucket  = NULL;
+static size_t        watch_buckets = 0; /* Doubled when there are as many watches */
+static size_t        watch_count   = 0;
+static rule        **rules       = NULL; /* In no order */
+static size_t        rules_len   = 0;
+static size_t        rules_size  = 0;
+static unsigned long rule_seq    = 0;
+static unsigned long rule_mark   = 0;
+
+/* Work space for update_rules(): rules waiting to run, as a heap by seq */
+
+static rule  **pending      = NULL;
+static size_t  pending_len  = 0;
+static size_t  pending_size = 0;
+static watch **touched      = NULL;
+static size_t  touched_len  = 0;
+static size_t  touched_size = 0;
+
+/**************************************************************************************************/
+
+static int
+grow_watches(void)
+{
+  size_t new_buckets = watch_buckets ? watch_buckets * 2 : WATCH_BUCKETS_MIN;
+  watch **new_bucket = calloc(new_buckets, sizeof(watch *));
+  watch *w;
+  size_t i;
+
+  if (new_bucket == NULL)
+    return 0;
+
+  for (i = 0; i < watch_buckets; i++)
+    while ((w = watch_bucket [i]) != NULL)
+      {
+        watch_bucket [i] = w -> chain;
+        w -> chain = new_bucket [w -> hash & (new_buckets - 1)];
+        new_bucket [w -> hash & (new_buckets - 1)] = w;
+      }
+
+  FREE(watch_bucket);
+  watch_bucket  = new_bucket;
+  watch_buckets = new_buckets;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static watch *
+find_watch(const char *name, size_t len)
+{
+  uint32_t hash = hash32s(name, len, 0);
+  watch **link;
+  watch *w;
+
+  if (watch_count >= watch_buckets && !grow_watches())
+    return NULL;
+
+  for (w = watch_bucket [hash & (watch_buckets - 1)]; w != NULL; w = w -> chain)
+    if (w -> hash == hash && w -> len == len && memcmp(w -> name, name, len) == 0)
+      return w;
+
+  if ((w = calloc(1, sizeof ( watch ))) == NULL || (w -> name = malloc(len)) == NULL)
+    {
+      FREE(w);
+
+      return NULL;
+    }
+
+  link = &watch_bucket [hash & (watch_buckets - 1)];
+  (void)memcpy(w -> name, name, len);
+  w -> len   = len;
+  w -> hash  = hash;
+  w -> chain = *link;
+  *link      = w;
+  watch_count++;
+
+  return w;
+}
+
+/**************************************************************************************************/
+
+static int
+ref_use(opcode op)
+{
+  switch (op)
+    {
+      case OP_LOAD:
+        return USE_READ;
+
+      case OP_LOAD_INC:
+      case OP_LOAD_DEC:
+      case OP_PRE_INC:
+      case OP_PRE_DEC:
+      case OP_ASSIGN_OP:
+        return USE_READ | USE_WRITE;
+
+      case OP_ASSIGN:
+      case OP_REMOVE:
+      case OP_UNSET:
+        return USE_WRITE;
+
+      default:
+        return 0;
+    }
+}
+
+/**************************************************************************************************/
+
+/*
+ * List the variables prog reads or writes (as use says), setting *len.
+ * Returns NULL if there are none, or if out of memory (setting *len to
+ * (size_t)-1).
+ */
+
+static dependency *
+program_uses(const program *prog, int use, size_t *len)
+{
+  unsigned char *used;
+  dependency *list = NULL;
+  size_t i;
+
+  *len = 0;
+
+  if (prog -> refs_len == 0)
+    return NULL;
+
+  if ((used = calloc(prog -> refs_len, 1)) == NULL
+      || (list = calloc(prog -> refs_len, sizeof ( dependency ))) == NULL)
+    {
+      FREE(used);
+      *len = (size_t)-1;
+
+      return NULL;
+    }
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (ref_use(prog -> code [i].op) & use)
+      used [prog -> code [i].arg] = 1;
+
+  for (i = 0; i < prog -> refs_len; i++)
+    if (used [i])
+      {
+        if ((list [*len].var = find_watch(prog -> refs [i].name, prog -> refs [i].len)) == NULL)
+          {
+            FREE(used);
+            FREE(list);
+            *len = (size_t)-1;
+
+            return NULL;
+          }
+
+        ( *len )++;
+      }
+
+  FREE(used);
+
+  return list;
+}
+
+/**************************************************************************************************/
+
+/* Index of the first rule in list (which is in order of seq) after seq */
+
+static size_t
+rules_after(rule *const *list, size_t len, unsigned long seq)
+{
+  size_t low = 0, high = len;
+
+  while (low < high)
+    {
+      size_t mid = low + ( high - low ) / 2;
+
+      if (list [mid] -> seq <= seq)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+
+  return low;
+}
+
+/**************************************************************************************************/
+
+/* Put r in its place in list, which has room for it */
+
+static void
+insert_rule(rule **list, size_t *len, rule *r)
+{
+  size_t at = rules_after(list, *len, r -> seq);
+
+  (void)memmove(list + at + 1, list + at, ( *len - at ) * sizeof(rule *));
+  list [at] = r;
+  ( *len )++;
+}
+
+/**************************************************************************************************/
+
+static void
+remove_rule(rule **list, size_t *len, const rule *r)
+{
+  size_t at = rules_after(list, *len, r -> seq) - 1; /* Seqs are never shared */
+
+  (void)memmove(list + at, list + at + 1, ( *len - at - 1 ) * sizeof(rule *));
+  ( *len )--;
+}
+
+/**************************************************************************************************/
+
+static void
+free_rule(rule *r)
+{
+  size_t i;
+
+  for (i = 0; i < r -> reads_len; i++)
+    remove_rule(r -> reads [i].var -> readers, &r -> reads [i].var -> readers_len, r);
+
+  for (i = 0; i < r -> writes_len; i++)
+    remove_rule(r -> writes [i].var -> writers, &r -> writes [i].var -> writers_len, r);
+
+  rules [r -> index] = rules [--rules_len];
+  rules [r -> index] -> index = r -> index;
+
+  free_program(r -> prog);
+  FREE(r -> reads);
+  FREE(r -> writes);
+  FREE(r -> text);
+  FREE(r);
+}
+
+/**************************************************************************************************/
+
+static void
+drop_rules(void)
+{
+  watch *w;
+  size_t i;
+
+  while (rules_len > 0)
+    free_rule(rules [0]);
+
+  for (i = 0; i < watch_buckets; i++)
+    while ((w = watch_bucket [i]) != NULL)
+      {
+        watch_bucket [i] = w -> chain;
+        FREE(w -> name);
+        FREE(w -> readers);
+        FREE(w -> writers);
+        FREE(w);
+      }
+
+  FREE(watch_bucket);
+  watch_buckets = 0;
+  watch_count   = 0;
+}
+
+/**************************************************************************************************/
+
+/* The rule whose value of w one at seq reads, or NULL if there's none before it */
+
+static rule *
+writer_before(const watch *w, unsigned long seq)
+{
+  size_t at = rules_after(w -> writers, w -> writers_len, seq - 1);
+
+  return at > 0 ? w -> writers [at - 1] : NULL;
+}
+
+/**************************************************************************************************/
+
+static ULONG
+dependency_value(const rule *r, const watch *w, int *present)
+{
+  size_t i;
+
+  for (i = 0; i < r -> writes_len; i++)
+    if (r -> writes [i].var == w)
+      {
+        *present = r -> writes [i].present;
+
+        return r -> writes [i].value;
+      }
+
+  *present = 0;
+
+  return 0;
+}
+
+/**************************************************************************************************/
+
+static void
+set_watched(const watch *w, ULONG value, int present)
+{
+  variable *v = lookup_var(w -> name, w -> len);
+
+  if (!present)
+    (void)remove_var(w -> name, w -> len);
+  else if (v != NULL)
+    v -> value = truncate_register(v, value);
+  else
+    (void)add_var(w -> name, w -> len, value);
+}
+
+/**************************************************************************************************/
+
+static void
+record_writes(rule *r)
+{
+  size_t i;
+
+  for (i = 0; i < r -> writes_len; i++)
+    {
+      variable *v = lookup_var(r -> writes [i].var -> name, r -> writes [i].var -> len);
+
+      r -> writes [i].present = ( v != NULL );
+      r -> writes [i].value   = v != NULL ? v -> value : 0;
+    }
+}
+
+/**************************************************************************************************/
+
+static int
+push_pending(rule *r)
+{
+  rule **heap = grow_array(pending, &pending_size, pending_len, sizeof(rule *));
+  size_t i;
+
+  if (heap == NULL)
+    return 0;
+
+  pending = heap;
+  r -> mark = rule_mark;
+
+  for (i = pending_len++; i > 0 && heap [( i - 1 ) / 2] -> seq > r -> seq; i = ( i - 1 ) / 2)
+    heap [i] = heap [( i - 1 ) / 2];
+
+  heap [i] = r;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static rule *
+pop_pending(void)
+{
+  rule *top = pending [0], *last = pending [--pending_len];
+  size_t i = 0, child;
+
+  while (( child = 2 * i + 1 ) < pending_len)
+    {
+      if (child + 1 < pending_len && pending [child + 1] -> seq < pending [child] -> seq)
+        child++;
+
+      if (last -> seq <= pending [child] -> seq)
+        break;
+
+      pending [i] = pending [child];
+      i = child;
+    }
+
+  pending [i] = last;
+
+  return top;
+}
+
+/**************************************************************************************************/
+
+/* Note that w is changed by this update */
+
+static int
+touch(watch *w)
+{
+  watch **t;
+
+  if (w -> mark == rule_mark)
+    return 1;
+
+  if ((t = grow_array(touched, &touched_size, touched_len, sizeof(watch *))) == NULL)
+    return 0;
+
+  touched = t;
+  touched [touched_len++] = w;
+  w -> mark = rule_mark;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Queue the rules that read the value of w written at seq (up to the next rule writing w) */
+
+static int
+queue_readers(watch *w, unsigned long seq)
+{
+  size_t next = rules_after(w -> writers, w -> writers_len, seq);
+  unsigned long stop = next < w -> writers_len ? w -> writers [next] -> seq : (unsigned long)-1;
+  size_t i;
+
+  if (!touch(w))
+    return 0;
+
+  for (i = rules_after(w -> readers, w -> readers_len, seq);
+       i < w -> readers_len && w -> readers [i] -> seq <= stop; i++)
+    if (w -> readers [i] -> mark != rule_mark && !push_pending(w -> readers [i]))
+      return 0;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Run the rules queued, and those downstream of them, in order of seq (so
+ * each after any it reads from), giving each the values it reads as they
+ * were written before it.  Then every variable changed is left with the
+ * value of the last rule writing it.  The value of own, the statement's
+ * rule if it is one, is printed when it has run.
+ */
+
+static void
+update_rules(const rule *own)
+{
+  ULONG saved_last = last_result, value;
+  int ok = 1, present;
+  size_t i;
+
+  while (ok && pending_len > 0)
+    {
+      rule *r = pop_pending(), *w;
+
+      for (i = 0; ok && i < r -> reads_len; i++)
+        if ((w = writer_before(r -> reads [i].var, r -> seq)) != NULL)
+          {
+            value = dependency_value(w, r -> reads [i].var, &present);
+            set_watched(r -> reads [i].var, value, present);
+            ok = touch(r -> reads [i].var);
+          }
+
+      if (ok && ( r -> prog == NULL || r -> prog -> hook != external_var_lookup ))
+        {
+          free_program(r -> prog);
+          ok = ( r -> prog = compile_in_mode(r -> text, r -> mode) ) != NULL;
+        }
+
+      if (!ok)
+        break;
+
+      value = run_program(r -> prog);
+      record_writes(r);
+
+      if (r == own)
+        {
+          saved_last = last_result;
+
+          if (!unset_mode)
+            print_result(value);
+        }
+
+      for (i = 0; ok && i < r -> writes_len; i++)
+        ok = queue_readers(r -> writes [i].var, r -> seq);
+    }
+
+  if (!ok)
+    {
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+      pending_len = 0;
+    }
+
+  for (i = 0; i < touched_len; i++)
+    {
+      watch *w = touched [i];
+
+      if (w -> writers_len > 0)
+        {
+          value = dependency_value(w -> writers [w -> writers_len - 1], w, &present);
+          set_watched(w, value, present);
+        }
+    }
+
+  touched_len = 0;
+  last_result = saved_last; /* '.' is still the statement's */
+}
+
+/**************************************************************************************************/
+
+/*
+ * A statement that isn't a rule changed these variables: each new value
+ * takes the place of what the last rule writing it wrote.
+ */
+
+static void
+react_to_writes(const dependency *writes, size_t len)
+{
+  size_t i;
+  int ok = 1;
+
+  rule_mark++;
+
+  for (i = 0; ok && i < len; i++)
+    {
+      watch *w = writes [i].var;
+      rule *last = w -> writers_len > 0 ? w -> writers [w -> writers_len - 1] : NULL;
+
+      if (last != NULL)
+        record_writes(last);
+
+      ok = queue_readers(w, last != NULL ? last -> seq : 0);
+    }
+
+  if (!ok)
+    pending_len = 0;
+
+  update_rules(NULL);
+}
+
+/**************************************************************************************************/
+
+/* After a block has run in reactive mode */
+
+static void
+react_to_program(const program *prog)
+{
+  dependency *writes;
+  size_t len;
+
+  if ((writes = program_uses(prog, USE_WRITE, &len)) != NULL)
+    react_to_writes(writes, len);
+  else if (len != 0)
+    (void)fprintf(stderr, "ERROR: out of memory\n");
+
+  FREE(writes);
+}
+
+/**************************************************************************************************/
+
+/*
+ * Make prog, compiled from 'name = expression', a rule: after all the
+ * others, or (to replace) in place of the last rule for name if there is
+ * one.
+ */
+
+static rule *
+add_rule(program *prog, const token *name, int replace)
+{
+  rule *r, **l, *old = NULL;
+  watch *target;
+  size_t i;
+
+  if ((target = find_watch(name -> text, name -> len)) == NULL
+      || (r = calloc(1, sizeof ( rule ))) == NULL)
+    return NULL;
+
+  r -> reads  = program_uses(prog, USE_READ, &r -> reads_len);
+  r -> writes = program_uses(prog, USE_WRITE, &r -> writes_len);
+  l           = NULL;
+
+  if (r -> reads_len != (size_t)-1 && r -> writes_len != (size_t)-1
+      && (r -> text = malloc(strlen(prog -> source) + 1)) != NULL
+      && (l = grow_array(rules, &rules_size, rules_len, sizeof(rule *))) != NULL)
+    {
+      rules = l;
+
+      for (i = 0; l != NULL && i < r -> reads_len; i++) /* Make room first */
+        if ((l = grow_array(r -> reads [i].var -> readers, &r -> reads [i].var -> readers_size,
+                            r -> reads [i].var -> readers_len, sizeof(rule *))) != NULL)
+          r -> reads [i].var -> readers = l;
+
+      for (i = 0; l != NULL && i < r -> writes_len; i++)
+        if ((l = grow_array(r -> writes [i].var -> writers, &r -> writes [i].var -> writers_size,
+                            r -> writes [i].var -> writers_len, sizeof(rule *))) != NULL)
+          r -> writes [i].var -> writers = l;
+    }
+
+  if (l == NULL)
+    {
+      FREE(r -> reads);
+      FREE(r -> writes);
+      FREE(r -> text);
+      FREE(r);
+
+      return NULL;
+    }
+
+  if (replace && target -> writers_len > 0
+      && target -> writers [target -> writers_len - 1] -> target == target)
+    old = target -> writers [target -> writers_len - 1];
+
+  (void)strcpy(r -> text, prog -> source);
+  r -> mode   = prog -> mode;
+  r -> prog   = prog;
+  r -> target = target;
+  r -> seq    = old != NULL ? old -> seq : ++rule_seq;
+
+  if (old != NULL)
+    free_rule(old);
+
+  r -> index = rules_len;
+  rules [rules_len++] = r;
+
+  for (i = 0; i < r -> reads_len; i++)
+    insert_rule(r -> reads [i].var -> readers, &r -> reads [i].var -> readers_len, r);
+
+  for (i = 0; i < r -> writes_len; i++)
+    insert_rule(r -> writes [i].var -> writers, &r -> writes [i].var -> writers_len, r);
+
+  return r;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Run a statement in reactive mode.  An assignment becomes a rule, and is
+ * run in its place (so what it reads may not be the latest values, if a
+ * variable is assigned more than once): in a file read by 'take' it goes
+ * after the rules so far, but otherwise it replaces the last rule for the
+ * same variable.  Anything else is run as usual, and changes the
+ * variables it writes.
+ */
+
+static void
+react_to_statement(char *text)
+{
+  program *prog = compile_in_mode(text, arithmetic_mode);
+  ULONG value;
+  size_t i;
+  rule *r;
+
+  if (prog == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+
+      return;
+    }
+
+  for (i = 0; i < prog -> code_len; i++) /* No rules from statements with mistakes */
+    if (prog -> code [i].op == OP_DIAG)
+      break;
+
+  if (i == prog -> code_len && !prog -> unset_mode && tokens [0].kind == TOK_IDENT
+      && tokens [1].kind == TOK_EQUAL && !followed_by(&tokens [1], TOK_EQUAL))
+    {
+      if ((r = add_rule(prog, &tokens [0], take_nesting == 0)) == NULL)
+        {
+          free_program(prog);
+          (void)fprintf(stderr, "ERROR: out of memory\n");
+        }
+      else
+        {
+          rule_mark++;
+
+          if (push_pending(r))
+            update_rules(r);
+        }
+
+      return;
+    }
+
+  value = parse_expression(text);
+
+  if (!unset_mode)
+    print_result(value);
+
+  react_to_program(prog);
+  free_program(prog);
+}
+
+/**************************************************************************************************/
+
+/* Whether the operand on top for instruction i is a constant it can't warn about */
+
+static int
+safe_operand(const program *prog, size_t i)
+{
+  const instruction *ip = &prog -> code [i];
+  ULONG val;
+  size_t j;
+
+  if (i == 0 || ( ip [-1].op != OP_PUSH && ip [-1].op != OP_CONST ))
+    return 0;
+
+  for (j = 0; j < prog -> code_len; j++) /* Not if anything else could come before it */
+    if (( prog -> code [j].op == OP_JUMP || prog -> code [j].op == OP_JUMP_FALSE )
+        && prog -> code [j].arg == i)
+      return 0;
+
+  val = ip [-1].arg;
+
+  if (ip -> op == OP_SHL || ip -> op == OP_SHR
+      || ( ip -> op == OP_ASSIGN_OP
+           && ( ip -> aux == TOK_LESS_THAN || ip -> aux == TOK_GREATER_THAN ) ))
+    return val < sizeof(ULONG) * CHAR_BIT;
+
+  return val != 0;
+}
+
+/**************************************************************************************************/
+
+/* Whether instruction i of prog can't print anything (as long as the variables it uses are there) */
+
+static int
+quiet_instruction(const program *prog, size_t i)
+{
+  const instruction *ip = &prog -> code [i];
+
+  switch (ip -> op)
+    {
+      case OP_SHL:
+      case OP_SHR:
+      case OP_DIV:
+      case OP_SDIV:
+      case OP_MOD:
+      case OP_SMOD:
+        return safe_operand(prog, i);
+
+      case OP_ASSIGN_OP:
+        if (ip -> aux == TOK_DIVISION || ip -> aux == TOK_MODULO
+            || ip -> aux == TOK_LESS_THAN || ip -> aux == TOK_GREATER_THAN)
+          return safe_operand(prog, i);
+
+        return 1;
+
+      case OP_END:
+      case OP_PUSH:
+      case OP_CONST:
+      case OP_LAST:
+      case OP_SET_LAST:
+      case OP_STORE_LAST:
+      case OP_LOAD:
+      case OP_LOAD_INC:
+      case OP_LOAD_DEC:
+      case OP_PRE_INC:
+      case OP_PRE_DEC:
+      case OP_ASSIGN:
+      case OP_NEG:
+      case OP_NOT:
+      case OP_COMPL:
+      case OP_LOGOR:
+      case OP_LOGAND:
+      case OP_OR:
+      case OP_XOR:
+      case OP_AND:
+      case OP_EQ:
+      case OP_NE:
+      case OP_LT:
+      case OP_LE:
+      case OP_GT:
+      case OP_GE:
+      case OP_ULT:
+      case OP_ULE:
+      case OP_UGT:
+      case OP_UGE:
+      case OP_ADD:
+      case OP_SUB:
+      case OP_MUL:
+      case OP_SADD:
+      case OP_SSUB:
+      case OP_SMUL:
+      case OP_MUL_POW2:
+      case OP_DIV_POW2:
+      case OP_MOD_POW2:
+      case OP_JUMP:
+      case OP_JUMP_FALSE:
+      case OP_POP:
+      case OP_ARG:
+        return 1;
+
+      default: /* Messages, commands, unsets, GT shown, and calls (whose bodies could) */
+        return 0;
+    }
+}
+
+/**************************************************************************************************/
+
+#if defined (WITH_THREADS)
+
+/*
+ * With 'parallel' on, a file taken again runs statements that don't depend
+ * on each other at the same time, on a pool of threads.  The first take
+ * runs in order, and as it's kept, plan_waves() goes through the statements
+ * as they were compiled: a statement depends on an earlier one if either
+ * writes a variable the other reads or writes, and its wave is one past
+ * the latest of those.  Only an expression that can't print anything but
+ * its result gets a wave; anything else (reading '.' or a builtin such as
+ * 'rand' or 'time', storing to GT, calling a function, a control statement
+ * or a command) has none, and waits for everything before it.
+ *
+ * Taken again, each run of steps with waves is run a wave at a time, each
+ * wave split into a batch for each thread (the main one too), so there's
+ * one hand-off per wave rather than per statement.  One whose variables
+ * don't all exist yet, or that has to be compiled again, is run as usual.
+ * Lines are echoed, and results printed, in order once the run is done.
+ * A wave of fewer than PARALLEL_BATCH statements a thread is just run on
+ * the main one.
+ */
+
+#define PARALLEL_THREADS 16  /* At most */
+#define PARALLEL_BATCH   256 /* Statements, at least, for each thread given some */
+#define PARALLEL_NAMES   256 /* Variables planned for at once, before a step waits for all */
+
+typedef struct wave_name
+{
+  const char   *name;
+  size_t        len;
+  unsigned long read, written; /* The latest waves to       */
+  int           use;           /* By the step being planned */
+} wave_name;
+
+typedef struct wave_result
+{
+  ULONG value, last; /* Its result, and '.' after it */
+  int   failed, err;
+} wave_result;
+
+static int             workers      = 0;    /* Or -1 if none could be started */
+static pthread_mutex_t wave_lock    = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  wave_posted  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  wave_done    = PTHREAD_COND_INITIALIZER;
+static step           *wave_steps   = NULL; /* Of the run, each with a result */
+static wave_result    *wave_results = NULL;
+static const size_t   *wave_order   = NULL; /* The wave's steps, by place in the run */
+static size_t          wave_len     = 0;
+static size_t          wave_batches = 0;
+static size_t          wave_next    = 0;    /* Batch to hand out  */
+static size_t          wave_left    = 0;    /* Batches not done   */
+
+/**************************************************************************************************/
+
+/* Run batch b (of batches) of a wave's len steps, order giving their place in the run */
+
+static void
+run_batch(const size_t *order, size_t len, size_t batches, size_t b)
+{
+  wave_result *r;
+  size_t i;
+
+  for (i = len * b / batches; i < len * ( b + 1 ) / batches; i++)
+    {
+      r = &wave_results [order [i]];
+
+      call_failed = 0;
+      r -> value  = execute(wave_steps [order [i]].prog, 0, 0);
+      r -> failed = call_failed;
+      r -> err    = errno;
+      r -> last   = last_result;
+    }
+}
+
+/**************************************************************************************************/
+
+static void *
+worker_thread(void *unused)
+{
+  const size_t *order;
+  size_t len, batches, b;
+
+  (void)unused;
+  in_worker = 1;
+  (void)pthread_mutex_lock(&wave_lock);
+
+  while (always)
+    {
+      if (wave_next >= wave_batches)
+        {
+          (void)pthread_cond_wait(&wave_posted, &wave_lock);
+          continue;
+        }
+
+      order   = wave_order;
+      len     = wave_len;
+      batches = wave_batches;
+      b       = wave_next++;
+      (void)pthread_mutex_unlock(&wave_lock);
+
+      run_batch(order, len, batches, b);
+
+      (void)pthread_mutex_lock(&wave_lock);
+
+      if (--wave_left == 0)
+        (void)pthread_cond_signal(&wave_done);
+    }
+
+  /*NOTREACHED*/ /* unreachable */
+  return NULL;
+}
+
+/**************************************************************************************************/
+
+/* Start the pool of threads, if it isn't already, returning 0 if there can't be one */
+
+static int
+start_workers(void)
+{
+  pthread_t thread;
+  long n = 4;
+
+  if (workers != 0)
+    return workers > 0;
+
+# if defined (_SC_NPROCESSORS_ONLN)
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+
+  if (n < 1)
+    n = 1;
+  else if (n > PARALLEL_THREADS)
+    n = PARALLEL_THREADS;
+
+  while (workers < n && pthread_create(&thread, NULL, worker_thread, NULL) == 0)
+    {
+      (void)pthread_detach(thread);
+      workers++;
+    }
+
+  if (workers == 0)
+    {
+      (void)fprintf(stderr, "Warning: no threads could be started, running in order.\n");
+      workers = -1;
+    }
+
+  return workers > 0;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Note in names (adding any new ones) the variables prog uses, returning 0
+ * if it can't be given a wave.
+ */
+
+static int
+wave_uses(const program *prog, wave_name *names, size_t *names_len)
+{
+  const instruction *ip;
+  const var_ref *r;
+  size_t i, j;
+  int use, last = 0;
+
+  for (i = 0; i < prog -> code_len; i++)
+    {
+      ip = &prog -> code [i];
+
+      if (ip -> op == OP_SET_LAST || ip -> op == OP_STORE_LAST)
+        last = 1;
+      else if (ip -> op == OP_LAST || !quiet_instruction(prog, i))
+        return 0;
+
+      if ((use = ref_use(ip -> op)) == 0)
+        continue;
+
+      r = &prog -> refs [ip -> arg];
+
+      if (find_builtin(r -> name, r -> len) != NULL
+          || ( ( use & USE_WRITE ) && find_register(r -> name, r -> len) == REG_GT ))
+        return 0;
+
+      for (j = 0; j < *names_len; j++)
+        if (names [j].len == r -> len && memcmp(names [j].name, r -> name, r -> len) == 0)
+          break;
+
+      if (j == *names_len)
+        {
+          if (j == PARALLEL_NAMES)
+            return 0;
+
+          names [j].name    = r -> name;
+          names [j].len     = r -> len;
+          names [j].read    = 0;
+          names [j].written = 0;
+          names [j].use     = 0;
+          ( *names_len )++;
+        }
+
+      names [j].use |= use;
+    }
+
+  return last; /* So '.' after it is known */
+}
+
+/**************************************************************************************************/
+
+/* Give each step of a file just taken its wave (or 0), from its statements as compiled */
+
+static void
+plan_waves(taken_file *f)
+{
+  static wave_name names [PARALLEL_NAMES];
+  size_t names_len = 0;
+  unsigned long wave;
+  size_t i, j;
+  step *st;
+
+  for (i = 0; i < f -> steps_len; i++)
+    {
+      st = &f -> steps [i];
+      st -> wave = 0;
+
+      if (st -> kind == STEP_ECHO)
+        continue;
+
+      if (st -> kind != STEP_EXPRESSION || st -> prog == NULL
+          || !wave_uses(st -> prog, names, &names_len))
+        {
+          names_len = 0; /* It waits for all before, and all after wait for it */
+          continue;
+        }
+
+      for (j = 0, wave = 1; j < names_len; j++)
+        {
+          if (names [j].use != 0 && names [j].written >= wave)
+            wave = names [j].written + 1;
+
+          if (( names [j].use & USE_WRITE ) && names [j].read >= wave)
+            wave = names [j].read + 1;
+        }
+
+      for (j = 0; j < names_len; j++)
+        {
+          if (names [j].use & USE_WRITE)
+            names [j].written = wave;
+
+          if (( names [j].use & USE_READ ) && names [j].read < wave)
+            names [j].read = wave;
+
+          names [j].use = 0;
+        }
+
+      st -> wave = wave;
+    }
+}
+
+/**************************************************************************************************/
+
+/* Whether st can be run in a wave, with the steps about it */
+
+static int
+wave_ready(step *st)
+{
+  size_t i;
+
+  if (st -> kind == STEP_ECHO)
+    return 1;
+
+  if (st -> wave == 0 || !parallel || reactive || stale_step(st))
+    return 0;
+
+  for (i = 0; i < st -> prog -> refs_len; i++) /* Not to be created, or looked up, on a thread */
+    if (ref_var(&st -> prog -> refs [i]) == NULL)
+      return 0;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Grow a scratch array to hold len elements, returning NULL (leaving it be) if out of memory */
+
+static void *
+wave_scratch(void *array, size_t *size, size_t len, size_t elem_size)
+{
+  void *new_array;
+
+  if (len <= *size)
+    return array;
+
+  if ((new_array = realloc(array, len * elem_size)) != NULL)
+    *size = len;
+
+  return new_array;
+}
+
+/**************************************************************************************************/
+
+/* Run a wave's len steps, sharing them out if there are enough */
+
+static void
+run_wave(const size_t *order, size_t len)
+{
+  size_t batches = len / PARALLEL_BATCH;
+  size_t b;
+
+  if (batches > (size_t)workers + 1)
+    batches = (size_t)workers + 1;
+
+  if (batches < 2)
+    {
+      run_batch(order, len, 1, 0);
+
+      return;
+    }
+
+  (void)pthread_mutex_lock(&wave_lock);
+  wave_order   = order;
+  wave_len     = len;
+  wave_batches = batches;
+  wave_left    = batches;
+  wave_next    = 0;
+  (void)pthread_cond_broadcast(&wave_posted);
+  in_worker = 1;
+
+  while (wave_next < wave_batches)
+    {
+      b = wave_next++;
+      (void)pthread_mutex_unlock(&wave_lock);
+
+      run_batch(order, len, batches, b);
+
+      (void)pthread_mutex_lock(&wave_lock);
+      wave_left--;
+    }
+
+  in_worker = 0;
+
+  while (wave_left > 0)
+    (void)pthread_cond_wait(&wave_done, &wave_lock);
+
+  (void)pthread_mutex_unlock(&wave_lock);
+}
+
+/**************************************************************************************************/
+
+/*
+ * Run n steps that are all wave_ready(), a wave at a time, then echo their
+ * lines and print their results in order, as replay_step() would.  Returns
+ * 0 (having run none) if out of memory.
+ */
+
+static int
+run_waves(step *steps, size_t n, const char *filename)
+{
+  static size_t results_size = 0, order_size = 0, starts_size = 0;
+  static size_t *order = NULL, *starts = NULL;
+  unsigned long low = ULONG_MAX, high = 0;
+  size_t i, w, m = 0;
+  wave_result *r;
+  void *p;
+
+  for (i = 0; i < n; i++)
+    if (steps [i].kind != STEP_ECHO)
+      {
+        m++;
+
+        if (steps [i].wave < low)
+          low = steps [i].wave;
+
+        if (steps [i].wave > high)
+          high = steps [i].wave;
+      }
+
+  if (m == 0)
+    {
+      for (i = 0; i < n; i++)
+        replay_step(&steps [i], filename);
+
+      return 1;
+    }
+
+  if ((p = wave_scratch(wave_results, &results_size, n, sizeof(wave_result))) == NULL)
+    return 0;
+
+  wave_results = p;
+
+  if ((p = wave_scratch(order, &order_size, m, sizeof(size_t))) == NULL)
+    return 0;
+
+  order = p;
+
+  if ((p = wave_scratch(starts, &starts_size, high - low + 2, sizeof(size_t))) == NULL)
+    return 0;
+
+  starts = p;
+
+  /* Sort the statements by wave, keeping them in order within each */
+
+  (void)memset(starts, 0, ( high - low + 2 ) * sizeof(size_t));
+
+  for (i = 0; i < n; i++)
+    if (steps [i].kind != STEP_ECHO)
+      {
+        (void)ready_expression_step(&steps [i]); /* A hit, as it isn't stale */
+        starts [steps [i].wave - low + 1]++;
+      }
+
+  for (w = 1; w <= high - low; w++)
+    starts [w] += starts [w - 1];
+
+  for (i = 0; i < n; i++)
+    if (steps [i].kind != STEP_ECHO)
+      order [starts [steps [i].wave - low]++] = i; /* Leaving where the next wave starts */
+
+  wave_steps = steps;
+
+  for (w = 0, i = 0; w <= high - low; i = starts [w++])
+    if (starts [w] > i)
+      run_wave(order + i, starts [w] - i);
+
+  for (i = 0; i < n; i++)
+    {
+      if (steps [i].kind == STEP_ECHO)
+        {
+          replay_step(&steps [i], filename);
+          continue;
+        }
+
+      r     = &wave_results [i];
+      errno = r -> err;
+
+      if (r -> failed) /* As run_program() */
+        {
+          unset_mode = 1;
+          continue;
+        }
+
+      unset_mode  = steps [i].prog -> unset_mode;
+      last_result = r -> last;
+
+      if (!unset_mode)
+        print_result(r -> value);
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static void
+replay_parallel(taken_file *f, const char *filename)
+{
+  size_t i, j;
+
+  for (i = 0; i < f -> steps_len; i = j)
+    {
+      for (j = i; j < f -> steps_len && wave_ready(&f -> steps [j]); j++)
+        ;
+
+      if (j == i)
+        replay_step(&f -> steps [j++], filename);
+      else if (!run_waves(f -> steps + i, j - i, filename))
+        for (; i < j; i++)
+          replay_step(&f -> steps [i], filename);
+    }
+}
+
+#endif /* defined (WITH_THREADS) */
+
+/**************************************************************************************************/
+
+/*
+ * The next name in a list separated by commas (as given to --specialize
+ * and --results) from *p, setting *len and moving *p past it, or NULL at
+ * the end of the list.
+ */
+
+static const char *
+next_name(char **p, size_t *len)
+{
+  char *name, *q;
+
+  do
+    {
+      name = skipwhite(*p);
+
+      for (q = name; *q != '\0' && *q != ','; q++)
+        ;
+
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      for (*len = (size_t)(q - name); *len > 0 && isspace((unsigned char)name [*len - 1]); ( *len )--)
+        ;
+
+      *p = *q != '\0' ? q + 1 : q;
+    }
+  while (*len == 0 && *q != '\0');
+
+  return *len > 0 ? name : NULL;
+}
+
+/**************************************************************************************************/
+
+/*
+ * pc --specialize inputs file partially evaluates a file, as it would be
+ * taken, for everything but its inputs: a list of names, separated by
+ * commas, of variables or builtins whose values are only known when it is
+ * run.  It prints a reduced file that gives the same results.
+ *
+ * A statement that only reads known values, and can't print anything but
+ * its result, is run now: it becomes the assignment of its value (or just
+ * its value), and a control statement becomes the assignments it made.
+ * In any other statement, each known variable only read is replaced by its
+ * value, so that it's folded when compiled.  What a statement that isn't
+ * run writes is unknown from then on, as is everything after a function is
+ * called or a file taken (as either could change anything), and nothing
+ * after 'reactive' is changed.  Builtins that change as pc runs, such as
+ * 'rand' and 'time', are never known.
+ */
+
+typedef struct spec_name
+{
+  char  *name;
+  size_t len;
+  int    unknown;
+} spec_name;
+
+static spec_name *spec_names      = NULL;
+static size_t     spec_names_len  = 0;
+static size_t     spec_names_size = 0;
+static int        spec_forget     = 0; /* Names not listed are unknown */
+static int        spec_last       = 1; /* Whether '.' is known         */
+static int        spec_line       = 0; /* A line is started            */
+
+/**************************************************************************************************/
+
+/* Note whether a name's value is known, returning 0 if out of memory */
+
+static int
+spec_mark(const char *name, size_t len, int unknown)
+{
+  spec_name *s;
+  size_t i;
+
+  for (i = 0; i < spec_names_len; i++)
+    if (spec_names [i].len == len && memcmp(spec_names [i].name, name, len) == 0)
+      {
+        spec_names [i].unknown = unknown;
+
+        return 1;
+      }
+
+  if ((s = grow_array(spec_names, &spec_names_size, spec_names_len, sizeof(spec_name))) == NULL)
+    return 0;
+
+  spec_names = s;
+  s          = &spec_names [spec_names_len];
+
+  if ((s -> name = malloc(len + 1)) == NULL)
+    return 0;
+
+  (void)memcpy(s -> name, name, len);
+  s -> name [len] = '\0';
+  s -> len        = len;
+  s -> unknown    = unknown;
+  spec_names_len++;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Whether a variable, register or builtin has a known value, setting *val to it */
+
+static int
+spec_value(const char *name, size_t len, ULONG *val)
+{
+  static const char *const changing [] =
+    {
+      "cache_hits", "cache_misses", "errno", "pid", "rand", "time"
+    };
+  variable *v;
+  size_t i;
+
+  for (i = 0; i < spec_names_len; i++)
+    if (spec_names [i].len == len && memcmp(spec_names [i].name, name, len) == 0)
+      break;
+
+  if (i < spec_names_len ? spec_names [i].unknown : spec_forget)
+    return 0;
+
+  if ((v = lookup_var(name, len)) != NULL)
+    {
+      *val = v -> value;
+
+      return 1;
+    }
+
+  for (i = 0; i < sizeof ( changing ) / sizeof ( changing [0] ); i++)
+    if (strlen(changing [i]) == len && memcmp(name, changing [i], len) == 0)
+      return 0;
+
+  return external_var_lookup != NULL && external_var_lookup(name, len, val) != 0;
+}
+
+/**************************************************************************************************/
+
+/* Add a statement to the reduced file, on the line of those before */
+
+static void
+spec_print(const char *text)
+{
+  size_t len = strlen(text);
+
+  while (len > 0 && isspace((unsigned char)text [len - 1]))
+    len--;
+
+  (void)fprintf(stdout, "%s%.*s", spec_line ? "; " : "", (int)len, text);
+  spec_line = 1;
+}
+
+/**************************************************************************************************/
+
+static void
+spec_print_ulong(ULONG value)
+{
+#if defined (USE_LONG_LONG)
+  (void)fprintf(stdout, "%llu", value);
+#else
+  (void)fprintf(stdout, "%lu", value);
+#endif
+}
+
+/**************************************************************************************************/
+
+/*
+ * The text of a statement compiled as prog, with each known variable that
+ * it only reads (and '.', if known and dots is set) replaced by its value.
+ * A '.' after a group isn't replaced, as the group sets it.  Returns NULL
+ * if out of memory.
+ */
+
+static char *
+spec_substitute(const char *text, const program *prog, const unsigned char *uses, int dots)
+{
+  char *copy, *out;
+  const char *from;
+  size_t i, len;
+  long n, k;
+  ULONG val;
+
+  if ((copy = strdup(text)) == NULL || (n = tokenize(copy)) < 0
+      || (out = malloc(strlen(text) + (size_t)n * sizeof ( ULONG ) * 3 + 1)) == NULL)
+    {
+      FREE(copy);
+
+      return NULL;
+    }
+
+  from = copy;
+  len  = 0;
+
+  for (k = 0; k < n; k++)
+    {
+      const token *t = &tokens [k];
+
+      if (t -> kind == TOK_LPAREN || t -> kind == TOK_LBRACE || t -> kind == TOK_LBRACKET)
+        dots = 0;
+
+      if (t -> kind == TOK_DOT && dots && spec_last)
+        val = last_result;
+      else if (t -> kind != TOK_IDENT || followed_by(t, TOK_LPAREN))
+        continue;
+      else
+        {
+          for (i = 0; i < prog -> refs_len; i++)
+            if (prog -> refs [i].len == t -> len
+                && memcmp(prog -> refs [i].name, t -> text, t -> len) == 0)
+              break;
+
+          if (i == prog -> refs_len || uses [i] != USE_READ
+              || !spec_value(t -> text, t -> len, &val))
+            continue;
+        }
+
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      (void)memcpy(out + len, from, (size_t)(t -> text - from));
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      len += (size_t)(t -> text - from);
+#if defined (USE_LONG_LONG)
+      len += (size_t)snprintf(out + len, sizeof ( ULONG ) * 3 + 1, "%llu", val);
+#else
+      len += (size_t)snprintf(out + len, sizeof ( ULONG ) * 3 + 1, "%lu", val);
+#endif
+      from = t -> text + t -> len;
+    }
+
+  (void)strcpy(out + len, from);
+  FREE(copy);
+
+  return out;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Whether a statement compiled as prog can be run now: it reads only known
+ * values, and can't print anything but its result.  A '.' after a group
+ * has set it is taken as unknown.
+ */
+
+static int
+spec_runnable(const program *prog, const unsigned char *uses)
+{
+  const var_ref *r;
+  ULONG val;
+  size_t i;
+  int last = spec_last;
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_SET_LAST || prog -> code [i].op == OP_STORE_LAST)
+      last = 0;
+    else if (!quiet_instruction(prog, i) || ( prog -> code [i].op == OP_LAST && !last ))
+      return 0;
+
+  for (i = 0; i < prog -> refs_len; i++)
+    {
+      r = &prog -> refs [i];
+
+      if (( uses [i] & USE_READ ) && !spec_value(r -> name, r -> len, &val))
+        return 0;
+
+      if (( uses [i] & USE_WRITE ) && lookup_var(r -> name, r -> len) == NULL
+          && ( find_builtin(r -> name, r -> len) != NULL || is_reserved_name(r -> name, r -> len) ))
+        return 0; /* Can't be assigned, and says so */
+
+      if (( uses [i] & USE_WRITE ) && find_register(r -> name, r -> len) == REG_GT)
+        return 0;
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* Each of prog's variables, as USE_READ and USE_WRITE (or NULL if out of memory) */
+
+static unsigned char *
+spec_uses(const program *prog)
+{
+  unsigned char *uses = calloc(prog -> refs_len + 1, 1);
+  size_t i;
+
+  if (uses != NULL)
+    for (i = 0; i < prog -> code_len; i++)
+      if (ref_use(prog -> code [i].op) != 0)
+        uses [prog -> code [i].arg] |= (unsigned char)ref_use(prog -> code [i].op);
+
+  return uses;
+}
+
+/**************************************************************************************************/
+/* After a statement that isn't run, what it writes is unknown, returning 0 if out of memory */
+
+static int
+spec_unknown(const program *prog, const unsigned char *uses)
+{
+  size_t i;
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_CALL)
+      spec_forget = 1;
+
+  for (i = 0; i < spec_names_len; i++)
+    if (spec_forget)
+      spec_names [i].unknown = 1;
+
+  for (i = 0; i < prog -> refs_len; i++)
+    if (( uses [i] & USE_WRITE ) && !spec_mark(prog -> refs [i].name, prog -> refs [i].len, 1))
+      return 0;
+
+  spec_last = 0;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/* What a statement that was run writes is known, returning 0 if out of memory */
+
+static int
+spec_known(const program *prog, const unsigned char *uses)
+{
+  size_t i;
+
+  for (i = 0; i < prog -> refs_len; i++)
+    if (( uses [i] & USE_WRITE ) && !spec_mark(prog -> refs [i].name, prog -> refs [i].len, 0))
+      return 0;
+
+  spec_last = 1;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static int
+spec_expression(const step *st)
+{
+  unsigned char *uses;
+  const var_ref *w = NULL;
+  variable *v;
+  program *prog;
+  char *text;
+  size_t i, writes = 0;
+  ULONG value;
+  int ok;
+
+  if ((uses = spec_uses(st -> prog)) == NULL)
+    return 0;
+
+  for (i = 0; i < st -> prog -> code_len; i++) /* Leave mistakes to be reported */
+    if (st -> prog -> code [i].op == OP_DIAG)
+      {
+        spec_print(st -> text);
+        ok = spec_unknown(st -> prog, uses);
+        FREE(uses);
+
+        return ok;
+      }
+
+  text = spec_substitute(st -> text, st -> prog, uses, 1);
+  FREE(uses);
+
+  if (text == NULL || ( prog = compile_in_mode(text, st -> prog -> mode) ) == NULL)
+    {
+      FREE(text);
+
+      return 0;
+    }
+
+  if ((uses = spec_uses(prog)) == NULL)
+    ok = 0;
+  else if (spec_runnable(prog, uses))
+    {
+      value = run_program(prog);
+
+      for (i = 0; i < prog -> refs_len; i++)
+        if (uses [i] & USE_WRITE)
+          {
+            w = &prog -> refs [i];
+            writes++;
+          }
+
+      if (writes == 0)
+        {
+          (void)fprintf(stdout, "%s", spec_line ? "; " : "");
+          spec_print_ulong(value);
+          spec_line = 1;
+        }
+      else if (writes == 1 && ( v = lookup_var(w -> name, w -> len) ) != NULL && v -> value == value)
+        {
+          (void)fprintf(stdout, "%s%.*s = ", spec_line ? "; " : "", (int)w -> len, w -> name);
+          spec_print_ulong(value);
+          spec_line = 1;
+        }
+      else
+        spec_print(text);
+
+      ok = spec_known(prog, uses);
+    }
+  else
+    {
+      spec_print(text);
+      ok = spec_unknown(prog, uses);
+    }
+
+  FREE(uses);
+  FREE(text);
+  free_program(prog);
+
+  return ok;
+}
+
+/**************************************************************************************************/
+
+static int
+spec_block(const step *st)
+{
+  const program *prog = st -> prog;
+  program *held;
+  unsigned char *uses;
+  const var_ref *r;
+  variable *v;
+  char *text, *source;
+  size_t i, used, writes = 0;
+  int ok = 1, last = 0;
+  ULONG value = 0;
+
+  if ((uses = spec_uses(prog)) == NULL)
+    return 0;
+
+  if (!spec_runnable(prog, uses))
+    {
+      if (compile_block(st -> text, &held, &used) == BLOCK_ERROR) /* Where the block ends */
+        used = strlen(st -> text);
+
+      free_program(held);
+
+      if ((source = malloc(used + 1)) != NULL)
+        {
+          (void)memcpy(source, st -> text, used);
+          source [used] = '\0';
+        }
+
+      if (source == NULL || ( text = spec_substitute(source, prog, uses, 0) ) == NULL)
+        ok = 0;
+      else
+        {
+          spec_print(text);
+          ok = spec_unknown(prog, uses);
+          FREE(text);
+        }
+
+      FREE(source);
+
+      FREE(uses);
+
+      return ok;
+    }
+
+  (void)run_program(st -> prog);
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_SET_LAST || prog -> code [i].op == OP_STORE_LAST)
+      last = 1;
+
+  for (i = 0; ok && i < prog -> refs_len; i++) /* It becomes the assignments it made */
+    if (uses [i] & USE_WRITE)
+      {
+        r = &prog -> refs [i];
+
+        if ((v = lookup_var(r -> name, r -> len)) == NULL) /* Couldn't be added */
+          ok = 0;
+        else
+          {
+            value = v -> value;
+            (void)fprintf(stdout, "%s%s%.*s = ", spec_line ? "; " : "",
+                          writes++ ? "" : "if (1) { ", (int)r -> len, r -> name);
+            spec_print_ulong(value);
+            spec_line = 1;
+          }
+      }
+
+  if (last && ( writes == 0 || value != last_result )) /* Then '.', as a condition would */
+    {
+      (void)fprintf(stdout, "%sif (", spec_line ? "; " : "");
+      spec_print_ulong(last_result);
+      (void)fprintf(stdout, ") { }");
+      spec_line = 1;
+    }
+
+  if (writes != 0)
+    (void)fprintf(stdout, " }");
+
+  ok = ok && spec_known(prog, uses);
+  FREE(uses);
+
+  return ok;
+}
+
+/**************************************************************************************************/
+
+static int
+specialize(char *inputs, const char *filename)
+{
+  const char *name;
+  char *p, *text;
+  taken_file *f;
+  size_t i, len;
+  int ok, frozen = 0;
+
+  if ((f = record_file(filename, "--specialize")) == NULL)
+    return 0;
+
+  if (f -> broken)
+    {
+      (void)fprintf(stderr, "ERROR: '--specialize': '%s' can't be specialized.\n", filename);
+      free_taken(f);
+
+      return 0;
+    }
+
+  for (ok = 1, p = inputs; ok && ( name = next_name(&p, &len) ) != NULL;)
+    ok = spec_mark(name, len, 1);
+
+  (void)fprintf(stdout, "# Specialized from '%s' by pc --specialize '%s'\n", filename, inputs);
+
+  for (i = 0; ok && i < f -> steps_len; i++)
+    {
+      const step *st = &f -> steps [i];
+
+      text = st -> text;
+
+      if (st -> kind == STEP_ECHO)
+        {
+          if (spec_line)
+            (void)fputc('\n', stdout);
+
+          spec_line = 0;
+          text      = skipwhite(text);
+
+          if (*text == '#' || *text == '\0' || *text == '\n' || *text == '\r')
+            (void)fprintf(stdout, "%s%s", text, strchr(text, '\n') ? "" : "\n");
+        }
+      else if (frozen) /* Rules are kept as written */
+        spec_print(text);
+      else if (st -> kind == STEP_STATEMENT)
+        {
+          spec_print(text);
+
+          if (NAME_IS(text, strlen(text), "reactive"))
+            frozen = 1;
+          else if (is_word(text, text + strlen(text), "take"))
+            {
+              spec_forget = 1;
+
+              for (len = 0; len < spec_names_len; len++)
+                spec_names [len].unknown = 1;
+
+              spec_last = 0;
+            }
+        }
+      else if (st -> kind == STEP_EXPRESSION)
+        ok = spec_expression(st);
+      else
+        ok = spec_block(st);
+    }
+
+  if (spec_line)
+    (void)fputc('\n', stdout);
+
+  if (!ok)
+    (void)fprintf(stderr, "ERROR: out of memory\n");
+
+  free_taken(f);
+
+  return ok;
+}
+
+/**************************************************************************************************/
+
+/*
+ * pc --results names file takes a file quietly, then prints the variables
+ * named (separated by commas, and '.' for the last result), as 'vars' would.  Only what their values
+ * depend on is run: going back from the end of the file, a statement is
+ * needed if it writes a variable (or '.') that's still needed, and then
+ * what it reads is needed before it.  A statement that writes a variable
+ * for sure (it has no branches, and can't fail) means that variable isn't
+ * needed before it.
+ *
+ * Statements that read 'rand' (so that later values are the same), store
+ * to a register, or have a mistake to report always run.  So does anything
+ * that could change more than it says, which needs everything before it: a
+ * function call, a 'take', and every statement from 'reactive' on.  Nothing
+ * is printed but the variables, and errors and warnings, so those that a
+ * statement left out would have given aren't.
+ */
+
+typedef struct slice_name
+{
+  const char *name;
+  size_t      len;
+} slice_name;
+
+static slice_name *slice_names      = NULL;
+static size_t      slice_names_len  = 0;
+static size_t      slice_names_size = 0;
+static int         slice_all        = 0; /* Every variable is needed */
+static int         slice_last       = 0; /* '.' is needed            */
+
+/**************************************************************************************************/
+
+static int
+slice_needs(const char *name, size_t len)
+{
+  size_t i;
+
+  if (slice_all)
+    return 1;
+
+  for (i = 0; i < slice_names_len; i++)
+    if (slice_names [i].len == len && memcmp(slice_names [i].name, name, len) == 0)
+      return 1;
+
+  return 0;
+}
+
+/**************************************************************************************************/
+
+/* Note that a variable is needed (name must last as long as the slice), returning 0 if out of memory */
+
+static int
+slice_need(const char *name, size_t len)
+{
+  slice_name *s;
+
+  if (slice_needs(name, len))
+    return 1;
+
+  if ((s = grow_array(slice_names, &slice_names_size, slice_names_len, sizeof(slice_name))) == NULL)
+    return 0;
+
+  slice_names = s;
+  slice_names [slice_names_len].name = name;
+  slice_names [slice_names_len].len  = len;
+  slice_names_len++;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static void
+slice_drop(const char *name, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < slice_names_len; i++)
+    if (slice_names [i].len == len && memcmp(slice_names [i].name, name, len) == 0)
+      {
+        slice_names [i] = slice_names [--slice_names_len];
+
+        return;
+      }
+}
+
+/**************************************************************************************************/
+
+/* Whether a statement compiled as prog must run, given what's needed after it */
+
+static int
+slice_needed(const program *prog)
+{
+  const var_ref *r;
+  size_t i;
+  int use;
+
+  for (i = 0; i < prog -> code_len; i++)
+    switch (prog -> code [i].op)
+      {
+        case OP_CALL:
+        case OP_DIAG:
+        case OP_WARN_CONVERT:
+        case OP_WARN_CHAR:
+          return 1;
+
+        case OP_SET_LAST:
+        case OP_STORE_LAST:
+          if (slice_last)
+            return 1;
+
+          break;
+
+        default:
+          if ((use = ref_use(prog -> code [i].op)) == 0)
+            break;
+
+          r = &prog -> refs [prog -> code [i].arg];
+
+          if (( use & USE_READ ) && NAME_IS(r -> name, r -> len, "rand"))
+            return 1;
+
+          if (( use & USE_WRITE )
+              && ( slice_needs(r -> name, r -> len) || find_register(r -> name, r -> len) != REG_NONE
+                   || find_builtin(r -> name, r -> len) != NULL || is_reserved_name(r -> name, r -> len) ))
+            return 1;
+
+          break;
+      }
+
+  return 0;
+}
+
+/**************************************************************************************************/
+
+/* What's needed before a statement that runs, returning 0 if out of memory */
+
+static int
+slice_before(const program *prog, int expression)
+{
+  const var_ref *r;
+  size_t i;
+  int use, surely = expression;
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_CALL)
+      slice_all = slice_last = 1;
+    else if (prog -> code [i].op == OP_JUMP || prog -> code [i].op == OP_JUMP_FALSE
+             || !quiet_instruction(prog, i))
+      surely = 0;
+
+  if (surely) /* What it writes (and '.') it sets, whatever they were */
+    {
+      for (i = 0; i < prog -> code_len; i++)
+        if (ref_use(prog -> code [i].op) == USE_WRITE)
+          {
+            r = &prog -> refs [prog -> code [i].arg];
+            slice_drop(r -> name, r -> len);
+          }
+
+      slice_last = slice_all;
+    }
+
+  for (i = 0; i < prog -> code_len; i++)
+    if (prog -> code [i].op == OP_LAST)
+      slice_last = 1;
+    else if (( use = ref_use(prog -> code [i].op) ) & USE_READ)
+      {
+        r = &prog -> refs [prog -> code [i].arg];
+
+        if (!slice_need(r -> name, r -> len))
+          return 0;
+      }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Print a variable named by --results, as 'vars' would, or as zero if it
+ * doesn't exist (whether or not reading it in a statement left out would
+ * have added it)
+ */
+
+static void
+print_named(const char *name, size_t len)
+{
+  const variable *v = lookup_var(name, len);
+
+  if (NAME_IS(name, len, "."))
+    {
+      (void)fprintf(stdout, "  .:\n");
+      print_result(last_result);
+    }
+  else if (v != NULL && v -> reg == REG_GT)
+    print_time_reg(v -> name, v -> value);
+  else
+    {
+      (void)fprintf(stdout, "  %.*s:\n", (int)len, name);
+      print_result(v != NULL ? v -> value : 0);
+    }
+}
+
+/**************************************************************************************************/
+
+static int
+run_results(char *names, const char *filename)
+{
+  unsigned char *keep = NULL;
+  const char *name, *text;
+  char *p;
+  taken_file *f;
+  size_t i, len, stop, frozen, defined = function_count;
+  arithmetic_mode_t mode = arithmetic_mode;
+  unsigned long gen = compile_generation;
+  int ok = 1;
+
+  if ((f = record_file(filename, "--results")) == NULL)
+    return 0;
+
+  for (p = names; ok && ( name = next_name(&p, &len) ) != NULL;)
+    if (NAME_IS(name, len, "."))
+      slice_last = 1;
+    else
+      ok = slice_need(name, len);
+
+  for (stop = 0; stop < f -> steps_len; stop++) /* Nothing after 'quit' is run */
+    if (f -> steps [stop].kind == STEP_STATEMENT && strcmp(f -> steps [stop].text, "quit") == 0)
+      break;
+
+  for (frozen = 0; frozen < stop; frozen++)
+    if (f -> steps [frozen].kind == STEP_STATEMENT && strcmp(f -> steps [frozen].text, "reactive") == 0)
+      break;
+
+  if (ok && ( keep = calloc(f -> steps_len + 1, 1) ) == NULL)
+    ok = 0;
+
+  for (i = stop; ok && !f -> broken && i-- > 0;)
+    {
+      const step *st = &f -> steps [i];
+
+      text = st -> text;
+
+      if (st -> kind == STEP_ECHO)
+        continue;
+
+      if (i >= frozen)
+        slice_all = slice_last = keep [i] = 1;
+      else if (st -> kind != STEP_STATEMENT)
+        {
+          if (slice_needed(st -> prog))
+            {
+              keep [i] = 1;
+              ok       = slice_before(st -> prog, st -> kind == STEP_EXPRESSION);
+            }
+        }
+      else if (!NAME_IS(text, strlen(text), "vars") && !NAME_IS(text, strlen(text), "regs")
+               && !NAME_IS(text, strlen(text), "help") && !NAME_IS(text, strlen(text), "mode"))
+        {
+          keep [i] = 1; /* Any command but those that only print */
+
+          if (!is_command(text, strlen(text)) && !is_word(text, text + strlen(text), "def"))
+            slice_all = slice_last = 1; /* A 'take' */
+        }
+    }
+
+  drop_functions(defined); /* Each step is run as it was when noted */
+  arithmetic_mode    = mode;
+  compile_generation = gen;
+  quiet              = 1;
+
+  if (ok && f -> broken) /* Without all its steps, it can only be taken as it is */
+    take_file(filename);
+  else if (ok)
+    for (i = 0; i < stop; i++)
+      if (keep [i])
+        replay_step(&f -> steps [i], filename);
+
+  quiet = 0;
+
+  for (p = names; ok && ( name = next_name(&p, &len) ) != NULL;)
+    print_named(name, len);
+
+  if (!ok)
+    (void)fprintf(stderr, "ERROR: out of memory\n");
+
+  FREE(keep);
+  FREE(slice_names);
+  free_taken(f);
+
+  return ok;
+}
+
+/**************************************************************************************************/
+
+/* Compiling a function body: its arguments are looked up here first */
+
+static const function *defining = NULL;
+
+/**************************************************************************************************/
+
+static int
+find_function(const char *name, size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < function_count; i++)
+    if (functions [i].len == len && memcmp(functions [i].name, name, len) == 0)
+      return (int)i;
+
+  return -1;
+}
+
+/**************************************************************************************************/
+
+/* The argument slot of the function being compiled that t names, or -1 */
+
+static int
+arg_slot(const token *t)
+{
+  int i;
+
+  if (defining == NULL)
+    return -1;
+
+  for (i = 0; i < defining -> nargs; i++)
+    if (defining -> arg_len [i] == t -> len && memcmp(defining -> arg_name [i], t -> text,
+                                                     t -> len) == 0)
+      return i;
+
+  return -1;
+}
+
+/**************************************************************************************************/
+
+/* Compile the body of fn for a mode */
+
+static program *
+compile_function(function *fn, arithmetic_mode_t mode)
+{
+  free_program(fn -> prog [mode]);
+
+  defining          = fn;
+  fn -> prog [mode] = compile_in_mode(fn -> body, mode);
+  defining          = NULL;
+
+  return fn -> prog [mode];
+}
+
+/**************************************************************************************************/
+
+/* Call fn with its arguments at vm_stack [args], in the mode of the caller */
+
+static ULONG
+call_function(function *fn, arithmetic_mode_t mode, size_t args)
+{
+  program *prog = fn -> prog [mode];
+  memo *m = NULL;
+  ULONG val;
+
+  if (call_depth >= MAX_CALL_DEPTH)
+    {
+      (void)fprintf(stderr, "ERROR: '%.*s': function calls nested too deeply.\n",
+                    (int)fn -> len, fn -> name);
+      call_failed = 1;
+
+      return 0;
+    }
+
+  if (fn -> memo != NULL)
+    {
+      m = &fn -> memo [hash32s(&vm_stack [args], (size_t)fn -> nargs * sizeof(ULONG),
+                               (uint32_t)mode) & (MEMO_SIZE - 1)];
+
+      if (m -> used && m -> mode == mode
+          && memcmp(m -> args, &vm_stack [args], (size_t)fn -> nargs * sizeof(ULONG)) == 0)
+        return m -> result;
+    }
+
+  if (( prog == NULL || prog -> hook != external_var_lookup )
+      && (prog = compile_function(fn, mode)) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+      call_failed = 1;
+
+      return 0;
+    }
+
+  call_depth++;
+  val = execute(prog, args + (size_t)fn -> nargs, args);
+  call_depth--;
+
+  if (m != NULL && !call_failed) /* The stack may have moved, but not the arguments */
+    {
+      m -> used   = 1;
+      m -> mode   = mode;
+      m -> result = val;
+      (void)memcpy(m -> args, &vm_stack [args], (size_t)fn -> nargs * sizeof(ULONG));
+    }
+
+  return val;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Whether a name is called as a function is settled when a statement is
+ * compiled, so a definition throws away every compiled statement, body and
+ * rule (and memo) that could have been compiled the other way.
+ */
+
+static void
+forget_compiled(void)
+{
+  size_t i;
+  int mode;
+
+  compile_generation++;
+
+  while (program_count > 0)
+    drop_oldest_program();
+
+  for (i = 0; i < rules_len; i++)
+    {
+      free_program(rules [i] -> prog);
+      rules [i] -> prog = NULL;
+    }
+
+  for (i = 0; i < function_count; i++)
+    {
+      for (mode = MODE_AUTO; mode <= MODE_UNSIGNED; mode++)
+        {
+          free_program(functions [i].prog [mode]);
+          functions [i].prog [mode] = NULL;
+        }
+
+      if (functions [i].memo != NULL)
+        (void)memset(functions [i].memo, 0, MEMO_SIZE * sizeof(memo));
+    }
+}
+
+/**************************************************************************************************/
+
+/* Let go of the functions defined since there were count of them */
+
+static void
+drop_functions(size_t count)
+{
+  if (function_count == count)
+    return;
+
+  forget_compiled();
+
+  while (function_count > count)
+    {
+      function_count--;
+      FREE(functions [function_count].text);
+      FREE(functions [function_count].memo);
+    }
+}
+
+/**************************************************************************************************/
+
+static char *
+skip_name(char *p)
+{
+  if (!( isalpha((unsigned char)*p) || *p == '_' ))
+    return p;
+
+  while (isalnum((unsigned char)*p) || *p == '_')
+    p++;
+
+  return p;
+}
+
+/**************************************************************************************************/
+
+static int
+def_error(function *fn, const char *format)
+{
+  (void)fprintf(stderr, format, (int)fn -> len, fn -> name);
+  FREE(fn -> text);
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * 'def [pure] name(a, b) = expression', where text follows the 'def'.
+ * Returns 0 if it isn't one after all (so 'def' is just a variable).
+ */
+
+static int
+define_function(char *text)
+{
+  function fn, *slot;
+  program *prog;
+  char *p, *q;
+  int i, index;
+
+  (void)memset(&fn, 0, sizeof ( fn ));
+
+  if ((fn.text = malloc(strlen(text) + 1)) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+
+      return 1;
+    }
+
+  p = skipwhite(strcpy(fn.text, text));
+  q = skip_name(p);
+
+  if (q - p == 4 && strncmp(p, "pure", 4) == 0 && isspace((unsigned char)*q)
+      && skip_name(skipwhite(q)) != skipwhite(q))
+    {
+      fn.pure = 1;
+      p = skipwhite(q);
+      q = skip_name(p);
+    }
+
+  fn.name = p;
+  /*LINTED: E_PTRDIFF_OVERFLOW*/
+  fn.len  = (size_t)(q - p);
+  p       = skipwhite(q);
+
+  if (fn.len == 0 || *p != LPAREN)
+    {
+      FREE(fn.text);
+
+      return 0;
+    }
+
+  if (is_reserved_name(fn.name, fn.len))
+    return def_error(&fn, "ERROR: can't define '%.*s', is a reserved name.\n");
+
+  p = skipwhite(p + 1);
+
+  while (*p != RPAREN)
+    {
+      q = skip_name(p);
+
+      if (q == p)
+        return def_error(&fn, "ERROR: 'def %.*s': expected argument names in parentheses.\n");
+
+      if (fn.nargs == FUNCTION_MAX_ARGS)
+        return def_error(&fn, "ERROR: 'def %.*s': too many arguments.\n");
+
+      for (i = 0; i < fn.nargs; i++)
+        if (fn.arg_len [i] == (size_t)(q - p) && memcmp(fn.arg_name [i], p, fn.arg_len [i]) == 0)
+          return def_error(&fn, "ERROR: 'def %.*s': argument named twice.\n");
+
+      fn.arg_name [fn.nargs] = p;
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      fn.arg_len [fn.nargs++] = (size_t)(q - p);
+      p = skipwhite(q);
+
+      if (*p == ',')
+        p = skipwhite(p + 1);
+      else if (*p != RPAREN)
+        return def_error(&fn, "ERROR: 'def %.*s': expected argument names in parentheses.\n");
+    }
+
+  p = skipwhite(p + 1);
+
+  if (*p != '=' || p [1] == '=' || *skipwhite(p + 1) == '\0')
+    return def_error(&fn, "ERROR: 'def %.*s': expected '= expression'.\n");
+
+  fn.body = skipwhite(p + 1);
+
+  if (fn.pure && (fn.memo = calloc(MEMO_SIZE, sizeof ( memo ))) == NULL)
+    return def_error(&fn, "ERROR: 'def %.*s': out of memory\n");
+
+  if ((index = find_function(fn.name, fn.len)) >= 0) /* Redefined */
+    {
+      slot = &functions [index];
+      forget_compiled();
+      FREE(slot -> text);
+      FREE(slot -> memo);
+    }
+  else
+    {
+      slot = grow_array(functions, &functions_size, function_count, sizeof(function));
+
+      if (slot == NULL)
+        {
+          FREE(fn.memo);
+
+          return def_error(&fn, "ERROR: 'def %.*s': out of memory\n");
+        }
+
+      functions = slot;
+      forget_compiled();
+      slot = &functions [function_count++];
+    }
+
+  *slot = fn;
+
+  /* Compiled now for the current mode, to report any mistakes in it */
+
+  if ((prog = compile_function(slot, arithmetic_mode)) != NULL)
+    for (i = 0; (size_t)i < prog -> code_len; i++)
+      if (prog -> code [i].op == OP_DIAG)
+        {
+          const message *m = &prog -> msgs [prog -> code [i].arg];
+
+          (void)fprintf(stderr, m -> format, m -> len, m -> text);
+        }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Control statements: 'while (cond) { ... }', 'for (init; cond; step)
+ * { ... }' and 'if (cond) { ... } else { ... }' (where the else part may be
+ * another 'if').  A whole one is compiled into a single program, bodies and
+ * all, which is then run; it is not printed, but in a body any expression
+ * other than an assignment or unset prints its value, as in bc.
+ *
+ * The text comes from read_block(), a line at a time, and is compiled over
+ * again as it grows until it is complete.  Errors in the structure are
+ * reported straight away, and end the statement.
+ */
+
+static block_status block_state;
+static int          block_depth; /* Bodies open, while compiling */
+
+/**************************************************************************************************/
+
+/* Does p start with the word w (and not some longer name)? */
+
+static int
+is_word(const char *p, const char *end, const char *w)
+{
+  size_t len = strlen(w);
+
+  /*LINTED: E_PTRDIFF_OVERFLOW*/
+  return (size_t)(end - p) >= len && strncmp(p, w, len) == 0
+    && ( p + len == end || !( isalnum((unsigned char)p [len]) || p [len] == '_' ) );
+}
+
+/**************************************************************************************************/
+
+static char *
+skip_blank(char *p, const char *end)
+{
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+
+  return p;
+}
+
+/**************************************************************************************************/
+
+/* Is this the start of a control statement: while, for or if, then '('? */
+
+static const char *
+control_keyword(char *p, const char *end)
+{
+  static const char *const keywords [] = { "while", "for", "if", NULL };
+  int i;
+
+  for (i = 0; keywords [i] != NULL; i++)
+    if (is_word(p, end, keywords [i]))
+      {
+        char *q = p + strlen(keywords [i]);
+
+        while (q < end && ( *q == ' ' || *q == '\t' ))
+          q++;
+
+        if (q < end && *q == LPAREN)
+          return keywords [i];
+      }
+
+  return NULL;
+}
+
+/**************************************************************************************************/
+
+/* Skip a character constant, if it is one closed on the same line */
+
+static char *
+skip_char_constant(char *p, const char *end)
+{
+  char *q;
+
+  for (q = p + 1; q < end && *q != '\n'; q++)
+    if (*q == '\\' && q + 1 < end)
+      q++;
+    else if (*q == '\'')
+      return q;
+
+  return p;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Find where what starts at p ends: at the first of stop (any of the
+ * characters in it) outside brackets and character constants, or at a
+ * closer that matches nothing.  Returns NULL if it runs out of text.
+ */
+
+static char *
+scan_to(char *p, const char *end, const char *stop)
+{
+  int depth = 0;
+
+  for (; p < end; p++)
+    {
+      if (depth == 0 && strchr(stop, *p) != NULL)
+        return p;
+
+      if (*p == '\'')
+        p = skip_char_constant(p, end);
+      else if (*p == LPAREN || *p == LBRACE || *p == LBRACKET)
+        depth++;
+      else if (*p == RPAREN || *p == RBRACE || *p == RBRACKET)
+        {
+          if (depth == 0)
+            return p;
+
+          depth--;
+        }
+    }
+
+  return NULL;
+}
+
+/**************************************************************************************************/
+
+static void
+block_error(const char *format, const char *what)
+{
+  if (block_state != BLOCK_ERROR)
+    (void)fprintf(stderr, format, what);
+
+  block_state = BLOCK_ERROR;
+}
+
+/**************************************************************************************************/
+
+/* Instructions compiled from here on may be jumped to, so don't fold them into earlier ones */
+
+static size_t
+jump_target(void)
+{
+  if (compiling == NULL)
+    return 0;
+
+  return compiling -> barrier = compiling -> code_len;
+}
+
+/**************************************************************************************************/
+
+static size_t
+emit_jump(opcode op)
+{
+  size_t at = compiling != NULL ? compiling -> code_len : 0;
+
+  emit(op, 0, 0);
+
+  return at;
+}
+
+/**************************************************************************************************/
+
+static void
+patch_jump(size_t at, size_t target)
+{
+  if (compiling != NULL)
+    compiling -> code [at].arg = (ULONG)target;
+}
+
+/**************************************************************************************************/
+
+/* Compile the expression from start to stop, leaving its value on the stack */
+
+static void
+compile_text(char *start, char *stop)
+{
+  char saved = *stop;
+  token *tok;
+  long n;
+
+  *stop = '\0';
+
+  if ((n = tokenize(start)) < 0)
+    compiling = NULL;
+  else
+    {
+      tok = tokens;
+      compile_span(&tok, tokens + n);
+    }
+
+  *stop = saved;
+}
+
+/**************************************************************************************************/
+
+/* Does p start 'def name' (and so isn't using a variable called def)? */
+
+static int
+is_definition(char *p, const char *end)
+{
+  return is_word(p, end, "def") && skip_blank(p + 3, end) > p + 3
+    && skip_name(skip_blank(p + 3, end)) > skip_blank(p + 3, end);
+}
+/**************************************************************************************************/
+
+static int compile_control(char **pp, char *end);
+
+/**************************************************************************************************/
+
+/* One statement of a body, which ends at a newline, ';' or the closing '}' */
+
+static int
+compile_body_statement(char **pp, char *end)
+{
+  char *p = *pp, *stop, *last;
+  size_t len;
+
+  if (control_keyword(p, end) != NULL)
+    return compile_control(pp, end);
+
+  if ((stop = scan_to(p, end, ";\n")) == NULL)
+    {
+      block_state = BLOCK_MORE;
+
+      return 0;
+    }
+
+  for (last = stop; last > p && isspace((unsigned char)last [-1]); last--)
+    continue;
+
+  /*LINTED: E_PTRDIFF_OVERFLOW*/
+  len = (size_t)(last - p);
+  *pp = stop;
+
+  if (len == 0)
+    return 1;
+
+  if (NAME_IS(p, len, "vars") || NAME_IS(p, len, "regs") || NAME_IS(p, len, "help")
+      || NAME_IS(p, len, "mode") || NAME_IS(p, len, "quit"))
+    {
+      emit_message(OP_COMMAND, 0, NULL, p, (int)len);
+
+      return 1;
+    }
+
+#if defined (WITH_THREADS)
+  if (NAME_IS(p, len, "parallel"))
+    {
+      block_error("ERROR: '%s' can't be used inside a block.\n", "parallel");
+
+      return 0;
+    }
+#endif
+
+  if (NAME_IS(p, len, "auto") || NAME_IS(p, len, "signed") || NAME_IS(p, len, "unsigned")
+      || NAME_IS(p, len, "reactive") || is_word(p, last, "take") || is_definition(p, last))
+    {
+      *last = '\0'; /* The source is going anyway */
+      block_error("ERROR: '%s' can't be used inside a block.\n",
+                  is_word(p, last, "take") ? "take" : is_word(p, last, "def") ? "def" : p);
+
+      return 0;
+    }
 
-  if (con)
-    Close(con);
+  compile_text(p, last);
+  emit(statement_assigns || unset_mode ? OP_POP : OP_PRINT, 0, 0);
 
-  return rc;
+  return 1;
 }
-#endif
 
 /**************************************************************************************************/
 
-static ULONG
-parse_expression(char *str)
-{
-  ULONG val;
-  char *ptr = str;
+/* A body in braces, the statements in it separated by newlines or ';' */
 
-  unset_mode = 0;
+static int
+compile_body(char **pp, char *end, const char *keyword)
+{
+  char *p = skip_blank(*pp, end);
 
-  ptr = skipwhite(ptr);
+  if (p == end)
+    {
+      block_state = BLOCK_MORE;
 
-  if (ptr == NULL || *ptr == '\0')
-    return last_result;
+      return 0;
+    }
 
-  if (strcmp(ptr, "GT") == 0)
-    if (get_var("GT", &val))
-      {
-        print_time_reg("GT", val);
+  if (*p != LBRACE)
+    {
+      block_error("ERROR: '%s': expected '{' to start the body.\n", keyword);
 
-        return val;
-      }
+      return 0;
+    }
 
-  val = assignment_expr(&ptr);
-  last_result = val;
+  block_depth++;
+  p++;
 
-  if (*ptr != '\0')
-    (void)fprintf(stderr,
-        "Warning: extra characters found when parsing expression at: '%s'\n", ptr);
+  while (always)
+    {
+      while (p < end && ( isspace((unsigned char)*p) || *p == ';' ))
+        p++;
 
-  return val;
-}
+      if (p == end)
+        {
+          block_state = BLOCK_MORE;
 
-/**************************************************************************************************/
+          return 0;
+        }
 
-static int
-remove_var(char *name)
-{
-  variable *v, *prev = NULL;
+      if (*p == RBRACE)
+        break;
 
-  if (name == NULL)
-    return 0;
+      if (*p == RPAREN || *p == RBRACKET)
+        {
+          block_error("ERROR: '%s': mismatched ')' or ']' in the body.\n", keyword);
 
-  for (v = vars; v; prev = v, v = v -> next)
-    if (v -> name && strcmp(v -> name, name) == 0)
-      {
-        if (prev)
-          prev -> next = v -> next;
-        else
-          vars = v -> next;
+          return 0;
+        }
 
-        FREE(v -> name);
-        FREE(v);
+      if (!compile_body_statement(&p, end))
+        return 0;
+    }
 
-        return 1;
-      }
+  block_depth--;
+  *pp = p + 1;
 
-  return 0;
+  return 1;
 }
 
 /**************************************************************************************************/
 
-#define DEFAULT_LEN 32
+/* Find the parentheses after a keyword, returning the '(' and leaving *pp after the ')' */
 
 static char *
-get_var_name(char **str)
+control_header(char **pp, char *end, const char *keyword)
 {
-  size_t i, len = DEFAULT_LEN;
-  char *buff, *tmpbuff;
-
-  if (isalpha((unsigned char)**str) == 0 && **str != '_')
-    return NULL;
-
-  buff = malloc(len * sizeof ( char ));
-
-  if (buff == NULL)
-    return NULL;
+  char *open = strchr(*pp, LPAREN);
+  char *close;
 
-  /* First get the variable name */
+  if ((close = scan_to(open + 1, end, "")) == NULL)
+    {
+      block_state = BLOCK_MORE;
 
-  i = 0;
+      return NULL;
+    }
 
-  while (**str && ( isalnum((unsigned char)**str) || **str == '_' ))
+  if (*close != RPAREN)
     {
-      if (i >= len - 1)
-        {
-          len     *= 2;
-          tmpbuff  = realloc(buff, len);
+      block_error("ERROR: '%s': mismatched '('.\n", keyword);
 
-          if (tmpbuff == NULL)
-            {
-              FREE(buff);
-
-              return NULL;
-            }
+      return NULL;
+    }
 
-          buff = tmpbuff;
-        }
+  *pp = close + 1;
 
-      buff [i++] = **str;
-      *str      = *str + 1;
-    }
+  return open;
+}
 
-  buff [i] = '\0'; /* NULL terminate */
+/**************************************************************************************************/
 
-  /* Skip over any remaining junk */
-  while (isalnum((unsigned char)**str) || **str == '_')
-    *str = *str + 1;
+/* Compile an expression, if there is one between start and stop, discarding its value */
 
-  return buff;
+static void
+compile_discarded(char *start, char *stop)
+{
+  if (skip_blank(start, stop) < stop)
+    {
+      compile_text(start, stop);
+      emit(OP_POP, 0, 0);
+    }
 }
 
 /**************************************************************************************************/
 
-static ULONG
-assignment_expr(char **str)
+static int
+compile_control(char **pp, char *end)
 {
-  ULONG val;
-  char *orig_str;
-  char *var_name;
-  variable *v;
+  char *p = *pp, *open, *close, *cond, *step = NULL, *stop;
+  const char *keyword = control_keyword(p, end);
+  size_t top, exit_jump = 0, else_jump;
+  int has_exit = 1;
+
+  if ((open = control_header(&p, end, keyword)) == NULL)
+    return 0;
 
-  *str     = skipwhite(*str);
-  orig_str = *str;
-  var_name = get_var_name(str);
+  close = p - 1;
+  cond  = open + 1;
 
-  if (var_name == NULL)
+  if (keyword [0] == 'f') /* for (init; cond; step) */
     {
-      *str = orig_str;
+      if (( cond = scan_to(open + 1, close, ";") ) == NULL
+          || ( step = scan_to(cond + 1, close, ";") ) == NULL
+          || scan_to(step + 1, close, ";") != NULL)
+        {
+          block_error("ERROR: '%s': expected (init; condition; step).\n", keyword);
 
-      return logical_or_expr(str);
+          return 0;
+        }
+
+      compile_discarded(open + 1, cond);
+      cond++;
+      has_exit = skip_blank(cond, step) < step; /* No condition is always true */
     }
 
-  *str = skipwhite(*str);
+  top = jump_target();
 
-  if (*str != NULL && (**str == EQUAL && *( *str + 1 ) != EQUAL))
+  if (has_exit)
     {
-      char *peek;
+      compile_text(cond, step != NULL ? step : close);
+      exit_jump = emit_jump(OP_JUMP_FALSE);
+    }
 
-      *str = skipwhite(*str + 1); /* Skip the equal sign */
-      peek = skipwhite(*str);
+  if (!compile_body(&p, end, keyword))
+    return 0;
 
-      if (peek != NULL && (*peek == '\0' || *peek == SEMI_COLON))
-        {
-          if (is_register(var_name))
-            {
-              (void)fprintf(stderr, "ERROR: cannot unset register '%s'.\n", var_name);
-              val  = 0;
-              *str = peek;
-              unset_mode = 1;
-            }
-          else
-            {
-              int existed;
+  if (keyword [0] != 'i') /* while or for */
+    {
+      if (step != NULL)
+        compile_discarded(step + 1, close);
 
-              unset_silent = (*peek == SEMI_COLON);
-              existed = remove_var(var_name);
+      emit(OP_JUMP, 0, (ULONG)top);
 
-              if (existed && !unset_silent)
-                (void)fprintf(stdout, "Variable '%s' unset.\n", var_name);
-              else if (!existed && !unset_silent)
-                (void)fprintf(stderr, "Warning: no such variable '%s'.\n", var_name);
+      if (has_exit)
+        patch_jump(exit_jump, jump_target());
 
-              val  = 0;
-              *str = peek;
-              unset_mode = 1;
-            }
-        }
-      else
-        {
-          val  = assignment_expr(str); /* Go recursive! */
+      *pp = p;
 
-          if (unset_mode) /* RHS was an unset chain */
-            {
-              int existed = remove_var(var_name);
+      return 1;
+    }
 
-              if (existed && !unset_silent)
-                (void)fprintf(stdout, "Variable '%s' unset.\n", var_name);
-            }
-          else /* RHS was a normal expression */
-            {
-              unset_mode = 0; /* //-V1048 */
+  /* An if, and maybe an else */
 
-              if ((v = lookup_var(var_name)) == NULL)
-                (void)add_var(var_name, val);
-              else
-                {
-                  if (is_register(var_name))
-                    v -> value = truncate_register(var_name, val);
-                  else
-                    v -> value = val;
+  stop = skip_blank(p, end);
 
-                  if (strcmp(var_name, "GT") == 0)
-                    print_time_reg(var_name, v -> value);
-                }
-            }
-        }
-    }
-  else if (*str != NULL && ((( **str == PLUS || **str == MINUS
-        || **str == OR || **str == TIMES || **str == DIVISION
-        || **str == MODULO || **str == AND
-        || **str == XOR ) && *( *str + 1 ) == EQUAL )
-        || strncmp(*str, "<<=", 3) == 0 || strncmp(*str, ">>=", 3) == 0))
-    val = do_assignment_operator(str, var_name);
-  else
+  if (!is_word(stop, end, "else"))
     {
-      *str = orig_str;
-      val  = logical_or_expr(str); /* No equal sign, get var value */
-      *str = skipwhite(*str);
+      if (stop == end && block_depth == 0)
+        block_state = BLOCK_HELD; /* Unless the next line has the else */
 
-#if !defined (__func__)
-# define __func__ "assignment_expr" /* //-V1059 */
-# if defined (PC_FUNC)
-#  undef PC_FUNC
-# endif
-# define PC_FUNC
-#endif
+      patch_jump(exit_jump, jump_target());
+      *pp = p;
 
-      if (*str == NULL)
-        {
-          (void)fprintf(stderr, "FATAL: Bugcheck: str == NULL %s [%s:%d]\n",
-                        __FILE__, __func__, __LINE__);
-          abort();
-        }
+      return 1;
+    }
 
-#if defined (PC_FUNC)
-# undef __func__
-# undef PC_FUNC
-#endif
+  else_jump = emit_jump(OP_JUMP);
+  patch_jump(exit_jump, jump_target());
+  p = skip_blank(stop + 4, end);
+
+  if (p == end)
+    {
+      block_state = BLOCK_MORE;
+
+      return 0;
+    }
 
-      if (**str == EQUAL)
-        (void)fprintf(stderr, "Left hand side of expression is not assignable.\n");
+  if (control_keyword(p, end) != NULL && is_word(p, end, "if"))
+    {
+      if (!compile_control(&p, end))
+        return 0;
     }
+  else if (!compile_body(&p, end, "else"))
+    return 0;
 
-  if (var_name) /* //-V547 */
-    FREE(var_name);
+  patch_jump(else_jump, jump_target());
+  *pp = p;
 
-  return val;
+  return 1;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-do_assignment_operator(char **str, char *var_name)
-{
-  ULONG val;
-  variable *v;
-  char operator;
-
-  operator = **str;
+/*
+ * Compile the control statement at the start of str.  On BLOCK_DONE or
+ * BLOCK_HELD, *progp is the program and *used how much of str it took.
+ */
 
-  if (operator == SHIFT_L || operator == SHIFT_R)
-    *str = skipwhite(*str + 3);
-  else
-    *str = skipwhite(*str + 2); /* Skip the assignment operator */
+static block_status
+compile_block(const char *str, program **progp, size_t *used)
+{
+  program *prog;
+  char *p, *end;
 
-  val = assignment_expr(str); /* Go recursive! */
-  v = lookup_var(var_name);
+  *progp = NULL;
 
-  if (v == NULL)
+  if ((prog = calloc(1, sizeof ( program ))) == NULL
+      || (prog -> source = malloc(strlen(str) + 1)) == NULL)
     {
-      v = add_var(var_name, 0);
+      free_program(prog);
+      (void)fprintf(stderr, "ERROR: out of memory\n");
 
-      if (v == NULL)
-        return 0;
+      return BLOCK_ERROR;
     }
 
-  if (operator == PLUS)
-    {
-      if (v -> value > (ULONG)-1 - val)
-        errno = ERANGE;
-
-      v -> value += val;
-    }
-  else if (operator == MINUS)
-    {
-#if defined (USE_LONG_LONG)
-      if ((LONG)val > 0 && (LONG)v -> value < LLONG_MIN + (LONG)val)
-        errno = ERANGE;
-      else if ((LONG)val < 0 && (LONG)v -> value > LLONG_MAX + (LONG)val)
-        errno = ERANGE;
-#else
-      if ((LONG)val > 0 && (LONG)v -> value < LONG_MIN + (LONG)val)
-        errno = ERANGE;
-      else if ((LONG)val < 0 && (LONG)v -> value > LONG_MAX + (LONG)val)
-        errno = ERANGE;
-#endif
+  p   = strcpy(prog -> source, str);
+  end = p + strlen(p);
 
-      v -> value -= val;
-    }
-  else if (operator == AND)
-    v -> value &= val;
-  else if (operator == XOR)
-    v -> value ^= val;
-  else if (operator == OR)
-    v -> value |= val;
-  else if (operator == SHIFT_L)
-    {
-      if (val >= sizeof(ULONG) * CHAR_BIT)
-        {
-          errno = EINVAL;
-          (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n",
-                        xstrerror_l(errno));
-        }
+  prog -> mode = arithmetic_mode;
+  prog -> hook = external_var_lookup;
+  compiling    = prog;
+  block_state  = BLOCK_DONE;
+  block_depth  = 0;
 
-      v -> value <<= val;
-    }
-  else if (operator == SHIFT_R)
+  if (compile_control(&p, end))
     {
-      if (val >= sizeof(ULONG) * CHAR_BIT)
-        {
-          errno = EINVAL;
-          (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n", xstrerror_l(errno));
-        }
-
-      v -> value >>= val;
+      emit(OP_LAST, 0, 0);
+      emit(OP_END, 0, 0);
     }
-  else if (operator == TIMES)
-    {
-      if (val != 0 && v -> value > (ULONG)-1 / val)
-        errno = ERANGE;
 
-      v -> value *= val;
-    }
-  else if (operator == DIVISION)
+  if (compiling == NULL && block_state != BLOCK_ERROR) /* Out of memory */
     {
-      if (val == 0) /* Check, but still get the result! */
-        {
-          errno = EDOM;
-          (void)fprintf(stderr, "Warning: %s (Division by zero)\n", xstrerror_l(errno));
-          v -> value = 0;
-        }
-      else
-        v -> value /= val;
+      (void)fprintf(stderr, "ERROR: out of memory\n");
+      block_state = BLOCK_ERROR;
     }
-  else if (operator == MODULO)
+
+  compiling = NULL;
+
+  if (block_state == BLOCK_DONE || block_state == BLOCK_HELD)
     {
-      if (val == 0) /* Check, but still get the result! */
-        {
-          errno = EDOM;
-          (void)fprintf(stderr, "Warning: %s (Modulo by zero)\n", xstrerror_l(errno));
-          v -> value = 0;
-        }
-      else
-        v -> value %= val;
+      *progp = prog;
+      /*LINTED: E_PTRDIFF_OVERFLOW*/
+      *used  = (size_t)(p - prog -> source);
     }
   else
-    {
-      (void)fprintf(stderr, "Unknown operator: %c\n", operator);
-      v -> value = 0;
-    }
-
-  if (is_register(var_name))
-    v -> value = truncate_register(var_name, v -> value);
+    free_program(prog);
 
-  if (strcmp(var_name, "GT") == 0)
-    print_time_reg(var_name, v -> value);
-
-  return v -> value;
+  return block_state;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-logical_or_expr(char **str)
+/* Is the name one the external lookup hook (normally builtin_vars()) knows? */
+
+static int
+is_external_name(const char *name, size_t len)
 {
-  ULONG val, sum = 0;
+  ULONG tmp;
 
-  *str = skipwhite(*str);
-  sum  = logical_and_expr(str);
-  *str = skipwhite(*str);
+  if (external_var_lookup == NULL)
+    return 0;
 
-  while (*str != NULL && (**str == OR && *( *str + 1 ) == OR))
-    {
-      *str = skipwhite(*str + 2); /* Advance over the operator */
-      val  = logical_and_expr(str);
-      sum  = ( val || sum );
-    }
+  if (external_var_lookup == builtin_vars) /* Without reading e.g. 'rand' */
+    return find_builtin(name, len) != NULL;
 
-  return sum;
+  return external_var_lookup(name, len, &tmp) != 0;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-logical_and_expr(char **str)
+/*
+ * The binary operators, from the token that starts each and the one that
+ * must directly follow it (or TOK_END for none), tried in order so that
+ * '||' is found before '|' and '<<' and '<=' before '<'.  Higher levels
+ * bind tighter, and all of them group to the left.  The opcode used is
+ * op in auto mode, or sop or uop in signed or unsigned mode.
+ */
+
+#define LEVEL_TERM 10 /* Multiplication/Division *,%,/ */
+
+static const struct binary_operator
 {
-  ULONG val, sum = 0;
+  token_kind first;
+  token_kind second;
+  int        level;
+  opcode     op, sop, uop;
+} binary_operators [] =
+{
+  { TOK_OR,           TOK_OR,           1, OP_LOGOR,  OP_LOGOR,  OP_LOGOR  },
+  { TOK_AND,          TOK_AND,          2, OP_LOGAND, OP_LOGAND, OP_LOGAND },
+  { TOK_OR,           TOK_END,          3, OP_OR,     OP_OR,     OP_OR     },
+  { TOK_XOR,          TOK_END,          4, OP_XOR,    OP_XOR,    OP_XOR    },
+  { TOK_AND,          TOK_END,          5, OP_AND,    OP_AND,    OP_AND    },
+  { TOK_EQUAL,        TOK_EQUAL,        6, OP_EQ,     OP_EQ,     OP_EQ     },
+  { TOK_BANG,         TOK_EQUAL,        6, OP_NE,     OP_NE,     OP_NE     },
+  { TOK_LESS_THAN,    TOK_LESS_THAN,    8, OP_SHL,    OP_SHL,    OP_SHL    },
+  { TOK_GREATER_THAN, TOK_GREATER_THAN, 8, OP_SHR,    OP_SHR,    OP_SHR    },
+  { TOK_LESS_THAN,    TOK_EQUAL,        7, OP_LE,     OP_LE,     OP_ULE    },
+  { TOK_GREATER_THAN, TOK_EQUAL,        7, OP_GE,     OP_GE,     OP_UGE    },
+  { TOK_LESS_THAN,    TOK_END,          7, OP_LT,     OP_LT,     OP_ULT    },
+  { TOK_GREATER_THAN, TOK_END,          7, OP_GT,     OP_GT,     OP_UGT    },
+  { TOK_PLUS,         TOK_END,          9, OP_ADD,    OP_SADD,   OP_ADD    },
+  { TOK_MINUS,        TOK_END,          9, OP_SUB,    OP_SSUB,   OP_SUB    },
+  { TOK_TIMES,        TOK_END,         10, OP_MUL,    OP_SMUL,   OP_MUL    },
+  { TOK_DIVISION,     TOK_END,         10, OP_DIV,    OP_SDIV,   OP_DIV    },
+  { TOK_MODULO,       TOK_END,         10, OP_MOD,    OP_SMOD,   OP_MOD    }
+};
 
-  *str = skipwhite(*str);
-  sum  = or_expr(str);
-  *str = skipwhite(*str);
+/**************************************************************************************************/
 
-  while (*str != NULL && (**str == AND && *( *str + 1 ) == AND))
-    {
-      *str = skipwhite(*str + 2); /* Advance over the operator */
-      val  = or_expr(str);
-      sum  = ( val && sum );
-    }
+/* The binary operator t starts, if any */
+
+static const struct binary_operator *
+find_binary_operator(const token *t)
+{
+  size_t i;
 
-  return sum;
+  for (i = 0; i < sizeof ( binary_operators ) / sizeof ( binary_operators [0] ); i++)
+    if (binary_operators [i].first == t -> kind
+        && ( binary_operators [i].second == TOK_END || followed_by(t, binary_operators [i].second) ))
+      return &binary_operators [i];
+
+  return NULL;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-or_expr(char **str)
+/*
+ * The expression compiler keeps its place on a stack of its own, on the heap,
+ * rather than in calls of C functions, so no expression, however long or
+ * deeply nested, can run out of C stack.  Each frame is one of the old
+ * recursive descent functions, partway through: step says where to carry on
+ * once the frame it pushed is done.  Parsing 'x = (1 + y) * 2', say, the
+ * frames for the assignment, the conditional expression, the binary
+ * operators, the factor and the group are all on the stack as the group
+ * is compiled.
+ *
+ * Expressions may nest (in groups, assignments, branches of conditionals,
+ * and arguments) MAX_NESTING deep; an expression nested any deeper is an
+ * error.
+ */
+
+#if !defined (MAX_NESTING)
+# define MAX_NESTING 10000
+#endif
+
+typedef enum
 {
-  ULONG val, sum = 0;
+  PARSE_SPAN,          /* A statement, or the inside of a group            */
+  PARSE_GROUP,         /* '(', '{' or '[', with its mode                   */
+  PARSE_ASSIGN,        /* Assignments =, +=, *=, etc                       */
+  PARSE_CONDITIONAL,   /* Conditional ? :                                  */
+  PARSE_BRANCHES,      /* The branches of a conditional, from the '?'      */
+  PARSE_BINARY,        /* Binary operators, of level and above             */
+  PARSE_SHORT_CIRCUIT, /* The right operand of '&&' or '||'                */
+  PARSE_FACTOR,        /* Negation, Logical NOT ~, !                       */
+  PARSE_CALL           /* A call of a user function, from its '('          */
+} parse_kind;
+
+typedef struct parse_frame
+{
+  parse_kind         kind;
+  int                step;
+  int                level, last, flag;
+  token_kind         op;
+  arithmetic_mode_t  mode;
+  const struct binary_operator *bop;
+  const function    *fn;
+  token             *from, *end, *stop, *outer_end;
+  size_t             start, depth, barrier, skip, done;
+  int                arg, nargs;
+  int                old_unset, old_silent, old_assigns;
+} parse_frame;
 
-  *str = skipwhite(*str);
-  sum  = xor_expr(str);
-  *str = skipwhite(*str);
+static parse_frame *parse_stack      = NULL;
+static size_t       parse_stack_size = 0;
+static size_t       parse_len        = 0;
+static int          parse_nesting    = 0;
 
-  while (*str != NULL && (**str == OR && *( *str + 1 ) != OR))
-    {
-      *str = skipwhite(*str + 1); /* Advance over the operator */
-      val  = xor_expr(str);
-      sum |= val;
-    }
+/**************************************************************************************************/
 
-  return sum;
-}
+#define VALUE_DONE  0 /* What get_value() found */
+#define VALUE_GROUP 1
+#define VALUE_CALL  2
 
 /**************************************************************************************************/
 
-static ULONG
-xor_expr(char **str)
+/*
+ * Compile a value, unless it's a group or a call, which are left for the
+ * caller to compile: then *tok is left at the '(', '{' or '[' of the group
+ * (returning VALUE_GROUP), or the '(' of the call of function *index
+ * (returning VALUE_CALL).
+ */
+
+static int
+get_value(token **tok, int *index)
 {
-  ULONG val, sum = 0;
+  token *t = *tok;
+
+  if (t -> kind == TOK_CHAR) /* A character constant */
+    {
+      *tok = t + 1;
 
-  *str = skipwhite(*str);
-  sum  = and_expr(str);
-  *str = skipwhite(*str);
+      if (t -> err == CHAR_BAD_ESCAPE)
+        {
+          emit_diag("Invalid escape sequence.\n", NULL, 0);
+          emit(OP_PUSH, 0, 0);
+
+          return VALUE_DONE;
+        }
+
+      if (t -> err == CHAR_TOO_LONG)
+        emit(OP_WARN_CHAR, 0, 0);
 
-  while (*str != NULL && (**str == XOR))
+      emit(OP_PUSH, 0, t -> value);
+    }
+  else if (t -> kind == TOK_NUMBER) /* A regular number */
+    {
+      *tok = t + 1;
+
+      if (t -> err)
+        {
+          emit_message(OP_WARN_CONVERT, t -> err, NULL, t -> text, (int)t -> len);
+          emit(OP_PUSH, 0, t -> value);
+        }
+      else
+        emit(OP_CONST, 0, t -> value);
+    }
+  else if (t -> kind == TOK_DOT) /* '.' meaning use the last result */
     {
-      *str = skipwhite(*str + 1); /* Advance over the operator */
-      val  = and_expr(str);
-      sum ^= val;
+      *tok = t + 1;
+      emit(OP_LAST, 0, 0);
     }
+  else if (t -> kind == TOK_LPAREN
+        || t -> kind == TOK_LBRACE
+        || t -> kind == TOK_LBRACKET)
+    {
+      if (t -> close == NO_GROUP)
+        {
+          emit_diag("ERROR: mismatched '%.*s'\n", t -> text, 1);
+          emit(OP_PUSH, 0, 0);
 
-  return sum;
-}
+          return VALUE_DONE;
+        }
 
-/**************************************************************************************************/
+      return VALUE_GROUP;
+    }
+  else if (t -> kind == TOK_IDENT) /* A variable name */
+    {
+      *tok = t + 1;
 
-static ULONG
-and_expr(char **str)
-{
-  ULONG val, sum = 0;
+      if (is_reserved_name(t -> text, t -> len))
+        {
+          emit_diag("ERROR: can't assign/create '%.*s', is a reserved name.\n",
+                    t -> text, (int)t -> len);
+          emit(OP_PUSH, 0, 0);
 
-  *str = skipwhite(*str);
-  sum  = equality_expr(str);
-  *str = skipwhite(*str);
+          return VALUE_DONE;
+        }
 
-  while (*str != NULL && (**str == AND && *( *str + 1 ) != AND))
-    {
-      *str = skipwhite(*str + 1); /* Advance over the operator */
-      val  = equality_expr(str);
-      sum &= val;
-    }
+      if (( *index = arg_slot(t) ) >= 0)
+        {
+          emit(OP_ARG, 0, (ULONG)*index);
 
-  return sum;
-}
+          if (( ( *tok ) -> kind == TOK_PLUS || ( *tok ) -> kind == TOK_MINUS )
+              && followed_by(*tok, ( *tok ) -> kind))
+            emit_diag("%.*s is an argument, which can't be changed\n", t -> text, (int)t -> len);
 
-/**************************************************************************************************/
+          return VALUE_DONE;
+        }
 
-static ULONG
-equality_expr(char **str)
-{
-  ULONG val, sum = 0;
-  char op;
+      if (t [1].kind == TOK_LPAREN && t [1].text == t -> text + t -> len
+          && t [1].close != NO_GROUP
+          && ( *index = find_function(t -> text, t -> len) ) >= 0)
+        return VALUE_CALL;
 
-  *str = skipwhite(*str);
-  sum  = relational_expr(str);
-  *str = skipwhite(*str);
+      /* Builtins are read-only, so their '++' or '--' is not taken */
 
-  while (*str != NULL && (
-         ( **str == EQUAL && *( *str + 1 ) == EQUAL ) ||
-         ( **str == BANG  && *( *str + 1 ) == EQUAL )))
+      if (( ( *tok ) -> kind == TOK_PLUS || ( *tok ) -> kind == TOK_MINUS )
+          && followed_by(*tok, ( *tok ) -> kind))
+        {
+          if (find_register(t -> text, t -> len) != REG_NONE
+              || !is_external_name(t -> text, t -> len))
+            {
+              emit(( *tok ) -> kind == TOK_PLUS ? OP_LOAD_INC : OP_LOAD_DEC, 0, var_ref_index(t));
+              *tok = *tok + 2;
+            }
+          else
+            {
+              emit(OP_LOAD, 0, var_ref_index(t));
+              emit_diag("%.*s is a read-only variable\n", t -> text, (int)t -> len);
+            }
+        }
+      else
+        emit(OP_LOAD, 0, var_ref_index(t));
+    }
+  else
     {
-      op   = **str;
-      *str = skipwhite(*str + 2); /* Advance over the operator */
-      val  = relational_expr(str);
-
-      if (op == EQUAL)
-        sum = ( sum == val );
-      else if (op == BANG) /* //-V547 */
-        sum = ( sum != val );
+      emit_diag("Expecting left paren, brace, bracket, unary op, constant, or variable."
+                "  Got: '%.*s'\n", t -> text, rest_len(t));
+      emit(OP_PUSH, 0, 0);
     }
 
-  return sum;
+  return VALUE_DONE;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-relational_expr(char **str)
+/* Push a frame of kind, at step 0, returning NULL if it can't be (or shouldn't be) */
+
+static parse_frame *
+push_frame(parse_kind kind)
 {
-  ULONG val, sum = 0;
-  char op, equal_to = 0;
+  parse_frame *stack, *f;
+
+  if (kind == PARSE_ASSIGN && parse_nesting > MAX_NESTING)
+    return NULL;
 
-  *str = skipwhite(*str);
-  sum  = shift_expr(str);
-  *str = skipwhite(*str);
+  stack = grow_array(parse_stack, &parse_stack_size, parse_len, sizeof(parse_frame));
 
-  while (*str != NULL && (**str == LESS_THAN || **str == GREATER_THAN))
+  if (stack == NULL)
     {
-      equal_to = 0;
-      op = **str;
-
-      if (*( *str + 1 ) == EQUAL)
-        {
-          equal_to = 1;
-          *str = *str + 1; /* Skip initial operator */
-        }
+      compiling = NULL; /* compile_statement() notices */
 
-      *str = skipwhite(*str + 1); /* Advance over the operator */
-      val  = shift_expr(str);
+      return NULL;
+    }
 
-      /*
-       * Notice in automatic mode relational expressions are
-       * performed as signed comparisons.  This is because of
-       * expressions like '0 > -1' which would not return the
-       * expected value if we did the comparison as unsigned.
-       */
+  parse_stack = stack;
+  f = &parse_stack [parse_len++];
+  (void)memset(f, 0, sizeof ( *f ));
+  f -> kind = kind;
 
-      if (arithmetic_mode == MODE_UNSIGNED)
-        {
-          if (op == LESS_THAN && equal_to == 0)
-            sum = (sum < val);
-          else if (op == LESS_THAN && equal_to == 1)
-            sum = (sum <= val);
-          else if (op == GREATER_THAN && equal_to == 0)
-            sum = (sum > val);
-          else if (op == GREATER_THAN && equal_to == 1)
-            sum = (sum >= val);
-        }
-      else
-        {
-          if (op == LESS_THAN && equal_to == 0)
-            sum = ((LONG)sum < (LONG)val );
-          else if (op == LESS_THAN && equal_to == 1)
-            sum = ((LONG)sum <= (LONG)val );
-          else if (op == GREATER_THAN && equal_to == 0)
-            sum = ((LONG)sum > (LONG)val );
-          else if (op == GREATER_THAN && equal_to == 1)
-            sum = ((LONG)sum >= (LONG)val );
-        }
-    }
+  if (kind == PARSE_ASSIGN)
+    parse_nesting++;
 
-  return sum;
+  return f;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-shift_expr(char **str)
-{
-  ULONG val, sum = 0;
-  char op;
+/*
+ * A term ends at t: if what follows isn't an operator, or the end of the
+ * string, it's an error and we print a message.
+ */
 
-  *str = skipwhite(*str);
-  sum  = add_expression(str);
-  *str = skipwhite(*str);
+static void
+end_term(token *t)
+{
+  if (t == expr_end) /* Such as the ',' after an argument */
+    return;
 
-  while (*str != NULL && ((strncmp(*str, "<<", 2) == 0) ||
-                          (strncmp(*str, ">>", 2) == 0)))
+  switch (t -> kind)
     {
-      op   = **str;
-      *str = skipwhite(*str + 2); /* Advance over the operator */
-      val  = add_expression(str);
-
-      if (val >= sizeof(ULONG) * CHAR_BIT)
-        {
-          errno = EINVAL;
-          (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n",
-                        xstrerror_l(errno));
-        }
+      case TOK_NUMBER:
+      case TOK_CHAR:
+      case TOK_IDENT:
+      case TOK_DOT:
+      case TOK_LPAREN:
+      case TOK_LBRACE:
+      case TOK_LBRACKET:
+      case TOK_OTHER:
+        emit_diag("Parsing stopped: unknown operator '%.*s'\n", t -> text, rest_len(t));
+        break;
 
-      if (op == SHIFT_L)
-        sum <<= val;
-      else if (op == SHIFT_R)
-        sum >>= val;
+      default:
+        break;
     }
-
-  return sum;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-add_expression(char **str)
+/* Is *tok the start of an assignment operator (+=, <<=, etc)? */
+
+static int
+is_assignment_operator(const token *t)
 {
-  ULONG val, sum = 0;
-  char op;
+  return (( t -> kind == TOK_PLUS || t -> kind == TOK_MINUS
+         || t -> kind == TOK_OR || t -> kind == TOK_TIMES || t -> kind == TOK_DIVISION
+         || t -> kind == TOK_MODULO || t -> kind == TOK_AND
+         || t -> kind == TOK_XOR ) && followed_by(t, TOK_EQUAL) )
+       || ( t -> kind == TOK_LESS_THAN && followed_by(t, TOK_LESS_THAN)
+            && followed_by(t + 1, TOK_EQUAL) )
+       || ( t -> kind == TOK_GREATER_THAN && followed_by(t, TOK_GREATER_THAN)
+            && followed_by(t + 1, TOK_EQUAL) );
+}
 
-  *str = skipwhite(*str);
-  sum  = term(str);
-  *str = skipwhite(*str);
+/**************************************************************************************************/
 
-  while (*str != NULL && (**str == PLUS || **str == MINUS))
-    {
-      op   = **str;
-      *str = skipwhite(*str + 1); /* Advance over the operator */
-      val  = term(str);
+/* The opcode for a binary operator in the current mode */
 
-      if (op == PLUS)
-        {
-          if (arithmetic_mode == MODE_SIGNED)
-            sum = (ULONG)((LONG)sum + (LONG)val);
-          else
-            {
-              if (sum > (ULONG)-1 - val)
-                errno = ERANGE;
-              sum += val;
-            }
-        }
-      else if (op == MINUS) /* //-V547 */
-        {
-          if (arithmetic_mode == MODE_SIGNED)
-            sum = (ULONG)((LONG)sum - (LONG)val);
-          else
-            {
-#if defined (USE_LONG_LONG)
-              if ((LONG)val > 0 && (LONG)sum < LLONG_MIN + (LONG)val)
-                errno = ERANGE;
-              else if ((LONG)val < 0 && (LONG)sum > LLONG_MAX + (LONG)val)
-                errno = ERANGE;
-#else
-              if ((LONG)val > 0 && (LONG)sum < LONG_MIN + (LONG)val)
-                errno = ERANGE;
-              else if ((LONG)val < 0 && (LONG)sum > LONG_MAX + (LONG)val)
-                errno = ERANGE;
-#endif
-              sum -= val;
-            }
-        }
-    }
+static opcode
+mode_operator(const struct binary_operator *bop)
+{
+  if (arithmetic_mode == MODE_SIGNED)
+    return bop -> sop;
+
+  if (arithmetic_mode == MODE_UNSIGNED)
+    return bop -> uop;
 
-  return sum;
+  return bop -> op;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-term(char **str)
+/*
+ * If there are any messages in the code from start on, compile them again
+ * in its place, with the stack depth and barrier as they were there.
+ */
+
+static int
+hoist_diags(size_t start, size_t depth, size_t barrier)
 {
-  ULONG val, sum = 0;
-  char op;
+  instruction *diags;
+  size_t i, n;
 
-  sum  = factor(str);
-  *str = skipwhite(*str);
+  for (i = start, n = 0; i < compiling -> code_len; i++)
+    n += ( compiling -> code [i].op == OP_DIAG );
 
-  while (*str != NULL &&
-         (**str == TIMES || **str == DIVISION || **str == MODULO))
-    {
-      op   = **str;
-      *str = skipwhite(*str + 1);
-      val  = factor(str);
+  if (n == 0 || ( diags = malloc(n * sizeof ( instruction )) ) == NULL)
+    return 0;
 
-      if (op == TIMES)
-        {
-          if (arithmetic_mode == MODE_SIGNED)
-            sum = (ULONG)((LONG)sum * (LONG)val);
-          else
-            {
-              if (val != 0 && sum > (ULONG)-1 / val)
-                errno = ERANGE;
-              sum *= val;
-            }
-        }
-      else if (op == DIVISION)
-        {
-          if (val == 0)
-            {
-              errno = EDOM;
-              (void)fprintf(stderr, "Warning: %s (Division by zero)\n",
-                            xstrerror_l(errno));
-              sum = 0;
-            }
-          else
-            {
-              if (arithmetic_mode == MODE_SIGNED)
-                sum = (ULONG)((LONG)sum / (LONG)val);
-              else
-                sum /= val;
-            }
-        }
-      else if (op == MODULO) /* //-V547 */
-        {
-          if (val == 0)
-            {
-              errno = EDOM;
-              (void)fprintf(stderr, "Warning: %s (Modulo by zero)\n",
-                            xstrerror_l(errno));
-              sum = 0;
-            }
-          else
-            {
-              if (arithmetic_mode == MODE_SIGNED)
-                sum = (ULONG)((LONG)sum % (LONG)val);
-              else
-                sum %= val;
-            }
-        }
-    }
+  for (i = start, n = 0; i < compiling -> code_len; i++)
+    if (compiling -> code [i].op == OP_DIAG)
+      diags [n++] = compiling -> code [i];
 
-  /*
-   * We're at the bottom of the parse.  At this point we either have
-   * an operator or we're through with this string.  Otherwise it's
-   * an error and we print a message.
-   */
+  compiling -> code_len = start;
+  compiling -> depth    = depth;
+  compiling -> barrier  = barrier;
 
-  if (*str != NULL && (**str != TIMES
-                   &&  **str != DIVISION
-                   &&  **str != MODULO
-                   &&  **str != PLUS
-                   &&  **str != MINUS
-                   &&  **str != OR
-                   &&  **str != AND
-                   &&  **str != XOR
-                   &&  **str != BANG
-                   &&  **str != NEGATIVE /* //-V560 */
-                   &&  **str != TWIDDLE
-                   &&  **str != RPAREN
-                   &&  **str != RBRACE
-                   &&  **str != RBRACKET
-                   &&  **str != LESS_THAN
-                   &&  **str != GREATER_THAN
-                   &&  **str != SEMI_COLON
-                   &&  strncmp(*str, "<<", 2) != 0
-                   &&  strncmp(*str, ">>", 2) /* //-V526 */
-                   &&  **str != EQUAL &&
-                       **str != '\0'))
-    {
-      (void)fprintf(stderr, "Parsing stopped: unknown operator '%s'\n", *str);
+  for (i = 0; i < n; i++)
+    emit(OP_DIAG, diags [i].aux, diags [i].arg);
 
-      return sum;
-    }
+  FREE(diags);
 
-  return sum;
+  return 1;
 }
 
 /**************************************************************************************************/
 
-static ULONG
-factor(char **str)
+/*
+ * Compile the tokens from *tok, which should run exactly up to end: the
+ * whole statement, or the inside of a group.
+ */
+
+static void
+compile_span(token **tok, token *end)
 {
-  ULONG val = 0;
-  char op = NOTHING, have_special = 0;
-  char *var_name, *var_name_ptr;
-  variable *v;
+  size_t base = parse_len, code_len = 0, depth = 0, barrier = 0;
+  arithmetic_mode_t mode = arithmetic_mode;
+  token *outer_end = expr_end, *at = *tok, *t;
+  int nesting = parse_nesting, hidden = hide_diags, index;
+  const char *why = "ERROR: expression nested too deeply.\n"; /* Why the statement's abandoned */
+  const function *bad = NULL;
+  parse_frame *f;
+
+  if (compiling != NULL)
+    {
+      code_len = compiling -> code_len;
+      depth    = compiling -> depth;
+      barrier  = compiling -> barrier;
+    }
+
+  if (( f = push_frame(PARSE_SPAN) ) == NULL)
+    return;
+
+  f -> end = end;
 
-  if (**str == NEGATIVE || **str == PLUS || **str == TWIDDLE || **str == BANG)
+  while (parse_len > base)
     {
-      op = **str; /* Must be a unary op */
+      f = &parse_stack [parse_len - 1];
 
-      if (( op == NEGATIVE && *( *str + 1 ) == NEGATIVE ) || /* Look for -- */
-          ( op == PLUS     && *( *str + 1 ) == PLUS ))       /* Look for ++ */
+      switch (f -> kind)
         {
-          *str = *str + 1;
-          have_special = 1;
-        }
+          case PARSE_SPAN:
+            if (f -> step == 0)
+              {
+                f -> outer_end    = expr_end;
+                unset_mode        = 0;
+                statement_assigns = 0;
+
+                if (at == f -> end)
+                  {
+                    emit(OP_LAST, 0, 0);
+                    break;
+                  }
+
+                if (at -> kind == TOK_IDENT && at -> len == 2 && strncmp(at -> text, "GT", 2) == 0
+                    && at -> text + 2 == f -> end -> text)
+                  {
+                    at = f -> end;
+                    emit(OP_SHOW_GT, 0, 0);
+                    break;
+                  }
+
+                expr_end  = f -> end;
+                f -> step = 1;
+
+                if (push_frame(PARSE_ASSIGN) == NULL)
+                  goto too_deep;
+
+                continue;
+              }
+
+            emit(OP_SET_LAST, 0, 0);
+
+            if (at < f -> end)
+              emit_diag("Warning: extra characters found when parsing expression at: '%.*s'\n",
+                        at -> text, rest_len(at));
+
+            expr_end = f -> outer_end;
+            break;
 
-      *str = skipwhite(*str + 1);
-      var_name_ptr = *str; /* Save where the varname should be */
-    }
+          case PARSE_GROUP: /* The mode override only lasts until the matching closer */
+            if (f -> step == 0)
+              {
+                f -> mode = arithmetic_mode;
+                f -> end  = tokens + at -> close;
 
-  val  = get_value(str);
-  *str = skipwhite(*str);
+                if (at -> kind == TOK_LBRACE)
+                  arithmetic_mode = MODE_UNSIGNED;
+                else if (at -> kind == TOK_LBRACKET)
+                  arithmetic_mode = MODE_SIGNED;
 
-  /* Now is the time to actually do the unary operation if one was present. */
+                at        = at + 1;
+                f -> step = 1;
+                t         = f -> end;
 
-  if (have_special) /* We've got a ++ or -- */
-    {
-      var_name = get_var_name(&var_name_ptr);
+                if (( f = push_frame(PARSE_SPAN) ) == NULL)
+                  goto too_deep;
 
-      if (var_name == NULL)
-        {
-          (void)fprintf(stderr, "Can only use ++/-- on variables.\n");
+                f -> end = t;
+                continue;
+              }
 
-          return val;
-        }
+            arithmetic_mode = f -> mode;
+            at = f -> end + 1;
+            break;
 
-      if ((v = lookup_var(var_name)) == NULL)
-        {
-          v = add_var(var_name, 0);
+          case PARSE_ASSIGN:
+            if (f -> step == 0)
+              {
+                f -> from = at;
+
+                if (at -> kind != TOK_IDENT || arg_slot(at) >= 0) /* Arguments are values */
+                  f -> step = 4;
+                else if (at [1].kind == TOK_EQUAL && !followed_by(at + 1, TOK_EQUAL))
+                  {
+                    at = at + 2; /* Skip the equal sign */
+
+                    if (at == expr_end || at -> kind == TOK_SEMI_COLON)
+                      {
+                        if (find_register(f -> from -> text, f -> from -> len) != REG_NONE)
+                          {
+                            emit_diag("ERROR: cannot unset register '%.*s'.\n",
+                                      f -> from -> text, (int)f -> from -> len);
+                            emit(OP_PUSH, 0, 0);
+                          }
+                        else
+                          {
+                            unset_silent = ( at -> kind == TOK_SEMI_COLON );
+                            emit(OP_UNSET, unset_silent, var_ref_index(f -> from));
+                          }
+
+                        unset_mode        = 1;
+                        statement_assigns = 1;
+                        break;
+                      }
+
+                    f -> step = 1;
+
+                    if (push_frame(PARSE_ASSIGN) == NULL) /* Go recursive! */
+                      goto too_deep;
+
+                    continue;
+                  }
+                else if (is_assignment_operator(at + 1))
+                  {
+                    f -> op   = at [1].kind;
+                    at        = at + ( f -> op == TOK_LESS_THAN || f -> op == TOK_GREATER_THAN ? 4 : 3 );
+                    f -> step = 2;
+
+                    if (push_frame(PARSE_ASSIGN) == NULL) /* Go recursive! */
+                      goto too_deep;
+
+                    continue;
+                  }
+                else
+                  f -> step = 3; /* No equal sign, get var value */
+
+                if (push_frame(PARSE_CONDITIONAL) == NULL)
+                  goto too_deep;
+
+                continue;
+              }
+
+            if (f -> step == 1)
+              {
+                if (unset_mode) /* RHS was an unset chain */
+                  emit(OP_REMOVE, unset_silent, var_ref_index(f -> from));
+                else /* RHS was a normal expression */
+                  {
+                    unset_mode = 0; /* //-V1048 */
+                    emit(OP_ASSIGN, 0, var_ref_index(f -> from));
+                  }
+
+                statement_assigns = 1;
+              }
+            else if (f -> step == 2)
+              {
+                emit(OP_ASSIGN_OP, (int)f -> op, var_ref_index(f -> from));
+                statement_assigns = 1;
+              }
+            else
+              {
+                statement_assigns = 0;
+
+                if (f -> step == 3 && at -> kind == TOK_EQUAL)
+                  emit_diag("Left hand side of expression is not assignable.\n", NULL, 0);
+              }
+            break;
 
-          if (v == NULL)
-            {
-              FREE(var_name);
+          /*
+           * 'condition ? a : b' runs only the branch selected.  If either
+           * branch has a mistake in it, the messages about it are given
+           * first, whichever branch is taken, and the branches compiled
+           * again without them.
+           */
 
-              return val;
-            }
-        }
+          case PARSE_CONDITIONAL:
+            if (f -> step == 0)
+              {
+                f -> step = 1;
 
-      if (op == PLUS)
-        v -> value++;
-      else
-        v -> value--;
+                if (( f = push_frame(PARSE_BINARY) ) == NULL)
+                  goto too_deep;
 
-      if (is_register(var_name))
-        v -> value = truncate_register(var_name, v -> value);
+                continue;
+              }
 
-      val = v -> value;
+            if (f -> step == 1)
+              {
+                if (at == expr_end || at -> kind != TOK_QUESTION || compiling == NULL)
+                  break;
 
-      FREE(var_name);
-    }
-  else /* Normal unary operator */
-    switch (op)
-      {
-        case NEGATIVE:
-#if defined (_MSC_VER)
-# pragma warning( disable : 4146 )
-#endif
-#if defined (USE_LONG_LONG)
-          val *= -(ULONG)1LL;
-#else
-          val *= -(ULONG)1L;
-#endif
-#if defined (_MSC_VER)
-# pragma warning( default : 4146 )
-#endif
-          break;
+                f -> from    = at;
+                f -> start   = compiling -> code_len;
+                f -> depth   = compiling -> depth;
+                f -> barrier = compiling -> barrier;
+                f -> step    = 2;
 
-        case BANG:
-          val = !val;
-          break;
+                if (push_frame(PARSE_BRANCHES) == NULL)
+                  goto too_deep;
 
-        case TWIDDLE:
-          val = ~val;
-          break;
+                continue;
+              }
 
-        default:
-          break;
-      }
+            if (f -> step == 2)
+              {
+                if (compiling == NULL || hide_diags > 0)
+                  break;
 
-  return val;
-}
+                if (!hoist_diags(f -> start, f -> depth, f -> barrier))
+                  break;
 
-/**************************************************************************************************/
+                at        = f -> from;
+                f -> step = 3;
+                hide_diags++;
 
-static char *
-find_matching_paren(char *str, char open_paren, char close_paren)
-{
-  int level = 1;
-  char *p = str;
+                if (push_frame(PARSE_BRANCHES) == NULL)
+                  goto too_deep;
 
-  while (*p)
-    {
-      if (*p == open_paren)
-        level++;
-      else if (*p == close_paren)
-        {
-          level--;
+                continue;
+              }
 
-          if (level == 0)
-            return p;
-        }
+            hide_diags--;
+            break;
 
-      p++;
-    }
+          case PARSE_BRANCHES:
+            if (f -> step == 0)
+              {
+                at        = at + 1; /* Skip the '?' */
+                f -> skip = emit_jump(OP_JUMP_FALSE);
+                f -> step = 1;
 
-  return NULL;
-}
+                if (push_frame(PARSE_ASSIGN) == NULL)
+                  goto too_deep;
 
-/**************************************************************************************************/
+                continue;
+              }
 
-static ULONG
-get_value(char **str)
-{
-  ULONG val;
-  char *var_name;
-  variable *v;
+            if (f -> step == 1)
+              {
+                f -> flag = ( at != expr_end && at -> kind == TOK_COLON );
 
-  if (**str == SINGLE_QUOTE) /* A character constant */
-    {
-      unsigned int i;
+                if (!f -> flag)
+                  emit_diag("Expecting ':' in conditional expression.  Got: '%.*s'\n",
+                            at -> text, rest_len(at));
 
-      *str = *str + 1; /* Advance over the leading quote */
-      val  = 0;
-      for (i = 0; **str && **str != SINGLE_QUOTE && i < sizeof ( LONG );
-           *str += 1, i++)
-        {
-          if (**str == '\\') /* Escape the next char */
-            {
-              *str += 1;
+                f -> done = emit_jump(OP_JUMP);
+                patch_jump(f -> skip, jump_target());
 
-              if (!**str)
-                {
-                  (void)fprintf(stderr, "Invalid escape sequence.\n");
+                if (compiling != NULL) /* Back to the depth after the first jump */
+                  compiling -> depth--;
 
-                  return 0;
-                }
-            }
+                f -> step = 2;
 
-          val <<= CHAR_BIT;
-          val  |= (ULONG)((unsigned)**str );
-        }
+                if (f -> flag)
+                  {
+                    at = at + 1;
 
-      if (**str != SINGLE_QUOTE) /* Constant must have been too long */
-        {
-          (void)fprintf(stderr,
-              "Warning: character constant not terminated or too long (max len == %ld bytes)\n",
-                        (long)sizeof ( LONG ));
+                    if (push_frame(PARSE_ASSIGN) == NULL) /* So 'a ? b : c ? d : e' groups to the right */
+                      goto too_deep;
 
-          while (**str && **str != SINGLE_QUOTE)
-            *str += 1;
-        }
-      else if (**str != '\0') /* //-V547 */
-        *str += 1;
-    }
-  else if (isdigit((unsigned char)**str)) /* A regular number */
-    {
-      char *orig_str = *str; /* Store original for errors, etc. */
-      errno = 0;
-      val = xstrtoUL(orig_str, str, 0);
+                    continue;
+                  }
 
-      if (errno)
-        {
-          /*LINTED: E_PTRDIFF_OVERFLOW*/
-          ptrdiff_t len = *str - orig_str;
-          (void)fprintf(stderr, "Warning when converting input%s%.*s%s: %s\n",
-                        /*LINTED: E_CAST_INT_TO_SMALL_INT*/
-                        len > 0 ? " '" : "", (int)len, orig_str,
-                        len > 0 ? "'" : "", xstrerror_l(errno));
-        }
+                emit(OP_PUSH, 0, 0);
+              }
 
-      *str = skipwhite(*str);
-    }
-  else if (**str == USE_LAST_RESULT) /* '.' meaning use the last result */
-    {
-      val  = last_result;
-      *str = skipwhite(*str + 1);
-    }
-  else if (**str == LPAREN
-        || **str == LBRACE
-        || **str == LBRACKET)
-    {
-      char open_paren = **str;
-      char close_paren;
-      arithmetic_mode_t old_mode = arithmetic_mode;
-      char *end_paren;
-      char *sub_expr_str;
-      size_t sub_expr_len;
+            patch_jump(f -> done, jump_target());
+            break;
 
-      if (open_paren == LPAREN)
-        close_paren = RPAREN;
-      else if (open_paren == LBRACE)
-        {
-          close_paren = RBRACE;
-          arithmetic_mode = MODE_UNSIGNED;
-        }
-      else
-        {
-          close_paren = RBRACKET;
-          arithmetic_mode = MODE_SIGNED;
-        }
+          /*
+           * Binary operators of level and above, by precedence climbing,
+           * each operand being a factor.
+           *
+           * Notice in automatic mode relational expressions are performed
+           * as signed comparisons.  This is because of expressions like
+           * '0 > -1' which would not return the expected value if we did
+           * the comparison as unsigned.
+           */
 
-      end_paren = find_matching_paren(*str + 1, open_paren, close_paren);
+          case PARSE_BINARY:
+            if (f -> step == 0)
+              {
+                f -> last = LEVEL_TERM;
+                f -> step = 1;
 
-      if (end_paren == NULL)
-        {
-          (void)fprintf(stderr, "ERROR: mismatched '%c'\n", open_paren);
+                if (push_frame(PARSE_FACTOR) == NULL)
+                  goto too_deep;
 
-          return 0;
-        }
+                continue;
+              }
 
-      /*LINTED: E_PTRDIFF_OVERFLOW */
-      sub_expr_len = (size_t)(end_paren - (*str + 1));
-      sub_expr_str = malloc(sub_expr_len + 1);
+            if (f -> step == 2)
+              emit(mode_operator(f -> bop), 0, 0);
 
-      if (sub_expr_str == NULL)
-        {
-          (void)fprintf(stderr, "ERROR: out of memory\n");
+            if (( f -> bop = find_binary_operator(at) ) != NULL && f -> bop -> level >= f -> level)
+              {
+                const struct binary_operator *bop = f -> bop;
 
-          return 0;
-        }
+                at = at + ( bop -> second == TOK_END ? 1 : 2 ); /* Advance over the operator */
+                f -> last = bop -> level;
 
-      (void)strncpy(sub_expr_str, *str + 1, sub_expr_len);
-      sub_expr_str [sub_expr_len] = '\0';
+                if (bop -> op == OP_LOGAND || bop -> op == OP_LOGOR)
+                  {
+                    f -> step = 1;
 
-      val = parse_expression(sub_expr_str);
+                    if (( f = push_frame(PARSE_SHORT_CIRCUIT) ) == NULL)
+                      goto too_deep;
+                  }
+                else
+                  {
+                    f -> step = 2;
 
-      FREE(sub_expr_str);
-      *str = end_paren + 1;
-      arithmetic_mode = old_mode;
-    }
-  else if (isalpha((unsigned char)**str) || **str == '_') /* A variable name */
-    {
-      if (( var_name = get_var_name(str)) == NULL)
-        {
-          (void)fprintf(stderr, "Can't get var name!\n");
+                    if (( f = push_frame(PARSE_BINARY) ) == NULL)
+                      goto too_deep;
 
-          return 0;
-        }
+                    f -> level = bop -> level + 1;
+                  }
 
-      if (is_reserved_name(var_name))
-        {
-          (void)fprintf(stderr, "ERROR: can't assign/create '%s', is a reserved name.\n",
-                        var_name);
-          FREE(var_name);
+                f -> bop = bop;
+                continue;
+              }
 
-          return 0;
-        }
+            /* We're at the bottom of the parse (unless a term ended further in) */
 
-      if (get_var(var_name, &val) == 0)
-        {
-          if (is_reserved_name(var_name))
-            {
-              (void)fprintf(stderr,
-                  "ERROR: can't assign/create '%s', is a reserved name.\n", var_name);
-              val = 0;
-            }
-          else
-            {
-              (void)fprintf(stderr, "No such variable: %s (assigning value of zero)\n", var_name);
-              val = 0;
-              v   = add_var(var_name, val);
+            if (f -> level <= LEVEL_TERM && f -> last == LEVEL_TERM)
+              end_term(at);
+            break;
+
+          /*
+           * The right operand of '&&' or '||' is only run if the left one
+           * (on the stack) doesn't already decide the result, 0 or 1.  A
+           * skipped operand does no arithmetic, creates no variables, and
+           * gives no warnings.  One with a mistake in it is run anyway, so
+           * it's reported.
+           */
+
+          case PARSE_SHORT_CIRCUIT:
+            if (f -> step == 0)
+              {
+                if (compiling == NULL)
+                  break;
+
+                f -> from    = at;
+                f -> start   = compiling -> code_len;
+                f -> depth   = compiling -> depth;
+                f -> barrier = compiling -> barrier;
+                f -> skip    = emit_jump(OP_JUMP_FALSE);
+                f -> step    = 1;
+
+                if (f -> bop -> op == OP_LOGAND)
+                  goto right_operand;
+
+                emit(OP_PUSH, 0, 1);
+                continue;
+              }
+
+            if (f -> step == 1)
+              {
+                if (f -> bop -> op == OP_LOGAND)
+                  {
+                    emit(OP_NOT, 0, 0);
+                    emit(OP_NOT, 0, 0);
+                  }
+
+                f -> done = emit_jump(OP_JUMP);
+                patch_jump(f -> skip, jump_target());
+
+                if (compiling != NULL) /* Back to the depth after the first jump */
+                  compiling -> depth--;
+
+                f -> step = 2;
+
+                if (f -> bop -> op == OP_LOGOR)
+                  goto right_operand;
+
+                emit(OP_PUSH, 0, 0);
+                continue;
+              }
+
+            if (f -> step == 2)
+              {
+                size_t i;
+
+                if (f -> bop -> op == OP_LOGOR)
+                  {
+                    emit(OP_NOT, 0, 0);
+                    emit(OP_NOT, 0, 0);
+                  }
+
+                patch_jump(f -> done, jump_target());
+
+                if (compiling == NULL)
+                  break;
+
+                for (i = f -> start; i < compiling -> code_len && compiling -> code [i].op != OP_DIAG; i++)
+                  continue;
+
+                if (i == compiling -> code_len)
+                  break;
+
+                compiling -> code_len = f -> start;
+                compiling -> depth    = f -> depth;
+                compiling -> barrier  = f -> barrier;
+                at        = f -> from;
+                f -> step = 3;
+                goto right_operand;
+              }
+
+            emit(f -> bop -> op, 0, 0);
+            break;
 
-              if (v == NULL)
+          right_operand:
+            index = f -> bop -> level + 1;
+
+            if (( f = push_frame(PARSE_BINARY) ) == NULL)
+              goto too_deep;
+
+            f -> level = index;
+            continue;
+
+          case PARSE_FACTOR:
+            if (f -> step == 0)
+              {
+                f -> op = TOK_END;
+
+                if (at -> kind == TOK_MINUS || at -> kind == TOK_PLUS
+                    || at -> kind == TOK_TWIDDLE || at -> kind == TOK_BANG)
+                  {
+                    f -> op = at -> kind; /* Must be a unary op */
+
+                    if (( f -> op == TOK_MINUS || f -> op == TOK_PLUS )
+                        && followed_by(at, f -> op)) /* Look for -- or ++ */
+                      {
+                        at = at + 1;
+                        f -> flag = 1;
+                      }
+
+                    at = at + 1;
+                    f -> from = at; /* Save where the varname should be */
+                  }
+
+                f -> step = 1;
+
+                switch (get_value(&at, &index))
+                  {
+                    case VALUE_GROUP:
+                      if (push_frame(PARSE_GROUP) == NULL)
+                        goto too_deep;
+
+                      continue;
+
+                    case VALUE_CALL:
+                      if (( f = push_frame(PARSE_CALL) ) == NULL)
+                        goto too_deep;
+
+                      f -> fn = &functions [index];
+                      continue;
+
+                    default:
+                      break;
+                  }
+              }
+
+            /* Now is the time to actually do the unary operation if one was present. */
+
+            if (f -> flag) /* We've got a ++ or -- */
+              {
+                if (f -> from -> kind != TOK_IDENT || arg_slot(f -> from) >= 0)
+                  emit_diag("Can only use ++/-- on variables.\n", NULL, 0);
+                else
+                  emit(f -> op == TOK_PLUS ? OP_PRE_INC : OP_PRE_DEC, 0, var_ref_index(f -> from));
+              }
+            else /* Normal unary operator */
+              switch (f -> op)
                 {
-                  FREE(var_name);
+                  case TOK_MINUS:
+                    emit(OP_NEG, 0, 0);
+                    break;
+
+                  case TOK_BANG:
+                    emit(OP_NOT, 0, 0);
+                    break;
 
-                  return 0;
+                  case TOK_TWIDDLE:
+                    emit(OP_COMPL, 0, 0);
+                    break;
+
+                  default:
+                    break;
                 }
-            }
-        }
+            break;
 
-      *str = skipwhite(*str);
+          /* A call of fn, each argument running up to a ',' or the ')' */
+
+          case PARSE_CALL:
+            if (f -> step == 0)
+              {
+                f -> end = tokens + at -> close;
+
+                for (t = at + 1; t < f -> end; t++) /* Count the arguments, skipping groups */
+                  if (( t -> kind == TOK_LPAREN || t -> kind == TOK_LBRACE
+                        || t -> kind == TOK_LBRACKET ) && t -> close != NO_GROUP)
+                    t = tokens + t -> close;
+                  else if (t -> kind == TOK_OTHER && *t -> text == ',')
+                    f -> nargs++;
+
+                if (f -> end > at + 1)
+                  f -> nargs++;
+
+                if (f -> nargs != f -> fn -> nargs)
+                  {
+                    why = "ERROR: wrong number of arguments for '%.*s'.\n";
+                    bad = f -> fn;
+                    goto too_deep;
+                  }
+
+                f -> from = at + 1;
+                f -> step = 1;
+              }
+            else if (f -> step == 2)
+              {
+                if (at < f -> stop)
+                  emit_diag("Warning: extra characters found when parsing expression at: '%.*s'\n",
+                            at -> text, rest_len(at));
+
+                expr_end          = f -> outer_end;
+                unset_mode        = f -> old_unset;
+                unset_silent      = f -> old_silent;
+                statement_assigns = f -> old_assigns;
+                f -> arg++;
+                f -> from = f -> stop + 1;
+                f -> step = 1;
+              }
+
+            for (; f -> arg < f -> nargs; f -> arg++, f -> from = f -> stop + 1)
+              {
+                for (t = f -> from; t < f -> end && !( t -> kind == TOK_OTHER && *t -> text == ',' ); t++)
+                  if (( t -> kind == TOK_LPAREN || t -> kind == TOK_LBRACE
+                        || t -> kind == TOK_LBRACKET ) && t -> close != NO_GROUP)
+                    t = tokens + t -> close;
+
+                f -> stop = t;
+
+                if (f -> from != f -> stop)
+                  break;
+
+                why = "ERROR: missing argument for '%.*s'.\n";
+                bad = f -> fn;
+                goto too_deep;
+              }
+
+            if (f -> arg < f -> nargs) /* Compile it, leaving the compiler's state as it was */
+              {
+                f -> outer_end   = expr_end;
+                f -> old_unset   = unset_mode;
+                f -> old_silent  = unset_silent;
+                f -> old_assigns = statement_assigns;
+                expr_end         = f -> stop;
+                at               = f -> from;
+                f -> step        = 2;
+
+                if (push_frame(PARSE_ASSIGN) == NULL)
+                  goto too_deep;
+
+                continue;
+              }
+
+            /*LINTED: E_PTRDIFF_OVERFLOW*/
+            emit(OP_CALL, f -> nargs, (ULONG)(f -> fn - functions));
+            at = f -> end + 1;
+            break;
+        }
 
-      if (*str != NULL &&
-          (strncmp(*str, "++", 2) == 0 || strncmp(*str, "--", 2) == 0))
-        {
-          if ((v = lookup_var(var_name)) != NULL)
-            {
-              if (**str == '+')
-                v -> value++;
-              else
-                v -> value--;
+      if (parse_stack [--parse_len].kind == PARSE_ASSIGN)
+        parse_nesting--;
+    }
 
-              if (is_register(var_name))
-                v -> value = truncate_register(var_name, v -> value);
+  *tok = at;
 
-              val = v -> value;
+  return;
 
-              *str = *str + 2;
-            }
-          else
-            (void)fprintf(stderr, "%s is a read-only variable\n", var_name);
-        }
+too_deep: /* Or out of memory, or a bad call: start again, with just the message */
+  parse_len       = base;
+  parse_nesting   = nesting;
+  hide_diags      = hidden;
+  arithmetic_mode = mode;
+  expr_end        = outer_end;
 
-      FREE(var_name);
-    }
-  else
+  if (compiling != NULL)
     {
-      (void)fprintf(stderr,
-          "Expecting left paren, brace, bracket, unary op, constant, or variable.");
-      (void)fprintf(stderr, "  Got: '%s'\n", *str);
-
-      return 0;
+      compiling -> code_len = code_len;
+      compiling -> depth    = depth;
+      compiling -> barrier  = barrier;
     }
 
-  return val;
+  if (bad != NULL)
+    emit_diag(why, bad -> name, (int)bad -> len);
+  else
+    emit_diag(why, NULL, 0);
+
+  emit(OP_PUSH, 0, 0);
+  unset_mode        = 1; /* Nothing to print */
+  statement_assigns = 0;
+  *tok = end;
 }
 
 /**************************************************************************************************/
 
+/**************************************************************************************************/
+
 static char *
 skipwhite(char *str)
 {
@@ -0,0 +1,1124 @@
+/**************************************************************************************************/
+
+/*
+ * pc2: programmer's calculator (runtime for translated files)
+ * SPDX-License-Identifier: MIT
+ */
+
+/**************************************************************************************************/
+
+/*
+ * Copyright (c) 1993 Dominic Giampaolo <dbg@be.com>
+ * Copyright (c) 1994 Joel Tesler <joel@engr.sgi.com>
+ * Copyright (c) 2005 Axel Dörfler <axeld@pinc-software.de>
+ * Copyright (c) 2005 Ingo Weinhold <ingo_weinhold@gmx.de>
+ * Copyright (c) 2009 Oliver Tappe <zooey@hirschkaefer.de>
+ * Copyright (c) 2017 Tuan Kiet Ho <tuankiet65@gmail.com>
+ * Copyright (c) 2019 Adrien Destugues <pulkomandy@pulkomandy.tk>
+ * Copyright (c) 2022-2026 Jeffrey H. Johnson <johnsonjh.dev@gmail.com>
+ * Copyright (c) 2022-2026 The DPS8M Development Team
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/**************************************************************************************************/
+
+/*
+ * What a file translated by 'pc --emit-c' needs to run without pc itself:
+ * variables and registers, printing results in every base, the modes, and
+ * calls to the functions it defines.  The translation defines the options
+ * pc was built with (USE_LONG_LONG, WITH_ROMAN, ...) before including this,
+ * and decides everything else (which names are builtins, what a constant
+ * builtin is worth, how each function body compiles) itself.
+ *
+ * This is for POSIX systems; pc.c itself is what runs everywhere else.
+ */
+
+#if !defined (PCRT_H)
+# define PCRT_H
+
+/**************************************************************************************************/
+
+# if !defined (_POSIX_C_SOURCE) && !defined (_XOPEN_SOURCE)
+#  define _POSIX_C_SOURCE 200112L /* For sysconf, pathconf, ... under -std=c99 */
+# endif
+
+# include <errno.h>    /* errno ...                                       */
+# include <limits.h>   /* LONG_MIN, ULONG_MAX ...                         */
+# include <locale.h>   /* setlocale ...                                   */
+# include <stdint.h>   /* UINT32_C, uint32_t ...                          */
+# include <stdio.h>    /* fprintf, fwrite, snprintf ...                   */
+# include <stdlib.h>   /* free, malloc, exit, (s)rand ...                 */
+# include <string.h>   /* memcmp, memcpy, strlen, strerror ...            */
+# include <time.h>     /* localtime, strftime, time ...                   */
+# include <unistd.h>   /* getpid, getuid, isatty, sysconf ...             */
+
+/**************************************************************************************************/
+
+# if defined (USE_LONG_LONG)
+#  define LONG  long long
+#  define ULONG unsigned long long
+# else
+#  define LONG  long
+#  define ULONG unsigned long
+# endif
+
+# if defined (__GNUC__)
+#  define PCRT_UNUSED __attribute__ ((unused)) /* Not every file needs each of these */
+# else
+#  define PCRT_UNUSED
+# endif
+
+# if !defined (OUTPUT_BUFF)
+#  define OUTPUT_BUFF ( 8 * BUFSIZ )
+# endif
+
+# define xstrerror_l strerror
+
+static const int never = 0;
+
+# define FREE(p)   \
+  do              \
+    {             \
+      free ((p)); \
+      (p) = NULL; \
+    }             \
+  while (never)
+
+/**************************************************************************************************/
+
+typedef enum
+{
+  MODE_AUTO,
+  MODE_SIGNED,
+  MODE_UNSIGNED
+} arithmetic_mode_t;
+
+typedef enum
+{
+  REG_GT,
+  REG_GC,
+  REG_GS,
+  REG_GI,
+  REG_GL,
+  REG_GLL,
+  REG_COUNT,
+  REG_NONE = -1
+} register_id;
+
+typedef struct variable
+{
+  char       *name;
+  size_t      len;
+  uint32_t    hash;
+  ULONG       value;
+  register_id reg;
+} variable;
+
+/* What a name in a translated statement was found to be, when it was translated */
+
+typedef enum
+{
+  REF_VARIABLE,  /* A variable or register                 */
+  REF_RESERVED,  /* A command's name, never a variable     */
+  REF_CONSTANT,  /* A builtin, with its value              */
+  REF_BUILTIN    /* A builtin that changes, by builtin_id  */
+} ref_kind;
+
+typedef struct var_ref
+{
+  const char   *name;
+  size_t        len;
+  ref_kind      kind;
+  ULONG         value;
+  variable     *var;
+  unsigned long gen;
+} var_ref;
+
+typedef struct message
+{
+  const char *format;
+  const char *text;
+  int         len;
+} message;
+
+/* The builtins that can't be worked out when a file is translated */
+
+typedef enum
+{
+  BV_ARG_MAX,
+  BV_CACHE_HITS,
+  BV_CACHE_MISSES,
+  BV_CHILD_MAX,
+  BV_ERRNO,
+  BV_FILESIZEBITS,
+  BV_GID,
+  BV_NAME_MAX,
+  BV_OPEN_MAX,
+  BV_PATH_MAX,
+  BV_PID,
+  BV_RAND,
+  BV_TIME,
+  BV_UID
+} builtin_id;
+
+/* A defined function, for call_function() */
+
+# define FUNCTION_MAX_ARGS 8
+# define MEMO_SIZE         64  /* Power of two */
+# define MAX_CALL_DEPTH    256
+
+typedef struct memo
+{
+  int               used;
+  arithmetic_mode_t mode;
+  ULONG             args [FUNCTION_MAX_ARGS];
+  ULONG             result;
+} memo;
+
+typedef struct function
+{
+  const char *name;
+  size_t      len;
+  int         nargs;
+  memo       *memo;                         /* MEMO_SIZE entries, if pure */
+} function;
+
+/**************************************************************************************************/
+
+static arithmetic_mode_t arithmetic_mode = MODE_AUTO;
+static int               call_failed     = 0; /* Abandon the statement */
+static int               call_depth      = 0;
+static size_t            target_line_len = 80;
+
+static PCRT_UNUSED ULONG last_result = 0; /* '.' */
+
+/* Counted as pc would count them, taking the file for the first time */
+
+static unsigned long cache_hits   = 0;
+static unsigned long cache_misses = 0;
+
+# define VAR_TABLE_MIN 64
+
+static variable    **var_table      = NULL;
+static size_t        var_table_size = 0; /* Always zero or a power of two */
+static size_t        var_count      = 0;
+static unsigned long var_generation = 0; /* Bumped as variables come and go */
+
+static variable registers [REG_COUNT] =
+{
+  { (char *)"GT",  2, 0, 0, REG_GT  },
+  { (char *)"GC",  2, 0, 0, REG_GC  },
+  { (char *)"GS",  2, 0, 0, REG_GS  },
+  { (char *)"GI",  2, 0, 0, REG_GI  },
+  { (char *)"GL",  2, 0, 0, REG_GL  },
+  { (char *)"GLL", 3, 0, 0, REG_GLL }
+};
+
+static const ULONG register_mask [REG_COUNT] =
+{
+  ~(ULONG)0,        /* GT  */
+  (ULONG)UCHAR_MAX, /* GC  */
+  (ULONG)USHRT_MAX, /* GS  */
+  (ULONG)UINT_MAX,  /* GI  */
+  (ULONG)ULONG_MAX, /* GL  */
+  ~(ULONG)0         /* GLL */
+};
+
+/**************************************************************************************************/
+
+static uint32_t
+hash32s(const void *buf, size_t len, uint32_t h)
+{
+  const unsigned char *p = buf;
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = h * 31 + p [i];
+
+  h ^= h >> 17;
+  h *= UINT32_C(0xed5ad4bb);
+  h ^= h >> 11;
+  h *= UINT32_C(0xac4c1b51);
+  h ^= h >> 15;
+  h *= UINT32_C(0x31848bab);
+  h ^= h >> 14;
+
+  return h;
+}
+
+/**************************************************************************************************/
+
+# if defined (WITH_BASE36) || defined (WITH_TERNARY)
+static char *
+convert_base_string(ULONG value, int base, char *buf, int buf_size)
+{
+  const char *digits = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+  char *ptr = &buf [(size_t)buf_size - 1];
+
+  *ptr = '\0';
+
+  if (value == 0)
+    {
+      *(--ptr) = '0';
+
+      return ptr;
+    }
+
+  while (value > 0 && ptr > buf)
+    {
+      *(--ptr) = digits [(unsigned char)(value % (ULONG)base)];
+      value /= (ULONG)base;
+    }
+
+  return ptr;
+}
+# endif
+
+/**************************************************************************************************/
+
+# if defined (WITH_ROMAN)
+static char *
+convert_to_roman(ULONG value)
+{
+  static char roman_buf [16];
+  static const char *const m [] = { "", "M", "MM", "MMM" };
+  static const char *const c [] = { "", "C", "CC", "CCC", "CD", "D", "DC", "DCC", "DCCC", "CM" };
+  static const char *const x [] = { "", "X", "XX", "XXX", "XL", "L", "LX", "LXX", "LXXX", "XC" };
+  static const char *const i [] = { "", "I", "II", "III", "IV", "V", "VI", "VII", "VIII", "IX" };
+
+  if (value == 0 || value > 3999)
+    return NULL;
+
+  (void)snprintf(roman_buf, sizeof(roman_buf), "%s%s%s%s", m [value / 1000],
+                 c [(value % 1000) / 100], x [(value % 100) / 10], i [value % 10]);
+
+  return roman_buf;
+}
+# endif
+
+/**************************************************************************************************/
+
+static char *
+get_binary_string(ULONG value)
+{
+  static char bin_buf [sizeof(ULONG) * CHAR_BIT + 1];
+  char *ptr = &bin_buf [sizeof(bin_buf) - 1];
+
+  *ptr = '\0';
+
+  do
+    {
+      *(--ptr) = (char)('0' + (int)(value & 1));
+      value >>= 1;
+    }
+  while (value != 0);
+
+  return ptr;
+}
+
+/**************************************************************************************************/
+
+/* As pc prints a result, fields wrapped at target_line_len */
+
+static void
+print_result(ULONG value)
+{
+  char dec_str [128];
+  char oct_str [30];
+  char hex_str [25];
+  char bin_str [80];
+# if defined (WITH_ROMAN)
+  char roman_str [23];
+  char *roman_value_converted;
+# endif
+# if defined (WITH_TERNARY)
+  char ter_str [50];
+  char ternary_str_buf [45];
+# endif
+# if defined (WITH_BASE36)
+  char b36_str [20];
+  char base36_str_buf [16];
+# endif
+  char extra_info [100] = "";
+  char char_repr [sizeof(ULONG) + 1];
+  int i;
+  int has_signed_info = 0;
+  int printable_chars_count = 0;
+  size_t line_len = 4;
+  const char *fields [8];
+  int field_index = 0;
+  char out [4 + 8 * ( sizeof ( dec_str ) + 6 ) + 1];
+  size_t out_len = 4;
+
+# if defined (USE_LONG_LONG)
+  (void)snprintf(dec_str, sizeof(dec_str), "dec: %llu", value);
+# else
+  (void)snprintf(dec_str, sizeof(dec_str), "dec: %lu", value);
+# endif
+
+  if ((LONG)value < 0)
+    {
+# if defined (USE_LONG_LONG)
+      (void)snprintf(extra_info, sizeof(extra_info), " signed: %lld", (LONG)value);
+# else
+      (void)snprintf(extra_info, sizeof(extra_info), " signed: %ld", (LONG)value);
+# endif
+      has_signed_info = 1;
+    }
+
+  for (i = 0; i < (int)sizeof(ULONG); i++)
+    {
+      ULONG ch = (value >> (i * CHAR_BIT)) & 0xFF;
+
+      if (ch >= 32 && ch <= 126) /* ASCII printable range */
+        {
+          char_repr [sizeof(ULONG) - 1 - (size_t)i] = (char)ch;
+          printable_chars_count++;
+        }
+      else
+        char_repr [sizeof(ULONG) - 1 - (size_t)i] = '.';
+    }
+
+  char_repr [sizeof(ULONG)] = '\0';
+
+  if (printable_chars_count > 0)
+    {
+      if (has_signed_info)
+        (void)snprintf(extra_info + strlen(extra_info),
+                       sizeof(extra_info) - strlen(extra_info),
+                       " char: '%s'", char_repr);
+      else
+        (void)snprintf(extra_info, sizeof(extra_info),
+                       " char: '%s'", char_repr);
+    }
+
+  (void)strncat(dec_str, extra_info, sizeof(dec_str) - strlen(dec_str) - 1);
+
+# if defined (USE_LONG_LONG)
+  (void)snprintf(oct_str, sizeof(oct_str), "oct: 0o%llo", value);
+# else
+  (void)snprintf(oct_str, sizeof(oct_str), "oct: 0o%lo", value);
+# endif
+
+  if (value == 0)
+    (void)snprintf(hex_str, sizeof(hex_str), "hex: 0x0");
+  else if (value <= 0xFFFFFFFFUL)
+    (void)snprintf(hex_str, sizeof(hex_str), "hex: 0x%lx", (unsigned long)value);
+  else
+# if defined (USE_LONG_LONG)
+    (void)snprintf(hex_str, sizeof(hex_str), "hex: 0x%llx", value);
+# else
+    (void)snprintf(hex_str, sizeof(hex_str), "hex: 0x%lx", value);
+# endif
+
+  fields [field_index++] = dec_str;
+  fields [field_index++] = oct_str;
+  fields [field_index++] = hex_str;
+
+# if defined (WITH_ROMAN)
+  if (value > 0 && value < 4000)
+    {
+      roman_value_converted = convert_to_roman(value);
+
+      if (NULL != roman_value_converted)
+        {
+          (void)snprintf(roman_str, sizeof(roman_str), "rom: 0r%s", roman_value_converted);
+          fields [field_index++] = roman_str;
+        }
+    }
+# endif
+
+# if defined (WITH_TERNARY)
+  (void)snprintf(ter_str, sizeof(ter_str), "ter: 0t%s",
+                 convert_base_string(value, 3, ternary_str_buf, sizeof(ternary_str_buf)));
+  fields [field_index++] = ter_str;
+# endif
+
+# if defined (WITH_BASE36)
+  (void)snprintf(b36_str, sizeof(b36_str), "b36: 0z%s",
+                 convert_base_string(value, 36, base36_str_buf, sizeof(base36_str_buf)));
+  fields [field_index++] = b36_str;
+# endif
+
+  (void)snprintf(bin_str, sizeof(bin_str), "bin: 0b%s", get_binary_string(value));
+  fields [field_index++] = bin_str;
+  fields [field_index] = NULL;
+
+  (void)memcpy(out, "    ", 4);
+
+  for (i = 0; fields [i] != NULL; i++)
+    {
+      size_t field_len = strlen(fields [i]);
+
+      if (line_len > 4 && line_len + field_len > target_line_len)
+        {
+          (void)memcpy(out + out_len, "\n     ", 6);
+          out_len += 6;
+          line_len = 5;
+        }
+
+      (void)memcpy(out + out_len, fields [i], field_len);
+      out_len  += field_len;
+      line_len += field_len;
+
+      if (fields [i + 1] != NULL)
+        {
+          out [out_len++] = ' ';
+          line_len++;
+        }
+    }
+
+  out [out_len++] = '\n';
+  (void)fwrite(out, 1, out_len, stdout); /* In one piece */
+}
+
+/**************************************************************************************************/
+
+/* Special formatting of GT time register */
+
+static void
+print_time_reg(const char *name, ULONG value)
+{
+  time_t time_val = (time_t)value;
+  struct tm *tm_info = localtime(&time_val);
+  char buf [256];
+
+  if (tm_info == NULL || strftime(buf, sizeof(buf), "%c", tm_info) == 0)
+    {
+      (void)fprintf(stderr, "Warning: strftime error: %s\n",
+                    (errno ? xstrerror_l (errno) : "unspecified trouble!"));
+
+      return;
+    }
+
+  (void)fprintf(stdout, "  %s: %s\n", name, buf);
+}
+
+/**************************************************************************************************/
+
+/* Registers are listed in register_id order */
+
+static void
+list_regs(void)
+{
+  int i;
+
+  (void)fprintf(stdout, "Registers:\n");
+
+  for (i = 0; i < REG_COUNT; i++)
+    {
+      if (i == REG_GT)
+        print_time_reg(registers [i].name, registers [i].value);
+      else
+        {
+          (void)fprintf(stdout, "  %s:\n", registers [i].name);
+          print_result(registers [i].value);
+        }
+    }
+}
+
+/**************************************************************************************************/
+
+static PCRT_UNUSED ULONG
+builtin_value(builtin_id id)
+{
+  switch (id)
+    {
+# if defined (_SC_ARG_MAX)
+      case BV_ARG_MAX:
+        return (ULONG)sysconf(_SC_ARG_MAX);
+# endif
+
+      case BV_CACHE_HITS:
+        return (ULONG)cache_hits;
+
+      case BV_CACHE_MISSES:
+        return (ULONG)cache_misses;
+
+# if defined (_SC_CHILD_MAX)
+      case BV_CHILD_MAX:
+        return (ULONG)sysconf(_SC_CHILD_MAX);
+# endif
+
+      case BV_ERRNO:
+        return (ULONG)errno;
+
+# if defined (_PC_FILESIZEBITS)
+      case BV_FILESIZEBITS:
+        return (ULONG)pathconf(".", _PC_FILESIZEBITS);
+# endif
+
+      case BV_GID:
+        return (ULONG)getgid();
+
+      case BV_NAME_MAX:
+        return (ULONG)pathconf(".", _PC_NAME_MAX);
+
+# if defined (_SC_OPEN_MAX)
+      case BV_OPEN_MAX:
+        return (ULONG)sysconf(_SC_OPEN_MAX);
+# endif
+
+      case BV_PATH_MAX:
+        return (ULONG)pathconf("/", _PC_PATH_MAX);
+
+      case BV_PID:
+        return (ULONG)getpid();
+
+      case BV_RAND:
+        return (ULONG)rand();
+
+      case BV_TIME:
+        return (ULONG)time(NULL);
+
+      case BV_UID:
+        return (ULONG)getuid();
+
+      default:
+        return 0;
+    }
+}
+
+/**************************************************************************************************/
+
+/*
+ * Variables are kept in an open-addressing hash table (linear probing) of
+ * pointers to individually allocated entries, just as in pc.
+ */
+
+static size_t
+find_var_slot(const char *name, size_t len, uint32_t hash)
+{
+  size_t mask = var_table_size - 1;
+  size_t i    = (size_t)hash & mask;
+
+  while (var_table [i] != NULL)
+    {
+      if (var_table [i] -> hash == hash && var_table [i] -> len == len &&
+          memcmp(var_table [i] -> name, name, len) == 0)
+        return i;
+
+      i = (i + 1) & mask;
+    }
+
+  return i;
+}
+
+/**************************************************************************************************/
+
+static variable *
+lookup_var(const char *name, size_t len)
+{
+  int i;
+
+  for (i = 0; i < REG_COUNT; i++)
+    if (registers [i].len == len && memcmp(registers [i].name, name, len) == 0)
+      return &registers [i];
+
+  if (var_count == 0)
+    return NULL;
+
+  return var_table [find_var_slot(name, len, hash32s(name, len, 0))];
+}
+
+/**************************************************************************************************/
+
+static int
+grow_var_table(void)
+{
+  size_t i, j, new_size;
+  variable **new_table;
+
+  new_size  = var_table_size ? var_table_size * 2 : VAR_TABLE_MIN;
+  new_table = calloc(new_size, sizeof(variable *));
+
+  if (new_table == NULL)
+    return 0;
+
+  for (i = 0; i < var_table_size; i++)
+    if (var_table [i] != NULL)
+      {
+        j = (size_t)var_table [i] -> hash & (new_size - 1);
+
+        while (new_table [j] != NULL)
+          j = (j + 1) & (new_size - 1);
+
+        new_table [j] = var_table [i];
+      }
+
+  FREE(var_table);
+  var_table      = new_table;
+  var_table_size = new_size;
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static variable *
+add_var(const var_ref *r, ULONG value)
+{
+  variable *v;
+
+  if (r -> kind == REF_RESERVED)
+    {
+      (void)fprintf(stderr, "ERROR: can't assign/create '%.*s', is a reserved name.\n",
+                    (int)r -> len, r -> name);
+
+      return NULL;
+    }
+
+  if (r -> kind != REF_VARIABLE)
+    {
+      (void)fprintf(stderr, "ERROR: can't assign/create '%.*s', it is a read-only variable\n",
+                    (int)r -> len, r -> name);
+
+      return NULL;
+    }
+
+  if ((var_count + 1) * 2 > var_table_size && !grow_var_table())
+    {
+      (void)fprintf(stderr, "ERROR: no memory to add variable '%.*s'\n", (int)r -> len, r -> name);
+
+      return NULL;
+    }
+
+  v = malloc(sizeof ( variable ));
+
+  if (v == NULL || (v -> name = malloc(r -> len + 1)) == NULL)
+    {
+      (void)fprintf(stderr, "ERROR: no memory to add variable '%.*s'\n", (int)r -> len, r -> name);
+      FREE(v);
+
+      return NULL;
+    }
+
+  (void)memcpy(v -> name, r -> name, r -> len);
+  v -> name [r -> len] = '\0';
+  v -> len   = r -> len;
+  v -> hash  = hash32s(r -> name, r -> len, 0);
+  v -> value = value;
+  v -> reg   = REG_NONE;
+
+  var_table [find_var_slot(r -> name, r -> len, v -> hash)] = v;
+  var_count++;
+  var_generation++;
+
+  return v;
+}
+
+/**************************************************************************************************/
+
+static PCRT_UNUSED int
+remove_var(const char *name, size_t len)
+{
+  size_t i, j, k, mask;
+  variable *v;
+
+  if (var_count == 0)
+    return 0;
+
+  mask = var_table_size - 1;
+  i    = find_var_slot(name, len, hash32s(name, len, 0));
+  v    = var_table [i];
+
+  if (v == NULL)
+    return 0;
+
+  for (j = i;;) /* Backward-shift deletion, as in pc */
+    {
+      j = (j + 1) & mask;
+
+      if (var_table [j] == NULL)
+        break;
+
+      k = (size_t)var_table [j] -> hash & mask;
+
+      if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
+        {
+          var_table [i] = var_table [j];
+          i = j;
+        }
+    }
+
+  var_table [i] = NULL;
+  var_count--;
+  var_generation++;
+
+  FREE(v -> name);
+  FREE(v);
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static ULONG
+truncate_register(const variable *v, ULONG value)
+{
+  if (v -> reg == REG_NONE)
+    return value;
+
+  return value & register_mask [v -> reg];
+}
+
+/**************************************************************************************************/
+
+static variable *
+ref_var(var_ref *r)
+{
+  if (r -> gen != var_generation)
+    {
+      r -> var = lookup_var(r -> name, r -> len);
+      r -> gen = var_generation;
+    }
+
+  return r -> var;
+}
+
+/**************************************************************************************************/
+
+/* Fetch a name's value, creating it as zero if there is no such variable (0 if that fails) */
+
+static PCRT_UNUSED int
+load_var(var_ref *r, ULONG *val)
+{
+  variable *v;
+
+  if (r -> kind == REF_CONSTANT)
+    *val = r -> value;
+  else if (r -> kind == REF_BUILTIN)
+    *val = builtin_value((builtin_id)r -> value);
+  else if ((v = ref_var(r)) != NULL)
+    *val = v -> value;
+  else
+    {
+      (void)fprintf(stderr, "No such variable: %.*s (assigning value of zero)\n",
+                    (int)r -> len, r -> name);
+      *val = 0;
+
+      if (add_var(r, 0) == NULL)
+        return 0;
+    }
+
+  return 1;
+}
+
+/**************************************************************************************************/
+
+static PCRT_UNUSED ULONG
+step_var(var_ref *r, ULONG val, int delta)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL)
+    {
+      (void)fprintf(stderr, "%.*s is a read-only variable\n", (int)r -> len, r -> name);
+
+      return val;
+    }
+
+  if (delta > 0)
+    v -> value++;
+  else
+    v -> value--;
+
+  v -> value = truncate_register(v, v -> value);
+
+  return v -> value;
+}
+
+/**************************************************************************************************/
+
+static PCRT_UNUSED void
+store_var(var_ref *r, ULONG val)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL)
+    (void)add_var(r, val);
+  else
+    {
+      v -> value = truncate_register(v, val);
+
+      if (v -> reg == REG_GT)
+        print_time_reg(v -> name, v -> value);
+    }
+}
+
+/**************************************************************************************************/
+
+/* Does a - b overflow, taken as signed?  (Subtraction sets errno to ERANGE if so) */
+
+static PCRT_UNUSED int
+sub_overflows(ULONG a, ULONG b)
+{
+# if defined (USE_LONG_LONG)
+  return ( (LONG)b > 0 && (LONG)a < LLONG_MIN + (LONG)b )
+      || ( (LONG)b < 0 && (LONG)a > LLONG_MAX + (LONG)b );
+# else
+  return ( (LONG)b > 0 && (LONG)a < LONG_MIN + (LONG)b )
+      || ( (LONG)b < 0 && (LONG)a > LONG_MAX + (LONG)b );
+# endif
+}
+
+/**************************************************************************************************/
+
+/* 'a op= val', the operator given by its character ('<' and '>' for the shifts) */
+
+static PCRT_UNUSED ULONG
+assign_operator(var_ref *r, char operator, ULONG val)
+{
+  variable *v = ref_var(r);
+
+  if (v == NULL && (v = add_var(r, 0)) == NULL)
+    return 0;
+
+  switch (operator)
+    {
+      case '+':
+        if (v -> value > (ULONG)-1 - val)
+          errno = ERANGE;
+
+        v -> value += val;
+        break;
+
+      case '-':
+        if (sub_overflows(v -> value, val))
+          errno = ERANGE;
+
+        v -> value -= val;
+        break;
+
+      case '&':
+        v -> value &= val;
+        break;
+
+      case '^':
+        v -> value ^= val;
+        break;
+
+      case '|':
+        v -> value |= val;
+        break;
+
+      case '<':
+      case '>':
+        if (val >= sizeof(ULONG) * CHAR_BIT)
+          {
+            errno = EINVAL;
+            (void)fprintf(stderr, "Warning: %s (Shift too many bits)\n", xstrerror_l(errno));
+          }
+
+        if (operator == '<')
+          v -> value <<= val;
+        else
+          v -> value >>= val;
+
+        break;
+
+      case '*':
+        if (val != 0 && v -> value > (ULONG)-1 / val)
+          errno = ERANGE;
+
+        v -> value *= val;
+        break;
+
+      case '/':
+      case '%':
+        if (val == 0) /* Check, but still get the result! */
+          {
+            errno = EDOM;
+            (void)fprintf(stderr, "Warning: %s (%s by zero)\n", xstrerror_l(errno),
+                          operator == '/' ? "Division" : "Modulo");
+            v -> value = 0;
+          }
+        else if (operator == '/')
+          v -> value /= val;
+        else
+          v -> value %= val;
+
+        break;
+
+      default:
+        break;
+    }
+
+  v -> value = truncate_register(v, v -> value);
+
+  if (v -> reg == REG_GT)
+    print_time_reg(v -> name, v -> value);
+
+  return v -> value;
+}
+
+/**************************************************************************************************/
+
+/*
+ * Call a translated body (body, compiled for the caller's mode) with its
+ * arguments, as pc calls a function: no deeper than MAX_CALL_DEPTH, and
+ * through its memo if it's pure.
+ */
+
+static PCRT_UNUSED ULONG
+call_function(const function *fn, ULONG (*body)(const ULONG *), const ULONG *args,
+              arithmetic_mode_t mode)
+{
+  memo *m = NULL;
+  ULONG val;
+
+  if (call_depth >= MAX_CALL_DEPTH)
+    {
+      (void)fprintf(stderr, "ERROR: '%.*s': function calls nested too deeply.\n",
+                    (int)fn -> len, fn -> name);
+      call_failed = 1;
+
+      return 0;
+    }
+
+  if (fn -> memo != NULL)
+    {
+      m = &fn -> memo [hash32s(args, (size_t)fn -> nargs * sizeof(ULONG),
+                               (uint32_t)mode) & (MEMO_SIZE - 1)];
+
+      if (m -> used && m -> mode == mode
+          && memcmp(m -> args, args, (size_t)fn -> nargs * sizeof(ULONG)) == 0)
+        return m -> result;
+    }
+
+  call_depth++;
+  val = body(args);
+  call_depth--;
+
+  if (m != NULL && !call_failed)
+    {
+      m -> used   = 1;
+      m -> mode   = mode;
+      m -> result = val;
+      (void)memcpy(m -> args, args, (size_t)fn -> nargs * sizeof(ULONG));
+    }
+
+  return val;
+}
+
+/**************************************************************************************************/
+
+static void
+print_current_mode(void)
+{
+  (void)fprintf(stdout, "Current mode is '%s'.\n", arithmetic_mode == MODE_SIGNED ? "signed"
+                : arithmetic_mode == MODE_UNSIGNED ? "unsigned" : "auto");
+}
+
+/**************************************************************************************************/
+
+/* The commands a translated file can run: 'regs', 'mode', the modes, and 'quit' */
+
+static PCRT_UNUSED void
+run_command(const char *cmd)
+{
+  if (strcmp(cmd, "regs") == 0)
+    list_regs();
+  else if (strcmp(cmd, "mode") == 0)
+    print_current_mode();
+  else if (strcmp(cmd, "auto") == 0)
+    {
+      arithmetic_mode = MODE_AUTO;
+      (void)fprintf(stdout, "Mode set to 'auto'.\n");
+    }
+  else if (strcmp(cmd, "signed") == 0)
+    {
+      arithmetic_mode = MODE_SIGNED;
+      (void)fprintf(stdout, "Mode set to 'signed'.\n");
+    }
+  else if (strcmp(cmd, "unsigned") == 0)
+    {
+      arithmetic_mode = MODE_UNSIGNED;
+      (void)fprintf(stdout, "Mode set to 'unsigned'.\n");
+    }
+  else if (strcmp(cmd, "quit") == 0)
+    exit(0);
+}
+
+/**************************************************************************************************/
+
+/* A translated expression, printed unless it assigns (or a call in it failed) */
+
+static PCRT_UNUSED void
+run_expression(ULONG (*fn)(void), int unset)
+{
+  ULONG value;
+
+  call_failed = 0;
+  value       = fn();
+
+  if (!call_failed && !unset)
+    print_result(value);
+}
+
+/**************************************************************************************************/
+
+/* A translated control statement, which prints what it prints itself */
+
+static PCRT_UNUSED void
+run_block(ULONG (*fn)(void))
+{
+  call_failed = 0;
+  (void)fn();
+}
+
+/**************************************************************************************************/
+
+/* What pc does before reading any input */
+
+static void
+startup(void)
+{
+  FILE *f;
+  uint32_t h;
+  unsigned char rnd [4];
+
+  (void)setlocale (LC_ALL, "");
+
+  /*LINTED: E_CAST_INT_TO_SMALL_INT*/
+  h = (uint32_t)time(NULL);
+  f = fopen("/dev/urandom", "rb");
+
+  if (f)
+    {
+      if (fread(&rnd, sizeof(rnd), 1, f) == 1)
+        h = hash32s(&rnd, sizeof(rnd), h);
+
+      (void)fclose(f);
+    }
+
+  srand(h);
+
+  if (!isatty(STDOUT_FILENO)) /* A terminal stays line buffered */
+    (void)setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFF);
+}
+
+/**************************************************************************************************/
+
+#endif /* !defined (PCRT_H) */
+
+/**************************************************************************************************/
+/* vim: set ts=2 sw=2 tw=0 ai expandtab cc=100 : */
+/**************************************************************************************************/